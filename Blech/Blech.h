@@ -53,22 +53,41 @@ Using Blech:
         }
     }
 
+    *Print variables are looked up once per Feed.  To keep them between Feeds until
+    they change, also pass a generation callback:
+    Blech MyBlech('#','|',VariableValue,VariableGeneration);
+
     *Feed Blech:
     MyBlech.Feed("Text with some portion");
 
+    *Or feed a block of lines, each one's events fire before the next is matched:
+    const char *Lines[]={"Text with some portion","Text with more portion"};
+    MyBlech.FeedBatch(Lines,2,MAX_STRING);
+
     *Examine output:
     MyEvent(1,0,(pointer))
     'variable'=>'some'
 
+    *Or take the captures as pieces of the line, without copies:
+    void __stdcall MySpanEvent(unsigned int ID, void * pData, const char *Input, PBLECHCAPTURE pCaptures, unsigned int nCaptures)
+    {
+        for (unsigned int N=0;N<nCaptures;N++)
+            printf("'%s'=>'%.*s'",pCaptures[N].Name,pCaptures[N].Length,&Input[pCaptures[N].Offset]);
+    }
+    MyBlech.AddEvent("Text with #variable# portion",MySpanEvent,0);
+
 ******************************************************************************/
 
 #pragma once
 //#pragma warning(disable : 4996)
 
-#define BLECHVERSION "Lax/Blech 1.7.4"
+#define BLECHVERSION "Lax/Blech 1.10.0"
 
+#include <algorithm>
+#include <deque>
 #include <map>
 #include <string>
+#include <vector>
 
 //#ifdef WIN32
 
@@ -131,32 +150,50 @@ typedef struct _BLECHVALUE {
     struct _BLECHVALUE *pNext;
 } BLECHVALUE, *PBLECHVALUE;
 
-typedef struct _BLECHLISTNODE {
-    class BlechNode *pNode;
-    struct _BLECHLISTNODE *pNext;
-} BLECHLISTNODE, *PBLECHLISTNODE;
+#define BLECH_NOLITERAL 0xFFFFFFFF
 
 
 typedef unsigned int   (__stdcall *fBlechVariableValue)(char *VarName, char *Value, size_t Valuelen);
+// returns a number that changes whenever VarName's value could have, or 0 if it can change at any time
+typedef unsigned int   (__stdcall *fBlechVariableGeneration)(char *VarName);
 typedef void (__stdcall *fBlechCallback)(unsigned int ID, void * pData, PBLECHVALUE pValues);
 
+// a capture is a piece of the line that was fed, it is not terminated
+typedef struct _BLECHCAPTURE {
+    const char *Name;
+    unsigned int Offset;
+    unsigned int Length;
+} BLECHCAPTURE, *PBLECHCAPTURE;
+
+// Input and pCaptures are only good until the callback returns
+typedef void (__stdcall *fBlechSpanCallback)(unsigned int ID, void * pData, const char *Input, PBLECHCAPTURE pCaptures, unsigned int nCaptures);
+
 typedef struct _BLECHEVENT {
     unsigned int ID;
     void * pData;
     const char *OriginalString;
-    fBlechCallback Callback;
+    fBlechCallback Callback;            // one of these is set
+    fBlechSpanCallback SpanCallback;
 
     class BlechNode *pBlechNode;
 } BLECHEVENT, *PBLECHEVENT;
 
-typedef struct _BLECHEXECUTE {
+// matches and their captures are queued in arrays kept per Feed depth, which are cut
+// back after every walk, so matching doesn't allocate once they've grown to fit
+typedef struct _BLECHSPAN {
+    unsigned int Name;      // offset of the terminated name in the string arena
+    unsigned int Offset;
+    unsigned int Length;
+} BLECHSPAN, *PBLECHSPAN;
+
+typedef struct _BLECHMATCH {
     unsigned int ID;
     void * pData;
-
     fBlechCallback Callback;
-    struct _BLECHVALUE *pValues;
-    struct _BLECHEXECUTE *pNext;
-} BLECHEXECUTE, *PBLECHEXECUTE;
+    fBlechSpanCallback SpanCallback;
+    unsigned int Span;      // first of nSpans in the span arena
+    unsigned int nSpans;
+} BLECHMATCH, *PBLECHMATCH;
 
 //typedef std::map<unsigned int,BLECHEVENT> BLECHEVENTMAP; 
 
@@ -167,6 +204,28 @@ typedef struct _BLECHEVENTNODE {
     struct _BLECHEVENTNODE *pPrev;
 } BLECHEVENTNODE, *PBLECHEVENTNODE;
 
+/*
+    Compiled trees
+    Each Tree[] root is flattened into its nodes in preorder.  Matching a node
+    moves on to the next op (its first child, or whatever follows it), failing
+    jumps to Skip, past everything under it.  The parent's match position is kept
+    per depth, so there is no match stack to overflow, and the path QueueEvents
+    needs for a node with events is worked out once here instead of per match.
+*/
+typedef struct _BLECHOP {
+    class BlechNode *pNode;
+    unsigned int Depth;         // Positions[Depth] is where the parent's match ended
+    unsigned int Skip;          // first op past this node's subtree
+    unsigned int Path;          // index into Paths of the nodes from the root down to this one
+    unsigned int nPath;         // 0 unless the node has events
+    int nVariableNodes;         // scan variables on the path
+} BLECHOP, *PBLECHOP;
+
+typedef struct _BLECHPROGRAM {
+    std::vector<BLECHOP> Ops;
+    std::vector<class BlechNode*> Paths;
+} BLECHPROGRAM, *PBLECHPROGRAM;
+
 static unsigned int Equalness(const char *StringA, const char *StringB)
 {
     BlechDebugFull("Equalness(%s,%s)",StringA,StringB);
@@ -234,6 +293,8 @@ public:
         pNext=0;
         pPrev=0;
         pEvents=0;
+        Literal=BLECH_NOLITERAL;
+        Variable=0;
     }
 
     ~BlechNode()
@@ -401,6 +462,161 @@ public:
     BlechNode *pPrev;
 
     PBLECHEVENTNODE pEvents;
+
+    unsigned int Literal; // index in the Tree[0] prefilter, or BLECH_NOLITERAL
+    unsigned int Variable; // print variables: index of its snapshot in each Feed level
+};
+
+/*
+    BlechPrefilter
+    Patterns that begin with a variable all live under Tree[0], and every literal
+    node there costs a STRFIND over the whole line.  A literal node can only match
+    if its text appears somewhere in the line, so all of them are put in one
+    Aho-Corasick automaton and found in a single pass before Tree[0] is walked.
+    Chew then skips any literal (and everything under it) that wasn't found.
+*/
+class BlechPrefilter
+{
+public:
+	BlechPrefilter()
+	{
+		Stamp = 0;
+		Clear();
+	}
+
+	void Clear()
+	{
+		memset(ClassOf, 0, sizeof(ClassOf));
+		Classes = 1;
+		Next.assign(Classes, 0);
+		Match.assign(1, std::vector<unsigned int>());
+		Output.assign(1, -1);
+		Visited.assign(1, 0);
+		Seen.clear();
+	}
+
+	// numbers every literal node under pRoot and builds the automaton from them
+	void Build(BlechNode *pRoot)
+	{
+		std::vector<BlechNode*> Nodes;
+		Collect(pRoot, Nodes);
+		Clear();
+		for (size_t N = 0; N < Nodes.size(); N++)
+		{
+			for (const char *p = Nodes[N]->pString; *p; p++)
+			{
+				unsigned char c = Fold(*p);
+				if (!ClassOf[c])
+					ClassOf[c] = Classes++;
+			}
+		}
+		Next.assign(Classes, 0);
+		for (unsigned int N = 0; N < (unsigned int)Nodes.size(); N++)
+		{
+			int State = 0;
+			for (const char *p = Nodes[N]->pString; *p; p++)
+			{
+				int Class = ClassOf[Fold(*p)];
+				if (!Next[State*Classes + Class])
+				{
+					Next[State*Classes + Class] = (int)Match.size();
+					Next.resize(Next.size() + Classes, 0);
+					Match.push_back(std::vector<unsigned int>());
+				}
+				State = Next[State*Classes + Class];
+			}
+			Match[State].push_back(N);
+			Nodes[N]->Literal = N;
+		}
+		// breadth first, fill in the failure links and turn the trie into a full DFA
+		std::vector<int> Fail(Match.size(), 0);
+		Output.assign(Match.size(), -1);
+		std::vector<int> Queue;
+		for (int C = 0; C < Classes; C++)
+			if (int Child = Next[C])
+				Queue.push_back(Child);
+		for (size_t Q = 0; Q < Queue.size(); Q++)
+		{
+			int State = Queue[Q];
+			// the nearest state down the failure chain that ends a literal
+			Output[State] = Match[Fail[State]].size() ? Fail[State] : Output[Fail[State]];
+			for (int C = 0; C < Classes; C++)
+			{
+				int &Child = Next[State*Classes + C];
+				int FailNext = Next[Fail[State] * Classes + C];
+				if (Child)
+				{
+					Fail[Child] = FailNext;
+					Queue.push_back(Child);
+				}
+				else
+					Child = FailNext;
+			}
+		}
+		Visited.assign(Match.size(), 0);
+		Seen.assign(Nodes.size(), 0);
+		Stamp = 0;
+	}
+
+	// marks every literal that appears in Input
+	void Scan(const char *Input)
+	{
+		if (!++Stamp)
+		{
+			// wrapped, forget the old marks
+			Visited.assign(Visited.size(), 0);
+			Seen.assign(Seen.size(), 0);
+			Stamp = 1;
+		}
+		int State = 0;
+		for (const char *p = Input; *p; p++)
+		{
+			State = Next[State*Classes + ClassOf[Fold(*p)]];
+			// a state reached before in this line has already marked its whole chain
+			for (int Hit = State; Hit > 0 && Visited[Hit] != Stamp; Hit = Output[Hit])
+			{
+				Visited[Hit] = Stamp;
+				for (size_t N = 0; N < Match[Hit].size(); N++)
+					Seen[Match[Hit][N]] = Stamp;
+			}
+		}
+	}
+
+	// only good for the line given to the last Scan
+	inline bool Found(unsigned int Literal)
+	{
+		return Seen[Literal] == Stamp;
+	}
+
+private:
+	static void Collect(BlechNode *pNode, std::vector<BlechNode*> &Nodes)
+	{
+		for (; pNode; pNode = pNode->pNext)
+		{
+			if (pNode->StringType == BST_NORMAL)
+				Nodes.push_back(pNode);
+			Collect(pNode->pChildren, Nodes);
+		}
+	}
+
+	// the same folding stristr does
+	static inline unsigned char Fold(char c)
+	{
+#ifndef BLECH_CASE_SENSITIVE
+		if (c >= 'a' && c <= 'z')
+			return (unsigned char)(c - 32);
+#endif
+		return (unsigned char)c;
+	}
+
+	unsigned char ClassOf[256];
+	int Classes;
+	std::vector<int> Next;                          // [state*Classes+class]
+	std::vector<int> Output;                        // next state down the failure chain that ends a literal
+	std::vector<std::vector<unsigned int>> Match;   // literals that end at each state
+	std::vector<unsigned int> Visited;              // Stamp of the last Scan that reached each state
+	std::vector<unsigned int> Seen;                 // Stamp of the last Scan that found each literal
+	unsigned int Stamp;
 };
 
 class Blech
@@ -408,14 +624,15 @@ class Blech
 	using BlechEventMap = std::map<unsigned int, BLECHEVENT>;
 
 public:
-	Blech(char ScanDelimiter, char PrintDelimiter, fBlechVariableValue PrintRetriever)
+	Blech(char ScanDelimiter, char PrintDelimiter, fBlechVariableValue PrintRetriever, fBlechVariableGeneration PrintGeneration = 0)
 	{
-		BlechDebug("Blech(%c,%c,%X)", ScanDelimiter, PrintDelimiter, PrintRetriever);
+		BlechDebug("Blech(%c,%c,%X,%X)", ScanDelimiter, PrintDelimiter, PrintRetriever, PrintGeneration);
 		BLECHASSERT(PrintDelimiter);
 		BLECHASSERT(PrintRetriever);
 		PrintVarDelimiter = PrintDelimiter;
 		ScanVarDelimiter = ScanDelimiter;
 		VariableValue = PrintRetriever;
+		VariableGeneration = PrintGeneration;
 		Initialize();
 	}
 	Blech(char ScanDelimiter = 0)
@@ -424,6 +641,7 @@ public:
 		ScanVarDelimiter = ScanDelimiter;
 		PrintVarDelimiter = 0;
 		VariableValue = 0;
+		VariableGeneration = 0;
 		Initialize();
 	}
 
@@ -505,20 +723,62 @@ public:
 	}
 
 	template <unsigned int _Size>unsigned int Feed(CHAR(&Input)[_Size])
+	{
+		return Feed(Input, _Size);
+	}
+
+	// BufferSize is the room a print variable's value gets, the array size above
+	unsigned int Feed(const char *Input, size_t BufferSize)
 	{
 		BlechDebug("Feed(%s)", Input);
 		if (!Input || !Input[0])
 			return 0;
+		// a callback or a print variable lookup can feed this Blech again.  Each depth
+		// works in its own level, so a deeper Feed can't move anything this one uses.
+		if (FeedDepth == Levels.size())
+			Levels.push_back(FeedLevel());
+		FeedLevel *pOuter = pLevel;
+		pLevel = &Levels[FeedDepth++];
+		// copied, a callback can change the caller's buffer before the line is done
+		pLevel->Line.assign(Input, Input + strlen(Input) + 1);
+		Input = &pLevel->Line[0];
+		if (!++pLevel->Stamp)
+		{
+			// wrapped, nothing read before now counts as this Feed's
+			for (size_t N = 0; N < pLevel->Variables.size(); N++)
+				pLevel->Variables[N].Feed = 0;
+			pLevel->Stamp = 1;
+		}
 		unsigned int Root = (unsigned char)Input[0];
 
 #ifndef BLECH_CASE_SENSITIVE
 		if (Root >= 'a' && Root <= 'z')
 			Root -= 32;
 #endif
-		if (Root > 255) {
-			Sleep(0);
+		unsigned int Count = Digest(Root, Input, BufferSize);
+		if (Tree[0])
+		{
+			if (TreeChanged)
+				Rebuild();
+			// a Feed from inside a walk leaves the marks of the line being walked alone
+			if (pLevel->Prefiltered = UsePrefilter && !Walking)
+				Prefilter.Scan(Input);
+			Count += Digest(0, Input, BufferSize);
+			pLevel->Prefiltered = false;
 		}
-		return Chew(Tree[Root], Input, _Size) + Chew(Tree[0], Input, _Size)/*+Swallow(Input)/**/;
+		FeedDepth--;
+		pLevel = pOuter;
+		return Count/*+Swallow(Input)/**/;
+	}
+
+	// feeds the lines in order, each line's events fire before the next one is matched
+	unsigned int FeedBatch(const char *const *Lines, size_t nLines, size_t BufferSize)
+	{
+		BlechDebug("FeedBatch(%X,%d)", Lines, nLines);
+		unsigned int Count = 0;
+		for (size_t N = 0; N < nLines; N++)
+			Count += Feed(Lines[N], BufferSize);
+		return Count;
 	}
 
 	inline bool IsExact(const char *Text)
@@ -530,9 +790,21 @@ public:
 
 	unsigned int AddEvent(const char *Text, fBlechCallback Callback, void *pData = 0)
 	{
-		BlechDebug("AddEvent(%s,%X,%X)", Text, Callback, pData);
+		return AddEvent(Text, Callback, 0, pData);
+	}
+
+	unsigned int AddEvent(const char *Text, fBlechSpanCallback SpanCallback, void *pData = 0)
+	{
+		return AddEvent(Text, 0, SpanCallback, pData);
+	}
+
+	unsigned int AddEvent(const char *Text, fBlechCallback Callback, fBlechSpanCallback SpanCallback, void *pData)
+	{
+		BlechDebug("AddEvent(%s,%X,%X,%X)", Text, Callback, SpanCallback, pData);
 		BLECHASSERT(Text);
-		BLECHASSERT(Callback);
+		BLECHASSERT(Callback || SpanCallback);
+		// new nodes can split existing ones, which changes their text
+		TreeChanged = true;
 		const char *pText = Text;
 		const char *Part = Text;
 		eBlechStringType StringType = BST_NORMAL;
@@ -591,6 +863,7 @@ public:
 		try {
 			BLECHEVENT& rEvent = EventMap[++LastID];
 			rEvent.Callback = Callback;
+			rEvent.SpanCallback = SpanCallback;
 			rEvent.pData = pData;
 			rEvent.ID = LastID;
 			rEvent.pBlechNode = pNode;
@@ -612,6 +885,7 @@ public:
 		BlechEventMap::iterator iter = EventMap.find(ID);
 		if (iter == EventMap.end())
 			return false;
+		TreeChanged = true;
 
 		BLECHEVENT& rEvent = iter->second;
 
@@ -647,59 +921,88 @@ public:
 	}
 
 	char Version[32];
+	bool UsePrefilter = true; // skip Tree[0] literals that aren't in the line before looking for them
+	bool UseCompiled = true;  // match with the compiled trees instead of walking the nodes in Chew
 
 private:
-	inline void FreeExecution(PBLECHEXECUTE pExecute)
+	inline void AddSpan(const char *Name, const char *Input, const char *Pos, unsigned int Length)
 	{
-		try
-		{
-			if (pExecute) {
-				if (PBLECHVALUE pValue = pExecute->pValues) {
-					while (pValue)
-					{
-						PBLECHVALUE pNext = pValue->pNext;
-						free(pValue->Value);
-						free(pValue->Name);
-						delete pValue;
-						pValue = pNext;
-					}
-				}
-				delete pExecute;
-			}
-		}
-		catch (...) {
-			int ret = MessageBox(NULL, "[Blech] Exception occured in FreeExecution", "Would you like to debug?", MB_SYSTEMMODAL | MB_YESNO);
-			if (ret == IDYES)
-				DebugBreak();
-			Sleep(0);
-		}
+		// names are copied, a callback can remove the event that owns the node
+		BLECHSPAN Span;
+		Span.Name = (unsigned int)pLevel->Strings.size();
+		Span.Offset = (unsigned int)(Pos - Input);
+		Span.Length = Length;
+		pLevel->Strings.insert(pLevel->Strings.end(), Name, Name + strlen(Name) + 1);
+		pLevel->Spans.push_back(Span);
 	}
 
-	void ClearExecutionList(PBLECHEXECUTE *ppExecuteList)
+	// the events at pNode fire with the captures from FirstSpan on
+	void QueueMatches(BlechNode *pNode, unsigned int FirstSpan)
 	{
-		PBLECHEXECUTE pExecuteList = *ppExecuteList;
-		*ppExecuteList = 0;
-		while (pExecuteList)
+		BlechDebug("QueueMatches(%X,%d)", pNode, FirstSpan);
+		for (PBLECHEVENTNODE pEventNode = pNode->pEvents; pEventNode; pEventNode = pEventNode->pNext)
 		{
-			PBLECHEXECUTE pExecuteNext = pExecuteList->pNext;
-			FreeExecution(pExecuteList);
-			pExecuteList = pExecuteNext;
+			PBLECHEVENT pEvent = pEventNode->pEvent;
+			BLECHMATCH Match;
+			Match.ID = pEvent->ID;
+			Match.pData = pEvent->pData;
+			Match.Callback = pEvent->Callback;
+			Match.SpanCallback = pEvent->SpanCallback;
+			Match.Span = FirstSpan;
+			Match.nSpans = (unsigned int)pLevel->Spans.size() - FirstSpan;
+			pLevel->Matches.push_back(Match);
 		}
 	}
 
-	unsigned int ProcessExecutionList(PBLECHEXECUTE *ppExecuteList)
+	// calls back everything the last walk queued, most recent first as the old execution
+	// list did, then hands the space back
+	unsigned int ProcessMatches(const char *Input)
 	{
+		// a callback that feeds this Blech again works a level deeper, none of this moves
+		FeedLevel &Level = *pLevel;
 		unsigned int n = 0;
-		PBLECHEXECUTE pExecuteList = *ppExecuteList;
-		*ppExecuteList = 0;
-		while (pExecuteList)
+		for (size_t N = Level.Matches.size(); N > 0; n++)
 		{
-			n++;
-			PBLECHEXECUTE pExecuteNext = pExecuteList->pNext;
-			pExecuteList->Callback(pExecuteList->ID, pExecuteList->pData, pExecuteList->pValues);
-			FreeExecution(pExecuteList);
-			pExecuteList = pExecuteNext;
+			const BLECHMATCH &Match = Level.Matches[--N];
+			if (Match.SpanCallback)
+			{
+				for (unsigned int i = 0; i < Match.nSpans; i++)
+				{
+					const BLECHSPAN &Span = Level.Spans[Match.Span + i];
+					BLECHCAPTURE Capture = { &Level.Strings[Span.Name], Span.Offset, Span.Length };
+					Level.Captures.push_back(Capture);
+				}
+				Match.SpanCallback(Match.ID, Match.pData, Input, Match.nSpans ? &Level.Captures[0] : 0, Match.nSpans);
+				Level.Captures.clear();
+			}
+			else
+			{
+				// old style callbacks get terminated copies of the values, made in the arena too
+				size_t StringMark = Level.Strings.size();
+				for (unsigned int i = 0; i < Match.nSpans; i++)
+				{
+					const BLECHSPAN &Span = Level.Spans[Match.Span + i];
+					Level.Strings.insert(Level.Strings.end(), &Input[Span.Offset], &Input[Span.Offset + Span.Length]);
+					Level.Strings.push_back(0);
+				}
+				size_t ValueString = StringMark;
+				for (unsigned int i = 0; i < Match.nSpans; i++)
+				{
+					const BLECHSPAN &Span = Level.Spans[Match.Span + i];
+					BLECHVALUE Value = { &Level.Strings[Span.Name], &Level.Strings[ValueString], 0 };
+					Level.Values.push_back(Value);
+					ValueString += Span.Length + 1;
+				}
+				for (size_t i = 1; i < Level.Values.size(); i++)
+					Level.Values[i - 1].pNext = &Level.Values[i];
+				Match.Callback(Match.ID, Match.pData, Match.nSpans ? &Level.Values[0] : 0);
+				Level.Values.clear();
+				Level.Strings.resize(StringMark);
+			}
 		}
+		Level.Matches.clear();
+		Level.Spans.clear();
+		Level.Strings.clear();
 		return n;
 	}
 
@@ -721,130 +1024,66 @@ private:
 	}
 
 
-	void QueueEvent(PBLECHEXECUTE *ppExecuteList, PBLECHEVENT pEvent, PBLECHVALUE pValues)
+	void QueueEvents(BlechNode *pNode, const char *Input, unsigned int InputLength, size_t BufferSize)
 	{
-		BlechDebug("QueueEvent(%X,%X)", pEvent, pValues);
-		BLECHASSERT(pEvent);
-		try {
-			PBLECHEXECUTE pNew = new BLECHEXECUTE;
-			pNew->Callback = pEvent->Callback;
-			pNew->ID = pEvent->ID;
-			pNew->pData = pEvent->pData;
-			// make a COPY of values
-			if (pValues)
-			{
-				PBLECHVALUE pNewValueTail = 0;
-				pNew->pValues = 0;
-				while (pValues)
-				{
-					PBLECHVALUE pNewValue = new BLECHVALUE;
-					pNewValue->Name = _strdup(pValues->Name);
-					pNewValue->Value = _strdup(pValues->Value);
-					pNewValue->pNext = 0;
-					if (pNew->pValues)
-					{
-						pNewValueTail->pNext = pNewValue;
-						pNewValueTail = pNewValue;
-					}
-					else
-					{
-						pNewValueTail = pNew->pValues = pNewValue;
-
-					}
-					pValues = pValues->pNext;
-				}
-			}
-			else
-				pNew->pValues = 0;
-
-			pNew->pNext = *ppExecuteList;
-			*ppExecuteList = pNew;
-		}
-		catch (std::bad_alloc& exc)
+		BlechDebug("QueueEvents(%X,%s,%d)", pNode, Input, InputLength);
+		BLECHASSERT(pNode);
+		// Get forward traversal list (walk up the parents, then reverse)
+		std::vector<BlechNode*> Path;
+		int nVariableNodes = 0;
+		for (BlechNode *pCurrent = pNode; pCurrent; pCurrent = pCurrent->pParent)
 		{
-			UNREFERENCED_PARAMETER(exc);
-			MessageBox(NULL, "Bleech failed to allocate memory in QueueEvent", "Did we just discover a memory leak?", MB_SYSTEMMODAL | MB_OK);
-		};
+			Path.push_back(pCurrent);
+			if (pCurrent->StringType == BST_SCANVAR)
+				nVariableNodes++;
+		}
+		std::reverse(Path.begin(), Path.end());
+		QueueEvents(pNode, &Path[0], (unsigned int)Path.size(), nVariableNodes, Input, InputLength, BufferSize);
 	}
 
-	void QueueEvents(PBLECHEXECUTE *ppExecuteList, BlechNode *pNode, const char *Input, unsigned int InputLength, size_t BufferSize)
+	// ppPath is every node from the root down to pNode
+	void QueueEvents(BlechNode *pNode, BlechNode *const *ppPath, unsigned int nPath, int nVariableNodes, const char *Input, unsigned int InputLength, size_t BufferSize)
 	{
-		PBLECHEVENTNODE pEventNode;
-		BlechDebug("QueueEvents(%X,%s,%d)", pNode, Input, InputLength);
+		BlechNode *pCurrent;
 		BLECHASSERT(pNode);
 		BLECHASSERT(Input);
 		BLECHASSERT(InputLength);
 		// ASSUME we have a complete match
 
-		// Get forward traversal list (reverse the links, into a new list)
-		PBLECHLISTNODE pList = 0;
-		BlechNode *pCurrent = pNode;
-		int nVariableNodes = 0;
-		while (pCurrent)
-		{
-			PBLECHLISTNODE pNewHead = new BLECHLISTNODE;
-			pNewHead->pNext = pList;
-			pNewHead->pNode = pCurrent;
-			pList = pNewHead;
-			if (pCurrent->StringType == BST_SCANVAR)
-				nVariableNodes++;
-			pCurrent = pCurrent->pParent;
-		}
-
 		if (!nVariableNodes)
 		{
 			BlechDebugFull("No variable nodes");
 			// if there's no variable nodes, just make sure the lengths match
 			unsigned int TestLength = 0;
-			pCurrent = pNode;
-			while (pCurrent)
-			{
-				TestLength += pCurrent->Length;
-				pCurrent = pCurrent->pParent;
-			}
+			for (unsigned int N = 0; N < nPath; N++)
+				TestLength += ppPath[N]->Length;
 			if (pNode && TestLength == InputLength)
-			{
-				PBLECHEVENTNODE pEventNode = pNode->pEvents;
-				while (pEventNode)
-				{
-					QueueEvent(ppExecuteList, pEventNode->pEvent, 0);
-					pEventNode = pEventNode->pNext;
-				}
-			}
-
-			// cleanup
-			while (pList)
-			{
-				PBLECHLISTNODE pNext = pList->pNext;
-				delete pList;
-				pList = pNext;
-			}
+				QueueMatches(pNode, (unsigned int)pLevel->Spans.size());
 			return;
 		}
 
 		// now do it forward, filling in the values. we KNOW they exist.
 
 		char NonVariable[16384];
-		char VarData[4096];
+		unsigned int VarLength;
 		NonVariable[0] = 0;
 		const char *Pos = Input;
 
-		PBLECHVALUE pValues = 0;
-		PBLECHVALUE pValuesTail = 0;
+		// captures go straight into the arena, and are dropped again if this isn't a match
+		unsigned int FirstSpan = (unsigned int)pLevel->Spans.size();
+		size_t StringMark = pLevel->Strings.size();
 
 		BlechNode *pCurrentScanVar = 0;
-		while (pList)
+		for (unsigned int N = 0; N < nPath; N++)
 		{
-			pCurrent = pList->pNode;
+			pCurrent = ppPath[N];
 			switch (pCurrent->StringType)
 			{
 			case BST_NORMAL:
 				strcat_s(NonVariable, pCurrent->pString);
 				break;
 			case BST_PRINTVAR:
-				VarData[0] = 0;
-				BlechTry(VariableValue(pCurrent->pString, VarData, BufferSize));
-				strcat_s(NonVariable, VarData);
+				strcat_s(NonVariable, PrintValue(pCurrent, BufferSize, VarLength));
 				break;
 			case BST_SCANVAR:
 				if (pCurrentScanVar)
@@ -854,24 +1093,7 @@ private:
 						const char *End = STRFIND(Pos, NonVariable);
 						if (End)
 						{
-							PBLECHVALUE pNewValue = new BLECHVALUE;
-							pNewValue->Name = _strdup(pCurrentScanVar->pString);
-
-							unsigned int Length = End - Pos;
-							pNewValue->Value = (char*)malloc(Length + 1);
-							memcpy(pNewValue->Value, Pos, Length);
-							pNewValue->Value[Length] = 0;
-							pNewValue->pNext = 0;
-							if (pValues)
-							{
-								pValuesTail->pNext = pNewValue;
-								pValuesTail = pNewValue;
-							}
-							else
-							{
-								pValuesTail = pValues = pNewValue;
-							}
-
+							AddSpan(pCurrentScanVar->pString, Input, Pos, (unsigned int)(End - Pos));
 							Pos = End + strlen(NonVariable);
 							NonVariable[0] = 0;
 						}
@@ -883,22 +1105,7 @@ private:
 						}
 					}
 					else
-					{
-						PBLECHVALUE pNewValue = new BLECHVALUE;
-						pNewValue->Name = _strdup(pCurrentScanVar->pString);
-						pNewValue->Value = (char*)malloc(1);
-						pNewValue->Value[0] = 0;
-						pNewValue->pNext = 0;
-						if (pValues)
-						{
-							pValuesTail->pNext = pNewValue;
-							pValuesTail = pNewValue;
-						}
-						else
-						{
-							pValuesTail = pValues = pNewValue;
-						}
-					}
+						AddSpan(pCurrentScanVar->pString, Input, Pos, 0);
 				}
 				else
 				{
@@ -915,11 +1122,6 @@ private:
 				pCurrentScanVar = pCurrent;
 				break;
 			}
-
-
-			PBLECHLISTNODE pNext = pList->pNext;
-			delete pList;
-			pList = pNext;
 		}
 
 		if (pCurrentScanVar)
@@ -927,49 +1129,15 @@ private:
 			if (NonVariable[0])
 			{
 				const char *End = &Input[InputLength] - strlen(NonVariable);
-				unsigned int Length = End - Pos;
-				if (STRCMP(&Pos[Length], NonVariable))
+				// the tail can't overlap text already consumed
+				if (End < Pos || STRCMP(End, NonVariable))
 				{
 					goto queueeventscleanup;
 				}
-
-				PBLECHVALUE pNewValue = new BLECHVALUE;
-				pNewValue->Name = _strdup(pCurrentScanVar->pString);
-
-				pNewValue->Value = (char*)malloc(Length + 1);
-				memcpy(pNewValue->Value, Pos, Length);
-				pNewValue->Value[Length] = 0;
-				pNewValue->pNext = 0;
-
-				if (pValues)
-				{
-					pValuesTail->pNext = pNewValue;
-					pValuesTail = pNewValue;
-				}
-				else
-				{
-					pValuesTail = pValues = pNewValue;
-				}
-
-				Pos = End;
-				NonVariable[0] = 0;
+				AddSpan(pCurrentScanVar->pString, Input, Pos, (unsigned int)(End - Pos));
 			}
 			else
-			{
-				PBLECHVALUE pNewValue = new BLECHVALUE;
-				pNewValue->Name = _strdup(pCurrentScanVar->pString);
-				pNewValue->Value = _strdup(Pos);
-				pNewValue->pNext = 0;
-				if (pValues)
-				{
-					pValuesTail->pNext = pNewValue;
-					pValuesTail = pNewValue;
-				}
-				else
-				{
-					pValuesTail = pValues = pNewValue;
-				}
-			}
+				AddSpan(pCurrentScanVar->pString, Input, Pos, (unsigned int)strlen(Pos));
 		}
 		else if (NonVariable[0])
 		{
@@ -981,31 +1149,12 @@ private:
 			}
 		}
 
-		// add to execution list
-		pEventNode = pNode->pEvents;
-		while (pEventNode)
-		{
-			QueueEvent(ppExecuteList, pEventNode->pEvent, pValues);
-			pEventNode = pEventNode->pNext;
-		}
+		QueueMatches(pNode, FirstSpan);
+		return;
 
-		// cleanup
 	queueeventscleanup:
-		while (pValues)
-		{
-			PBLECHVALUE pNext = pValues->pNext;
-			free(pValues->Name);
-			free(pValues->Value);
-			delete pValues;
-			pValues = pNext;
-		}
-
-		while (pList)
-		{
-			PBLECHLISTNODE pNext = pList->pNext;
-			delete pList;
-			pList = pNext;
-		}
+		pLevel->Spans.resize(FirstSpan);
+		pLevel->Strings.resize(StringMark);
 	}
 
 	struct MatchPos
@@ -1014,16 +1163,15 @@ private:
 		BlechNode *pNode;
 	};
 
-	unsigned int Chew(BlechNode *pNode, const char *Input, size_t BufferSize)
+	void Chew(BlechNode *pNode, const char *Input, size_t BufferSize)
 	{
 		BlechDebug("Chew(%X,%s)", pNode, Input);
 		BLECHASSERT(Input);
 		if (!pNode)
-			return 0;
-		PBLECHEXECUTE pExecuteList = 0;
+			return;
 		unsigned int Length = (unsigned int)strlen(Input);
 		const char *pEnd = &Input[Length];
-		char VarData[4096] = { 0 };
+		const char *VarData = 0;
 
 #define Push() {    BLECHASSERT(PLP<99) CurrentPos.pNode=pNode;MatchStack[PLP]=CurrentPos;    PLP++;    }
 #define Pop()  {    BLECHASSERT(PLP>0);PLP--; CurrentPos=MatchStack[PLP];pNode=CurrentPos.pNode;    }
@@ -1049,6 +1197,11 @@ private:
 				{
 				case BST_NORMAL:
 					BlechDebugFull("BST_NORMAL");
+					if (pLevel->Prefiltered && pNode->Literal != BLECH_NOLITERAL && !Prefilter.Found(pNode->Literal))
+					{
+						BlechDebugFull("BST_NORMAL => NOT IN LINE");
+						goto feedernomatch;
+					}
 					if (CurrentPos.Pos + pNode->Length < pEnd)
 					{
 						if (const char *pFound = STRFIND(CurrentPos.Pos, pNode->pString))
@@ -1076,7 +1229,7 @@ private:
 				case BST_PRINTVAR:
 					BlechDebugFull("BST_PRINTVAR");
 					// variable data of unknown size
-					BlechTry(pNode->Length = VariableValue(pNode->pString, VarData, BufferSize));
+					VarData = PrintValue(pNode, BufferSize, pNode->Length);
 					BlechDebugFull("Variable value '%s' length %d", VarData, pNode->Length);
 					if (!pNode->Length)
 					{
@@ -1127,7 +1280,7 @@ private:
 		feedermatchdoevents:
 			{
 				BlechDebug("feedermatchdoevents");
-				QueueEvents(&pExecuteList, pNode, Input, Length, BufferSize);
+				QueueEvents(pNode, Input, Length, BufferSize);
 			}
 		feedermatchnoevent:
 			{
@@ -1216,15 +1369,168 @@ private:
 			}
 		}
 	chewcomplete:
-		// execute any queued events
-		unsigned int Count = ProcessExecutionList(&pExecuteList);
-		BlechDebug("Chew returns %d", Count);
-		return Count;
+		BlechDebug("Chew complete");
 #undef Push
 #undef Pop
 #undef Peek
 	}
 
+	// walks one tree and calls back what it matched
+	unsigned int Digest(unsigned int Root, const char *Input, size_t BufferSize)
+	{
+		if (TreeChanged)
+			Rebuild();
+		Walking++;
+		if (!UseCompiled)
+			Chew(Tree[Root], Input, BufferSize);
+		else
+			Run(Programs[Root], Input, BufferSize);
+		Walking--;
+		return ProcessMatches(Input);
+	}
+
+	// a print variable's value, read at most once per Feed, or kept for as long as its
+	// generation says it hasn't changed
+	const char *PrintValue(BlechNode *pNode, size_t BufferSize, unsigned int &Length)
+	{
+		BLECHASSERT(pNode->Variable < VariableIndex.size());
+		if (pLevel->Variables.size() < VariableIndex.size())
+			pLevel->Variables.resize(VariableIndex.size());
+		PrintVariable &Var = pLevel->Variables[pNode->Variable];
+		if (Var.Feed != pLevel->Stamp)
+		{
+			unsigned int Generation = VariableGeneration ? VariableGeneration(pNode->pString) : 0;
+			if (!Generation || Generation != Var.Generation || Var.Value.size() != BufferSize)
+			{
+				Var.Value.assign(BufferSize, 0);
+				BlechTry(Var.Length = VariableValue(pNode->pString, &Var.Value[0], BufferSize));
+				Var.Generation = Generation;
+			}
+			Var.Feed = pLevel->Stamp;
+		}
+		Length = Var.Length;
+		return &Var.Value[0];
+	}
+
+	// done on the first Feed after a change rather than in AddEvent, so a burst of AddEvents only builds once
+	void Rebuild()
+	{
+		BlechDebug("Rebuild()");
+		Prefilter.Build(Tree[0]);
+		unsigned int MaxDepth = 0;
+		std::vector<BlechNode*> Path;
+		for (unsigned int N = 0; N < 256; N++)
+		{
+			Programs[N].Ops.clear();
+			Programs[N].Paths.clear();
+			Compile(Programs[N], Tree[N], Path, 0, MaxDepth);
+		}
+		PositionsSize = MaxDepth + 2;
+		TreeChanged = false;
+	}
+
+	void Compile(BLECHPROGRAM &Program, BlechNode *pNode, std::vector<BlechNode*> &Path, int nVariableNodes, unsigned int &MaxDepth)
+	{
+		for (; pNode; pNode = pNode->pNext)
+		{
+			unsigned int N = (unsigned int)Program.Ops.size();
+			Program.Ops.push_back(BLECHOP());
+			BLECHOP &Op = Program.Ops[N];
+			Op.pNode = pNode;
+			Op.Depth = (unsigned int)Path.size();
+			Op.nVariableNodes = nVariableNodes + (pNode->StringType == BST_SCANVAR ? 1 : 0);
+			if (pNode->StringType == BST_PRINTVAR)
+			{
+				// every node naming the same variable shares its snapshot
+				std::pair<std::map<std::string, unsigned int>::iterator, bool> Found = VariableIndex.insert(std::make_pair(std::string(pNode->pString), (unsigned int)VariableIndex.size()));
+				pNode->Variable = Found.first->second;
+			}
+			Path.push_back(pNode);
+			Op.Path = (unsigned int)Program.Paths.size();
+			Op.nPath = 0;
+			if (pNode->pEvents)
+			{
+				Program.Paths.insert(Program.Paths.end(), Path.begin(), Path.end());
+				Op.nPath = (unsigned int)Path.size();
+			}
+			if (Op.Depth > MaxDepth)
+				MaxDepth = Op.Depth;
+			Compile(Program, pNode->pChildren, Path, Op.nVariableNodes, MaxDepth);
+			// Op may have moved
+			Program.Ops[N].Skip = (unsigned int)Program.Ops.size();
+			Path.pop_back();
+		}
+	}
+
+	// same matching rules as Chew
+	void Run(BLECHPROGRAM &Program, const char *Input, size_t BufferSize)
+	{
+		BlechDebug("Run(%X,%s)", &Program, Input);
+		BLECHASSERT(Input);
+		if (Program.Ops.empty())
+			return;
+		unsigned int Length = (unsigned int)strlen(Input);
+		const char *pEnd = &Input[Length];
+		if (pLevel->Positions.size() < PositionsSize)
+			pLevel->Positions.resize(PositionsSize);
+		const char **Pos = &pLevel->Positions[0];
+		Pos[0] = Input;
+		const BLECHOP *pOps = &Program.Ops[0];
+		unsigned int nOps = (unsigned int)Program.Ops.size();
+		unsigned int N = 0;
+		while (N < nOps)
+		{
+			const BLECHOP &Op = pOps[N];
+			BlechNode *pNode = Op.pNode;
+			const char *pPos = Pos[Op.Depth];
+			const char *pText = 0;
+			switch (pNode->StringType)
+			{
+			case BST_NORMAL:
+				if (pLevel->Prefiltered && pNode->Literal != BLECH_NOLITERAL && !Prefilter.Found(pNode->Literal))
+				{
+					N = Op.Skip;
+					continue;
+				}
+				pText = pNode->pString;
+				break;
+			case BST_PRINTVAR:
+				pText = PrintValue(pNode, BufferSize, pNode->Length);
+				break;
+			}
+			if (pText && pNode->Length)
+			{
+				if (pPos + pNode->Length < pEnd)
+				{
+					const char *pFound = STRFIND(pPos, pText);
+					if (!pFound)
+					{
+						N = Op.Skip;
+						continue;
+					}
+					pPos = &pFound[pNode->Length];
+				}
+				else if (pPos + pNode->Length == pEnd && !STRNCMP(pText, pPos, pNode->Length))
+					pPos = pEnd;
+				else
+				{
+					N = Op.Skip;
+					continue;
+				}
+				if (!pPos[0] && pNode->pEvents)
+					QueueEvents(pNode, &Program.Paths[Op.Path], Op.nPath, Op.nVariableNodes, Input, Length, BufferSize);
+			}
+			else if (pNode->pEvents)
+			{
+				// scan variables and empty print variables match without moving
+				QueueEvents(pNode, &Program.Paths[Op.Path], Op.nPath, Op.nVariableNodes, Input, Length, BufferSize);
+			}
+			Pos[Op.Depth + 1] = pPos;
+			N++;
+		}
+		BlechDebug("Run complete");
+	}
+
 	BlechNode *AddNode(unsigned int nRoot, const char *String, eBlechStringType StringType)
 	{
 		if (nRoot > 255) {
@@ -1387,6 +1693,11 @@ private:
 	{
 		BlechDebugFull("Initialize()");
 		padding = 0;
+		TreeChanged = true;
+		VariableIndex.clear();
+		// the snapshots are by index, which starts over
+		for (size_t N = 0; N < Levels.size(); N++)
+			Levels[N].Variables.clear();
 		LastID = 0;
 		EventMap.clear();
 		strcpy_s(Version, BLECHVERSION); // store version string always
@@ -1401,6 +1712,41 @@ private:
 	char ScanVarDelimiter = 0;
 	WORD padding = 0;
 	fBlechVariableValue VariableValue = 0;
+	fBlechVariableGeneration VariableGeneration = 0;
 	BlechEventMap EventMap;
 	BlechNode *Tree[256];
+	BlechPrefilter Prefilter;
+	BLECHPROGRAM Programs[256];
+	unsigned int PositionsSize = 0;         // Run's positions needed by the deepest program
+
+	struct PrintVariable
+	{
+		PrintVariable() : Length(0), Feed(0), Generation(0) {}
+		std::vector<char> Value;
+		unsigned int Length;        // what VariableValue returned
+		unsigned int Feed;          // level Stamp of the last Feed that used it
+		unsigned int Generation;    // from VariableGeneration when it was read
+	};
+	std::map<std::string, unsigned int> VariableIndex;  // print variable name to snapshot index
+
+	// everything one Feed works in, kept for the next Feed at the same depth
+	struct FeedLevel
+	{
+		FeedLevel() : Stamp(0), Prefiltered(false) {}
+		std::vector<char> Line;                 // the line being fed
+		std::vector<const char*> Positions;     // for Run
+		std::vector<BLECHMATCH> Matches;
+		std::vector<BLECHSPAN> Spans;
+		std::vector<char> Strings;
+		std::vector<BLECHCAPTURE> Captures;     // handed to span callbacks
+		std::vector<BLECHVALUE> Values;         // handed to old style callbacks
+		std::vector<PrintVariable> Variables;   // print variable snapshots
+		unsigned int Stamp;                     // counts the Feeds at this depth
+		bool Prefiltered;                       // the prefilter holds this line's marks
+	};
+	std::deque<FeedLevel> Levels;               // a deque, a deeper level doesn't move the ones in use
+	FeedLevel *pLevel = 0;
+	size_t FeedDepth = 0;
+	unsigned int Walking = 0;                   // walks in progress, a print variable lookup can Feed
+	bool TreeChanged = true;
 };
\ No newline at end of file
@@ -0,0 +1,149 @@
+// Feeds a recorded EverQuest chat log through Blech walking the nodes (Chew), running
+// the compiled trees, running them with the Tree[0] prefilter, and with the prefilter
+// in blocks of 64 lines through FeedBatch, and reports the time per line and the number
+// of events fired by each.
+//
+// usage: benchmark <logfile> [events] [passes]
+//   events  total #events to add, the built in ones are padded with generated
+//           wildcard events that never match (default 200)
+//   passes  times to feed the whole log (default 10)
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "Blech.h"
+
+const char *WildcardEvents[] = {
+    "#*#Text with #variable# portion",
+    "#*#while stunned#*#",
+    "#*#has been slain#*#",
+    "#*#gain experience!#*#",
+    "#*#Insufficient mana#*#",
+    "#*#target is out of range#*#",
+    "#*#Returning to home point, please wait...#*#",
+    "#*#you have been slain#*#",
+    "#*#You have entered#*#",
+    "#*# YOU for #*#",
+    "#*# YOU, but #*#",
+    "#*#tells you, #*#",
+    "#*#tells the group, #*#",
+    "#*#tells the raid, #*#",
+    "#*#tells the guild, #*#",
+    "#*#looted a#*#",
+    "#*#Your spell is interrupted#*#",
+    "#*#Your target resisted#*#",
+    "#*#You are stunned#*#",
+    "#*#You can't use that command#*#",
+    "#1# begins to cast a spell.",
+    "#1# hits you for #2# damage.",
+    "#1# has become ENRAGED.",
+    "#1# is no longer enraged.",
+    "#1# tells you, '#2#'",
+};
+
+const char *LiteralEvents[] = {
+    "You have been summoned!",
+    "You cannot see#*#",
+    "The shield fades away.",
+    "The maelstrom dissipates.",
+    "You gain#*#",
+    "[MQ2] getout",
+    "[MQ2] ma #1#",
+};
+
+unsigned int Fired = 0;
+
+void __stdcall CountEvent(unsigned int ID, void *pData, PBLECHVALUE pValues)
+{
+    Fired++;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        printf("usage: %s <logfile> [events] [passes]\n", argv[0]);
+        return 1;
+    }
+    int nEvents = argc > 2 ? atoi(argv[2]) : 200;
+    int nPasses = argc > 3 ? atoi(argv[3]) : 10;
+
+    FILE *fLog = 0;
+    if (fopen_s(&fLog, argv[1], "rt") || !fLog) {
+        printf("can't open %s\n", argv[1]);
+        return 1;
+    }
+    std::vector<std::string> Lines;
+    char Line[2048];
+    while (fgets(Line, sizeof(Line), fLog)) {
+        size_t Len = strlen(Line);
+        while (Len && (Line[Len - 1] == '\n' || Line[Len - 1] == '\r'))
+            Line[--Len] = 0;
+        // [Thu Oct 16 12:00:00 2026] text
+        char *pText = Line;
+        if (Line[0] == '[' && Len > 27 && Line[25] == ']' && Line[26] == ' ')
+            pText = &Line[27];
+        if (*pText)
+            Lines.push_back(pText);
+    }
+    fclose(fLog);
+    printf("%s: %d lines\n", argv[1], (int)Lines.size());
+
+    Blech b('#');
+    int nAdded = 0;
+    for (int i = 0; i < sizeof(WildcardEvents) / sizeof(WildcardEvents[0]); i++, nAdded++)
+        b.AddEvent(WildcardEvents[i], CountEvent);
+    for (int i = 0; i < sizeof(LiteralEvents) / sizeof(LiteralEvents[0]); i++, nAdded++)
+        b.AddEvent(LiteralEvents[i], CountEvent);
+    // made up words, so the generated events don't share one long prefix in the tree
+    unsigned int Seed = 12345;
+    for (; nAdded < nEvents; nAdded++) {
+        char *pPos = &Line[sprintf_s(Line, "#*#")];
+        for (int Word = 0; Word < 3; Word++) {
+            int Len = 4 + (Seed >> 16) % 5;
+            for (int c = 0; c < Len; c++) {
+                Seed = Seed * 1103515245 + 12345;
+                *pPos++ = 'a' + (Seed >> 16) % 26;
+            }
+            *pPos++ = ' ';
+        }
+        strcpy_s(pPos - 1, Line + sizeof(Line) - pPos + 1, "#*#");
+        b.AddEvent(Line, CountEvent);
+    }
+    printf("%d events\n", nAdded);
+
+    LARGE_INTEGER Frequency;
+    QueryPerformanceFrequency(&Frequency);
+    std::vector<const char *> Batch;
+    for (size_t i = 0; i < Lines.size(); i++)
+        Batch.push_back(Lines[i].c_str());
+    const char *Modes[] = { "Chew", "compiled", "prefilter", "batch" };
+    double Elapsed[4];
+    unsigned int Count[4];
+    for (int Mode = 0; Mode < 4; Mode++) {
+        b.UseCompiled = Mode > 0;
+        b.UsePrefilter = Mode > 1;
+        Fired = 0;
+        LARGE_INTEGER Start, End;
+        QueryPerformanceCounter(&Start);
+        for (int Pass = 0; Pass < nPasses; Pass++) {
+            if (Mode > 2) {
+                for (size_t i = 0; i < Batch.size(); i += 64)
+                    b.FeedBatch(&Batch[i], Batch.size() - i < 64 ? Batch.size() - i : 64, sizeof(Line));
+                continue;
+            }
+            for (size_t i = 0; i < Lines.size(); i++) {
+                strcpy_s(Line, Lines[i].c_str());
+                b.Feed(Line);
+            }
+        }
+        QueryPerformanceCounter(&End);
+        Elapsed[Mode] = (double)(End.QuadPart - Start.QuadPart) * 1000000000.0 / (double)Frequency.QuadPart / ((double)Lines.size() * nPasses);
+        Count[Mode] = Fired;
+        printf("%-10s %8.0f ns/line (%.1fx), %u events fired\n", Modes[Mode], Elapsed[Mode], Elapsed[0] / Elapsed[Mode], Fired);
+    }
+    if (Count[1] != Count[0] || Count[2] != Count[0] || Count[3] != Count[0]) {
+        printf("!!!!!!!!!!!!!!! EVENT COUNTS DIFFER !!!!!!!!!!!!!!!!!!!\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,308 @@
+// Differential test: the event sets and lines from test.cpp, test2.cpp and test3.cpp,
+// plus randomly generated ones, are fed to one Blech walking the nodes (Chew) with old
+// style callbacks and to one running the compiled trees with the prefilter and span
+// callbacks.  Every Feed must fire the same events in the same order with the same values,
+// and so must a FeedBatch of a round's lines against feeding them one by one.  Last, the
+// fixed lines are fed from one shared buffer by callbacks that overwrite it and feed
+// again, which must not change what the outer Feed reports.
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "Blech.h"
+
+const char *Events[] = {
+    // test.cpp
+    "Text with #variable# portion",
+    "#*#Text with #variable# portion",
+    "thisshouldnevertrigger",
+    "#*#while stunned#*#",
+    "#*#has been slain#*#",
+    "#*#gain experience!#*#",
+    "#*#Insufficient mana#*#",
+    "[MQ2] getout",
+    "#*#target is out of range#*#",
+    "You cannot see#*#",
+    "#*#Returning to home point, please wait...#*#",
+    "#*#you have been slain#*#",
+    "#*#You have entered#*#",
+    "The shield fades away.",
+    "You have been summoned!",
+    "#*# YOU for #*#",
+    "#*# YOU, but #*#",
+    "[MQ2] nuke1 #1#",
+    "[MQ2] conc",
+    "[MQ2] concnum #1#",
+    "[MQ2] maxbuffs #1#",
+    "[MQ2] stopnuke #1#",
+    "[MQ2] stopnuke2 #1#",
+    "[MQ2] ma #1#",
+    "[MQ2] sa #1#",
+    "The magical barrier fades #*#",
+    "[MQ2] exclude #*#",
+    "[MQ2] itemset #1# #2# #3#",
+    "[MQ2] itembounce #1# #2#",
+    "[MQ2] leash#*#",
+    "[MQ2] afhelp",
+    "[MQ2] dopreconc",
+    "[MQ2] dopreconcxxxxx",
+    "You gain#*#",
+    "[MQ2] SetPCRadius#*#",
+    "[MQ2] SetNPCRadius#*#",
+    "#1# begins to cast a spell.",
+    "#1# hits you for #2# damage.",
+    // test2.cpp
+    "[MQ2] New MTHealPoint #1#",
+    "[MQ2] New TargetDAPoint #1#",
+    "[MQ2] New TankHealPoint #1#",
+    "[MQ2] New TopOffRange #1#",
+    // test3.cpp
+    "You begin casting#*#",
+    "|${Me.Name}| has fallen to the ground.",
+    "Your target resisted the #1# spell#*#",
+    "#*#hits for#*#",
+    "#*#goes on a RAMPAGE#*#",
+    "[MQ2] SetAEHeal#*#",
+};
+
+const char *Lines[] = {
+    "[MQ2] Autoassist your mom",
+    "Text with extra bits of portion",
+    "notText with extra bits of portion",
+    "[MQ2] maxbuffs 145",
+    "The magical barrier fades yourmoma",
+    "[MQ2] afhelp",
+    "[MQ2] ma 1",
+    "You can use the ability Fellstrike Discipline again in 20 minute(s) 19 seconds.",
+    "[MQ2] SetPCRadius",
+    "[MQ2] SetNPCRadius",
+    "[MQ2] itemset 3 2 1",
+    "a mob with space in name begins to cast a spell.",
+    "a mob hits you for lots of damage.",
+    "A bat hits you for 4 damage.",
+    "[MQ2] New MTHealPoint 55",
+    "[MQ2] Uber Raid Druid Macro Online, hold onto your seatbelt!",
+    "F has fallen to the ground.",
+    "Your target resisted the Tash spell.",
+    "A gnoll hits YOU for 12 points of damage.",
+    "a gnoll goes on a rampage",
+};
+
+std::string Fired;
+
+void __stdcall RecordEvent(unsigned int ID, void *pData, PBLECHVALUE pValues)
+{
+    char Temp[64];
+    sprintf_s(Temp, "%u:%d(", ID, (int)(INT_PTR)pData);
+    Fired += Temp;
+    for (; pValues; pValues = pValues->pNext) {
+        Fired += pValues->Name;
+        Fired += '=';
+        Fired += pValues->Value;
+        Fired += ';';
+    }
+    Fired += ')';
+}
+
+void __stdcall RecordSpans(unsigned int ID, void *pData, const char *Input, PBLECHCAPTURE pCaptures, unsigned int nCaptures)
+{
+    char Temp[64];
+    sprintf_s(Temp, "%u:%d(", ID, (int)(INT_PTR)pData);
+    Fired += Temp;
+    for (unsigned int N = 0; N < nCaptures; N++) {
+        Fired += pCaptures[N].Name;
+        Fired += '=';
+        Fired.append(&Input[pCaptures[N].Offset], pCaptures[N].Length);
+        Fired += ';';
+    }
+    Fired += ')';
+}
+
+unsigned int __stdcall VariableValue(char *VarName, char *Value, size_t Valuelen)
+{
+    // empty for some names, so the implied print variable match is covered
+    if (VarName[0] == 'e')
+        Value[0] = 0;
+    else
+        strcpy_s(Value, Valuelen, VarName[0] == 'a' ? "Ab" : "F");
+    return (unsigned int)strlen(Value);
+}
+
+unsigned int Seed = 1;
+
+unsigned int Random(unsigned int Range)
+{
+    Seed = Seed * 1103515245 + 12345;
+    return (Seed >> 16) % Range;
+}
+
+// short pieces from a tiny alphabet, so they overlap and repeat a lot
+std::string RandomText(int Max)
+{
+    const char Letters[] = "abAB xy";
+    std::string Text;
+    for (int Len = 1 + Random(Max); Len; Len--)
+        Text += Letters[Random(sizeof(Letters) - 1)];
+    return Text;
+}
+
+std::string RandomPattern()
+{
+    std::string Pattern;
+    bool Variable = Random(2) != 0;
+    for (int Parts = 1 + Random(4); Parts; Parts--, Variable = !Variable) {
+        if (!Variable)
+            Pattern += RandomText(4);
+        else if (int Kind = Random(3))
+            Pattern += Kind == 1 ? "#*#" : "#" + std::to_string(Random(3)) + "#";
+        else
+            Pattern += std::string("|") + "aeF"[Random(3)] + "|";
+    }
+    return Pattern;
+}
+
+int Failures = 0;
+
+void Compare(Blech &Reference, Blech &Compiled, const char *Line)
+{
+    char Input[1024];
+    strcpy_s(Input, Line);
+    Fired.clear();
+    unsigned int ReferenceCount = Reference.Feed(Input);
+    std::string ReferenceFired = Fired;
+    Fired.clear();
+    unsigned int CompiledCount = Compiled.Feed(Input);
+    if (ReferenceCount != CompiledCount || ReferenceFired != Fired) {
+        if (Failures++ < 10)
+            printf("'%s'\n\tChew:     %u %s\n\tcompiled: %u %s\n", Line, ReferenceCount, ReferenceFired.c_str(), CompiledCount, Fired.c_str());
+    }
+}
+
+void CompareBatch(Blech &Reference, Blech &Compiled, std::vector<std::string> &Lines)
+{
+    std::vector<const char *> Batch;
+    unsigned int ReferenceCount = 0;
+    Fired.clear();
+    for (size_t N = 0; N < Lines.size(); N++) {
+        char Input[1024];
+        strcpy_s(Input, Lines[N].c_str());
+        ReferenceCount += Reference.Feed(Input);
+        Batch.push_back(Lines[N].c_str());
+    }
+    std::string ReferenceFired = Fired;
+    Fired.clear();
+    unsigned int CompiledCount = Compiled.FeedBatch(&Batch[0], Batch.size(), 1024);
+    if (ReferenceCount != CompiledCount || ReferenceFired != Fired) {
+        if (Failures++ < 10)
+            printf("batch of %d\n\tFeed:      %u %s\n\tFeedBatch: %u %s\n", (int)Lines.size(), ReferenceCount, ReferenceFired.c_str(), CompiledCount, Fired.c_str());
+    }
+}
+
+char Shared[1024];
+Blech *pRefeed = 0;
+int RefeedDepth = 0;
+
+// what a plugin writing to chat from its event does: the chat hook copies the new line
+// into the buffer being fed and feeds it
+void Refeed()
+{
+    if (!pRefeed || RefeedDepth > 1)
+        return;
+    RefeedDepth++;
+    std::string Saved = Fired;
+    for (int i = 0; i < 20; i++) {
+        sprintf_s(Shared, "A bat hits you for %d damage, it goes on a rampage %d", i * 1000, i);
+        pRefeed->Feed(Shared);
+    }
+    Shared[0] = 0;
+    Fired = Saved;
+    RefeedDepth--;
+}
+
+void __stdcall RefeedEvent(unsigned int ID, void *pData, PBLECHVALUE pValues)
+{
+    Refeed();
+    RecordEvent(ID, pData, pValues);
+}
+
+void __stdcall RefeedSpans(unsigned int ID, void *pData, const char *Input, PBLECHCAPTURE pCaptures, unsigned int nCaptures)
+{
+    Refeed();
+    RecordSpans(ID, pData, Input, pCaptures, nCaptures);
+}
+
+std::string FeedShared(bool Reenter, bool Spans)
+{
+    Blech b('#', '|', VariableValue);
+    for (int i = 0; i < sizeof(Events) / sizeof(Events[0]); i++) {
+        if (Spans)
+            b.AddEvent(Events[i], RefeedSpans, (void *)(INT_PTR)i);
+        else
+            b.AddEvent(Events[i], RefeedEvent, (void *)(INT_PTR)i);
+    }
+    pRefeed = Reenter ? &b : 0;
+    Fired.clear();
+    for (int i = 0; i < sizeof(Lines) / sizeof(Lines[0]); i++) {
+        strcpy_s(Shared, Lines[i]);
+        b.Feed(Shared);
+    }
+    pRefeed = 0;
+    return Fired;
+}
+
+int main()
+{
+    Blech Reference('#', '|', VariableValue);
+    Blech Compiled('#', '|', VariableValue);
+    Reference.UseCompiled = false;
+    Reference.UsePrefilter = false;
+
+    for (int i = 0; i < sizeof(Events) / sizeof(Events[0]); i++) {
+        Reference.AddEvent(Events[i], RecordEvent, (void *)(INT_PTR)i);
+        Compiled.AddEvent(Events[i], RecordSpans, (void *)(INT_PTR)i);
+    }
+    for (int i = 0; i < sizeof(Lines) / sizeof(Lines[0]); i++)
+        Compare(Reference, Compiled, Lines[i]);
+
+    int nLines = 0;
+    for (int Round = 0; Round < 2000; Round++) {
+        Reference.Reset();
+        Compiled.Reset();
+        std::vector<unsigned int> IDs;
+        std::vector<std::string> RoundLines;
+        for (int Line = 0; Line < 200; Line++, nLines++) {
+            if (!Random(4)) {
+                std::string Pattern = RandomPattern();
+                unsigned int ID = Reference.AddEvent(Pattern.c_str(), RecordEvent, (void *)(INT_PTR)Line);
+                if (ID != Compiled.AddEvent(Pattern.c_str(), RecordSpans, (void *)(INT_PTR)Line)) {
+                    printf("event IDs differ for '%s'\n", Pattern.c_str());
+                    return 1;
+                }
+                IDs.push_back(ID);
+            }
+            if (!Random(10) && IDs.size()) {
+                unsigned int N = Random((unsigned int)IDs.size());
+                Reference.RemoveEvent(IDs[N]);
+                Compiled.RemoveEvent(IDs[N]);
+                IDs.erase(IDs.begin() + N);
+            }
+            RoundLines.push_back(RandomText(14));
+            Compare(Reference, Compiled, RoundLines.back().c_str());
+        }
+        CompareBatch(Reference, Compiled, RoundLines);
+    }
+    for (int Spans = 0; Spans < 2; Spans++) {
+        if (FeedShared(false, Spans != 0) != FeedShared(true, Spans != 0)) {
+            printf("a callback feeding again changed what %s callbacks got\n", Spans ? "span" : "old style");
+            Failures++;
+        }
+    }
+    if (Failures) {
+        printf("%d of %d lines differ\n", Failures, nLines);
+        return 1;
+    }
+    printf("%d lines match\n", nLines);
+    printf("!!!!!!!!!!!!!!! SUCCESS !!!!!!!!!!!!!!!!!!!\n");
+    return 0;
+}
@@ -0,0 +1,707 @@
+// Checks Calculate against the calculator it replaced (OldCalculate below, as it was
+// before formulas were parsed once and cached) and times the two on formulas the way
+// /varcalc, ${Math.Calc[]} and /if hand them over once their ${...} are expanded. The
+// last row changes the formula every call so it never hits the cache.
+//
+// Then runs random formulas over every operator through both, twice so the cached
+// program is checked as well, and reports any result that isn't bit for bit the same.
+// Small formulas go through CalculateInt64 too, which has to agree with Calculate on
+// them, and a few formulas it has to get exactly right are checked last.
+//
+// usage: calc [count] [seed]
+//   count   times each formula is calculated, and random formulas run (default 100000)
+//   seed    for the random formulas (default 1)
+//
+// Links against MQ2Main like a plugin and runs as a plain console program. Dividing
+// by zero is reported through FatalError, which doesn't print anything outside the game.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "../MQ2Plugin.h"
+
+int OldCalcOpPrecedence[CO_TOTAL] =
+{
+	0,
+	0,
+	0,
+	9,//add
+	9,//subtract
+	10,//multiply
+	10,//divide
+	10,//integer divide
+	2,//logical and
+	5,//bitwise and
+	1,//logical or
+	3,//bitwise or
+	4,//bitwise xor
+	6,//equal
+	6,//not equal
+	7,//greater
+	7,//not greater
+	7,//less
+	7,//not less
+	10,//modulus
+	11,//power
+	12,//logical not
+	12,//bitwise not
+	8,//shl
+	8,//shr
+	12,//negate
+};
+
+struct _CalcOp
+{
+	eCalcOp Op;
+	DOUBLE Value;
+};
+
+BOOL OldEvaluateRPN(_CalcOp *pList, int Size, DOUBLE &Result)
+{
+	if (!Size)
+		return 0;
+	// sized from the op count and cleared here. Size/2+2 overflowed on groups like
+	// (1)(2)(3), and an operator with nothing under it read whatever was in the stack.
+	int StackSize = (sizeof(DOUBLE)*(Size + 1));
+	if(DOUBLE *pStack = (DOUBLE*)calloc(1, StackSize)) {
+		int nStack = 0;
+		#define StackEmpty() (nStack==0)
+		#define StackTop() (pStack[nStack])
+		#define StackSetTop(do_assign) {pStack[nStack]##do_assign;}
+		#define StackPush(val) {nStack++;pStack[nStack]=val;}
+		#define StackPop() {if (!nStack) {FatalError("Illegal arithmetic in calculation");free(pStack);return 0;};nStack--;}
+
+		#define BinaryIntOp(op) {int RightSide=(int)StackTop();StackPop();StackSetTop(=(DOUBLE)(((int)StackTop())##op##RightSide));}
+		#define BinaryOp(op) {DOUBLE RightSide=StackTop();StackPop();StackSetTop(=StackTop()##op##RightSide);}
+		#define BinaryAssign(op) {DOUBLE RightSide=StackTop();StackPop();StackSetTop(##op##=RightSide);}
+
+		#define UnaryIntOp(op) {StackSetTop(=op##((int)StackTop()));}
+		#define UnaryOp(op)    {StackSetTop(=op##(StackTop()));}
+		for (int i = 0; i < Size; i++)
+		{
+			switch (pList[i].Op)
+			{
+			case CO_NUMBER:
+				StackPush(pList[i].Value);
+				break;
+			case CO_ADD:
+				BinaryAssign(+);
+				break;
+			case CO_MULTIPLY:
+				BinaryAssign(*);
+				break;
+			case CO_SUBTRACT:
+				BinaryAssign(-);
+				break;
+			case CO_NEGATE:
+				UnaryOp(-);
+				break;
+			case CO_DIVIDE:
+				if (StackTop())
+				{
+					BinaryAssign(/ );
+				}
+				else
+				{
+					//printf("Divide by zero error\n");
+					FatalError("Divide by zero in calculation");
+					free(pStack);
+					return false;
+				}
+				break;
+			case CO_IDIVIDE://TODO: SPECIAL HANDLING
+			{
+				int Right = (int)StackTop();
+				if (Right)
+				{
+					StackPop();
+					int Left = (int)StackTop();
+					Left /= Right;
+					StackSetTop(= Left);
+				}
+				else
+				{
+					//printf("Integer divide by zero error\n");
+					FatalError("Divide by zero in calculation");
+					free(pStack);
+					return false;
+				}
+			}
+			break;
+			case CO_MODULUS://TODO: SPECIAL HANDLING
+			{
+				int Right = (int)StackTop();
+				if (Right)
+				{
+					StackPop();
+					int Left = (int)StackTop();
+					Left %= Right;
+					StackSetTop(= Left);
+				}
+				else
+				{
+					//printf("Modulus by zero error\n");
+					FatalError("Modulus by zero in calculation");
+					free(pStack);
+					return false;
+				}
+			}
+			break;
+			case CO_LAND:
+				BinaryOp(&&);
+				break;
+			case CO_LOR:
+				BinaryOp(|| );
+				break;
+			case CO_EQUAL:
+				BinaryOp(== );
+				break;
+			case CO_NOTEQUAL:
+				BinaryOp(!= );
+				break;
+			case CO_GREATER:
+				BinaryOp(>);
+				break;
+			case CO_NOTGREATER:
+				BinaryOp(<= );
+				break;
+			case CO_LESS:
+				BinaryOp(<);
+				break;
+			case CO_NOTLESS:
+				BinaryOp(>= );
+				break;
+			case CO_SHL:
+				BinaryIntOp(<< );
+				break;
+			case CO_SHR:
+				BinaryIntOp(>> );
+				break;
+			case CO_AND:
+				BinaryIntOp(&);
+				break;
+			case CO_OR:
+				BinaryIntOp(| );
+				break;
+			case CO_XOR:
+				BinaryIntOp(^);
+				break;
+			case CO_LNOT:
+				UnaryIntOp(!);
+				break;
+			case CO_NOT:
+				UnaryIntOp(~);
+				break;
+			case CO_POWER:
+			{
+				DOUBLE RightSide = StackTop();
+				StackPop();
+				StackSetTop(= pow(StackTop(), RightSide));
+			}
+			break;
+			}
+		}
+		Result = StackTop();
+
+		#undef StackEmpty
+		#undef StackTop
+		#undef StackPush
+		#undef StackPop
+		try {
+			free(pStack);
+			return true;
+		} catch(...) {
+			MessageBox(NULL, "Tried to free the stack in EvaluateRPN but failed", "MQ2 Error", MB_SYSTEMMODAL | MB_OK);
+		}
+	}
+	return false;
+}
+
+BOOL OldFastCalculate(PCHAR szFormula, DOUBLE &Result)
+{
+	//DebugSpew("FastCalculate(%s)",szFormula);
+	if (!szFormula || !szFormula[0])
+		return false;
+	int Length = (int)strlen(szFormula);
+	int MaxOps = (Length + 1);
+	int ListSize = sizeof(_CalcOp)*MaxOps;
+	int StackSize = sizeof(eCalcOp)*MaxOps;
+	_CalcOp *pOpList = (_CalcOp *)malloc(ListSize);
+	eCalcOp *pStack = (eCalcOp *)malloc(StackSize);
+	memset(pOpList, 0, ListSize);
+	memset(pStack, 0, StackSize);
+	int nOps = 0;
+	int nStack = 0;
+	char *pEnd = szFormula + Length;
+	char CurrentToken[MAX_STRING] = { 0 };
+	char *pToken = &CurrentToken[0];
+
+#define OpToList(op) {pOpList[nOps].Op=op;nOps++;}
+#define ValueToList(val) {pOpList[nOps].Value=val;nOps++;}
+#define StackEmpty() (nStack==0)
+#define StackTop() (pStack[nStack])
+#define StackPush(op) {nStack++;pStack[nStack]=op;}
+#define StackPop() {if (!nStack) {FatalError("Illegal arithmetic in calculation");free(pOpList);free(pStack);return 0;} nStack--;}
+#define HasPrecedence(a,b) (OldCalcOpPrecedence[a]>=OldCalcOpPrecedence[b])
+#define MoveStack(op)  \
+    { \
+    while(!StackEmpty() && StackTop()!=CO_OPENPARENS && HasPrecedence(StackTop(),op)) \
+    { \
+    OpToList(StackTop()); \
+    StackPop(); \
+    } \
+    }
+
+#define FinishString() {if (pToken!=&CurrentToken[0]) {*pToken=0;ValueToList(atof(CurrentToken));pToken=&CurrentToken[0];*pToken=0;}}
+#define NewOp(op) {FinishString();MoveStack(op);StackPush(op);}
+#define NextChar(ch) {*pToken=ch;pToken++;}
+
+	bool WasParen = false;
+	for (char *pCur = szFormula; pCur<pEnd; pCur++)
+	{
+		switch (*pCur)
+		{
+		case ' ':
+			continue;
+		case '(':
+			FinishString();
+			StackPush(CO_OPENPARENS);
+			break;
+		case ')':
+			FinishString();
+			while (StackTop() != CO_OPENPARENS)
+			{
+				OpToList(StackTop());
+				StackPop();
+			}
+			StackPop();
+			WasParen = true;
+			continue;
+		case '+':
+			if (pCur[1] != '+')
+				NewOp(CO_ADD);
+			break;
+		case '-':
+			if (pCur[1] == '-')
+			{
+				pCur++;
+				NewOp(CO_ADD);
+			}
+			else
+			{
+				if (CurrentToken[0] || WasParen)
+				{
+					NewOp(CO_SUBTRACT);
+				}
+				else
+					NewOp(CO_NEGATE);
+			}
+			break;
+		case '*':
+			NewOp(CO_MULTIPLY);
+			break;
+		case '\\':
+			NewOp(CO_IDIVIDE);
+			break;
+		case '/':
+			NewOp(CO_DIVIDE);
+			break;
+		case '|':
+			if (pCur[1] == '|')
+			{
+				// Logical OR
+				++pCur;
+				NewOp(CO_LOR);
+			}
+			else
+			{
+				// Bitwise OR
+				NewOp(CO_OR);
+			}
+			break;
+		case '%':
+			NewOp(CO_MODULUS);
+			break;
+		case '~':
+			NewOp(CO_NOT);
+			break;
+		case '&':
+			if (pCur[1] == '&')
+			{
+				// Logical AND
+				++pCur;
+				NewOp(CO_LAND);
+			}
+			else
+			{
+				// Bitwise AND
+				NewOp(CO_AND);
+			}
+			break;
+		case '^':
+			if (pCur[1] == '^')
+			{
+				// XOR
+				++pCur;
+				NewOp(CO_XOR);
+			}
+			else
+			{
+				// POWER
+				NewOp(CO_POWER);
+			}
+			break;
+		case '!':
+			if (pCur[1] == '=')
+			{
+				++pCur;
+				NewOp(CO_NOTEQUAL);
+			}
+			else
+			{
+				NewOp(CO_LNOT);
+			}
+			break;
+		case '=':
+			if (pCur[1] == '=')
+			{
+				++pCur;
+				NewOp(CO_EQUAL);
+			}
+			else
+			{
+				//printf("Unparsable: '%c'\n",*pCur);
+				// error
+				free(pOpList);
+				free(pStack);
+				return false;
+			}
+			break;
+		case '<':
+			if (pCur[1] == '=')
+			{
+				++pCur;
+				NewOp(CO_NOTGREATER);
+			}
+			else if (pCur[1] == '<')
+			{
+				++pCur;
+				NewOp(CO_SHL);
+			}
+			else
+			{
+				NewOp(CO_LESS);
+			}
+			break;
+		case '>':
+			if (pCur[1] == '=')
+			{
+				++pCur;
+				NewOp(CO_NOTLESS);
+			}
+			else if (pCur[1] == '>')
+			{
+				++pCur;
+				NewOp(CO_SHR);
+			}
+			else
+			{
+				NewOp(CO_GREATER);
+			}
+			break;
+		case '.':
+		case '1':
+		case '2':
+		case '3':
+		case '4':
+		case '5':
+		case '6':
+		case '7':
+		case '8':
+		case '9':
+		case '0':
+			NextChar(*pCur);
+			break;
+		default:
+		{
+			//printf("Unparsable: '%c'\n",*pCur);
+			FatalError("Unparsable in Calculation: '%c'", *pCur);
+			// unparsable
+			free(pOpList);
+			free(pStack);
+			return false;
+		}
+		break;
+		}
+		WasParen = false;
+	}
+	FinishString();
+
+	while (!StackEmpty())
+	{
+		OpToList(StackTop());
+		StackPop();
+	}
+	free(pStack);
+	/*
+	for (int i = 0 ; i < nOps ; i++)
+	{
+	if (pOpList[i].Op)
+	printf("Op: %d\n",pOpList[i].Op);
+	else
+	printf("Value: %f\n",pOpList[i].Value);
+	}
+	/**/
+	BOOL Ret = OldEvaluateRPN(pOpList, nOps, Result);
+	free(pOpList);
+	return Ret;
+}
+
+BOOL OldCalculate(PCHAR szFormula, DOUBLE &Result)
+{
+	CHAR Buffer[MAX_STRING] = { 0 };
+	strcpy_s(Buffer, szFormula);
+	_strupr_s(Buffer);
+	while (PCHAR pNull = strstr(Buffer, "NULL"))
+	{
+		pNull[0] = '0';
+		pNull[1] = '.';
+		pNull[2] = '0';
+		pNull[3] = '0';
+	}
+	while (PCHAR pTrue = strstr(Buffer, "TRUE"))
+	{
+		pTrue[0] = '1';
+		pTrue[1] = '.';
+		pTrue[2] = '0';
+		pTrue[3] = '0';
+	}
+	while (PCHAR pFalse = strstr(Buffer, "FALSE"))
+	{
+		pFalse[0] = '0';
+		pFalse[1] = '.';
+		pFalse[2] = '0';
+		pFalse[3] = '0';
+		pFalse[4] = '0';
+	}
+	BOOL Ret;
+	//Benchmark(bmCalculate,Ret=ActualCalculate(Buffer,Result));
+	Benchmark(bmCalculate, Ret = OldFastCalculate(Buffer, Result));
+	return Ret;
+}
+
+PCHAR Corpus[] = {
+	// /varcalc
+	"1234+1",
+	"57*1.5",
+	"(4500-2310)/4500*100",
+	"3600\\60",
+	"12345%60",
+	"2^10-1",
+	// bookkeeping: platinum totals, coin conversion, flag words
+	"1234567*1000+250*100+17*10+3",
+	"(98765432 \\ 1000) % 1000",
+	"12345678 - 12345678 \\ 100 * 100",
+	"(4096 | 512 | 8) & ~512",
+	"1 << 12 | 1 << 3",
+	// ${Math.Calc[]}
+	"((101.25-87.5)^2+(-45.75-12.25)^2)^0.5",
+	"1234.56*0.01",
+	"100-((100*37)/100)",
+	// /if
+	"0 && 1 || 57>40",
+	"TRUE && NULL == 0",
+	"!(3>=2) || 87.50 < 90",
+	"FALSE || 35.00 >= 1234 && 1",
+	0
+};
+
+static int RandomCalcChoice(DWORD &Seed, int Choices)
+{
+	Seed = Seed * 1103515245 + 12345;
+	return (int)((Seed >> 16) % Choices);
+}
+
+// a random formula over every operator, leaning on integers and the edges of int and
+// DOUBLE. Small ones only use operators and numbers that keep every step well inside an
+// int, where the DOUBLE evaluator is exact and the int64 one has to agree with it.
+static VOID GenerateCalcFormula(std::string &Formula, DWORD &Seed, int Depth, BOOL Small)
+{
+	static PCHAR Operators[] = { "+", "-", "*", "/", "\\", "%", "&&", "||", "&", "|", "^^", "==", "!=", "<", ">", "<=", ">=", "^", "<<", ">>" };
+	static PCHAR Numbers[] = { "0", "1", "2", "3", "7", "10", "31", "32", "255", "1000", "65536", "2147483647", "2147483648", "4294967296",
+		"9007199254740992", "9007199254740993", "123456789012", "999999999999999999", "0.5", "2.25", "1.00", "0.000" };
+	int nOperators = sizeof(Operators) / sizeof(Operators[0]) - (Small ? 3 : 0);
+	switch (Depth > (Small ? 1 : 4) ? 0 : RandomCalcChoice(Seed, 6))
+	{
+	case 0:
+		if (Small)
+			Formula += RandomCalcChoice(Seed, 4) ? std::to_string(RandomCalcChoice(Seed, 100)) : "2.25";
+		else if (RandomCalcChoice(Seed, 2))
+			Formula += Numbers[RandomCalcChoice(Seed, sizeof(Numbers) / sizeof(Numbers[0]))];
+		else
+			Formula += std::to_string(RandomCalcChoice(Seed, 100000));
+		break;
+	case 1:
+		Formula += "-";
+		GenerateCalcFormula(Formula, Seed, Depth + 1, Small);
+		break;
+	case 2:
+		Formula += RandomCalcChoice(Seed, 2) ? "!" : "~";
+		GenerateCalcFormula(Formula, Seed, Depth + 1, Small);
+		break;
+	case 3:
+		Formula += "(";
+		GenerateCalcFormula(Formula, Seed, Depth + 1, Small);
+		Formula += ")";
+		break;
+	default:
+		GenerateCalcFormula(Formula, Seed, Depth + 1, Small);
+		Formula += Operators[RandomCalcChoice(Seed, nOperators)];
+		GenerateCalcFormula(Formula, Seed, Depth + 1, Small);
+		break;
+	}
+}
+
+// INT_MIN \ -1 and INT_MIN % -1 fault in both calculators, that counts as an answer
+// of its own (-1)
+static int GuardedCalculate(BOOL (*pCalculate)(PCHAR, DOUBLE &), PCHAR szFormula, DOUBLE &Result)
+{
+	__try
+	{
+		return pCalculate(szFormula, Result);
+	}
+	__except (GetExceptionCode() == EXCEPTION_INT_OVERFLOW ? EXCEPTION_EXECUTE_HANDLER : EXCEPTION_CONTINUE_SEARCH)
+	{
+		return -1;
+	}
+}
+
+int FuzzCalculate(int Count, DWORD Seed)
+{
+	std::vector<std::string> Formulas;
+	for (int N = 0; N < Count; N++)
+	{
+		std::string Formula;
+		GenerateCalcFormula(Formula, Seed, 0, false);
+		if (Formula.size() < MAX_STRING)
+			Formulas.push_back(Formula);
+	}
+	int nMismatches = 0;
+	int nErrors = 0;
+	for (auto &Formula : Formulas)
+	{
+		DOUBLE Expected = 0;
+		int ExpectedRet = GuardedCalculate(OldCalculate, &Formula[0], Expected);
+		if (ExpectedRet != 1)
+			nErrors++;
+		for (int Pass = 0; Pass < 2; Pass++)
+		{
+			DOUBLE Result = 0;
+			int Ret = GuardedCalculate(Calculate, &Formula[0], Result);
+			if (Ret != ExpectedRet || (Ret == 1 && memcmp(&Result, &Expected, sizeof(DOUBLE)) && !(Result != Result && Expected != Expected)))
+			{
+				if (nMismatches++ < 5)
+					printf("%s: old %d %g, Calculate %d %g\n", Formula.c_str(), ExpectedRet, Expected, Ret, Result);
+				break;
+			}
+		}
+	}
+	printf("%d formulas (%d failed), %d mismatches\n", (int)Formulas.size(), nErrors, nMismatches);
+
+	int nExactMismatches = 0;
+	for (int N = 0; N < Count; N++)
+	{
+		std::string Formula;
+		GenerateCalcFormula(Formula, Seed, 0, true);
+		DOUBLE Expected = 0;
+		__int64 Exact = 0;
+		BOOL ExpectedRet = Calculate(&Formula[0], Expected);
+		BOOL Ret = CalculateInt64(&Formula[0], Exact);
+		// CalculateInt64 truncates a result that isn't a whole number the way /varcalc does
+		CHAR szExpected[MAX_STRING];
+		sprintf_s(szExpected, "%f", Expected);
+		if (Ret != ExpectedRet || (Ret && Exact != _atoi64(szExpected)))
+		{
+			if (nExactMismatches++ < 5)
+				printf("%s: Calculate %d %g, int64 %d %I64d\n", Formula.c_str(), ExpectedRet, Expected, Ret, Exact);
+		}
+	}
+	printf("%d small formulas, %d int64 mismatches\n", Count, nExactMismatches);
+
+	struct
+	{
+		PCHAR szFormula;
+		__int64 Expected;
+	} ExactChecks[] = {
+		{ "9007199254740993+0", 9007199254740993LL },
+		{ "123456789012*1000+987", 123456789012987LL },
+		{ "-9007199254740993+2", -9007199254740991LL },
+		{ "9007199254740993 \\ 2", 4503599627370496LL },
+		{ "2^40 % 1000", 776 },
+		{ "1 << 40", 1099511627776LL },
+		{ "3000000000 & 4294967295", 3000000000LL },
+		{ "999999999999999999 - 1", 999999999999999998LL },
+		{ "10/4", 2 },
+	};
+	int nExactFailed = 0;
+	for (auto &Check : ExactChecks)
+	{
+		__int64 Result = 0;
+		if (!CalculateInt64(Check.szFormula, Result) || Result != Check.Expected)
+		{
+			printf("int64 %s: expected %I64d, got %I64d\n", Check.szFormula, Check.Expected, Result);
+			nExactFailed++;
+		}
+	}
+	return nMismatches + nExactMismatches + nExactFailed;
+}
+
+int main(int argc, char *argv[])
+{
+	int Count = argc > 1 ? atoi(argv[1]) : 100000;
+	if (Count <= 0)
+		Count = 100000;
+	DWORD Seed = argc > 2 ? (DWORD)atoi(argv[2]) : 1;
+	CHAR szUnique[MAX_STRING];
+	LARGE_INTEGER Frequency;
+	QueryPerformanceFrequency(&Frequency);
+	double Total[2] = { 0, 0 };
+	int nMismatches = 0;
+	for (PCHAR *ppFormula = &Corpus[0]; ; ppFormula++)
+	{
+		bool Unique = !*ppFormula;
+		double Elapsed[2];
+		DOUBLE Result[2] = { 0, 0 };
+		for (int Engine = 0; Engine < 2; Engine++)
+		{
+			LARGE_INTEGER Start, End;
+			QueryPerformanceCounter(&Start);
+			for (int N = 0; N < Count; N++)
+			{
+				PCHAR szFormula = *ppFormula;
+				if (Unique)
+				{
+					sprintf_s(szUnique, "%d*1.5+%d", N, N % 7);
+					szFormula = szUnique;
+				}
+				if (Engine)
+					Calculate(szFormula, Result[Engine]);
+				else
+					OldCalculate(szFormula, Result[Engine]);
+			}
+			QueryPerformanceCounter(&End);
+			Elapsed[Engine] = (double)(End.QuadPart - Start.QuadPart) * 1000000000.0 / (double)Frequency.QuadPart / Count;
+			Total[Engine] += Elapsed[Engine];
+		}
+		bool Differ = memcmp(&Result[0], &Result[1], sizeof(DOUBLE)) != 0;
+		if (Differ)
+			nMismatches++;
+		printf("%s: old %.0fns, cached %.0fns%s\n", Unique ? "(unique formulas)" : *ppFormula,
+			Elapsed[0], Elapsed[1], Differ ? " RESULTS DIFFER" : "");
+		if (Unique)
+			break;
+	}
+	printf("total: old %.0fns, cached %.0fns\n", Total[0], Total[1]);
+	nMismatches += FuzzCalculate(Count, Seed);
+	return nMismatches ? 1 : 0;
+}
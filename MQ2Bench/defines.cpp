@@ -0,0 +1,110 @@
+// Times #define expansion over a generated macro: the old walk of the define list, against
+// AddMacroLine, which expands them with the automaton. Every line is checked to come out
+// the same both ways. The AddMacroLine time includes adding the line to the macro, which
+// a load pays either way.
+//
+// usage: defines [lines] [defines]
+//   lines     generated macro lines (default 50000)
+//   defines   #defines loaded ahead of them (default 300)
+//
+// Links against MQ2Main like a plugin. It loads the #defines and lines with AddMacroLine
+// the way /macro would, which works outside the game, so it runs as a plain console
+// program.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "../MQ2Plugin.h"
+
+// how AddMacroLine used to apply the defines
+VOID ExpandDefinesInList(PCHAR szLine, size_t Linelen)
+{
+	PDEFINE pDef = pDefines;
+	while (pDef)
+	{
+		while (strstr(szLine, pDef->szName))
+		{
+			CHAR szNew[MAX_STRING] = { 0 };
+			strncpy_s(szNew, szLine, strstr(szLine, pDef->szName) - szLine);
+			strcat_s(szNew, pDef->szReplace);
+			strcat_s(szNew, strstr(szLine, pDef->szName) + strlen(pDef->szName));
+			strcpy_s(szLine, Linelen, szNew);
+		}
+		pDef = pDef->pNext;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int nLines = argc > 1 ? atoi(argv[1]) : 50000;
+	if (nLines <= 0)
+		nLines = 50000;
+	int nDefines = argc > 2 ? atoi(argv[2]) : 300;
+	if (nDefines <= 0)
+		nDefines = 300;
+
+	// every tenth define expands to another one, so some lines need more than one pass
+	CHAR szLine[MAX_STRING];
+	for (int N = 0; N < nDefines; N++)
+	{
+		if (N && N % 10 == 0)
+			sprintf_s(szLine, "#define DEF_%d_ DEF_%d_+1", N, N - 1);
+		else
+			sprintf_s(szLine, "#define DEF_%d_ ${Int[%d]}", N, N);
+		AddMacroLine(szLine, sizeof(szLine));
+	}
+	std::vector<std::string> Lines(nLines);
+	for (int N = 0; N < nLines; N++)
+	{
+		switch (N % 8)
+		{
+		case 0:
+			sprintf_s(szLine, "/if (${Counter}>DEF_%d_) /varcalc Counter ${Counter}+DEF_%d_", N % nDefines, (N * 7) % nDefines);
+			break;
+		case 1:
+			sprintf_s(szLine, "/varset Spell%d ${Me.Gem[%d].Name}", N, N % 12);
+			break;
+		case 2:
+			strcpy_s(szLine, "/if (${Me.PctHPs}<50 && ${Target.ID}) {");
+			break;
+		case 3:
+			sprintf_s(szLine, "/echo line %d of the generated macro, nothing to expand here", N);
+			break;
+		default:
+			sprintf_s(szLine, "/call Routine%d ${Target.ID} \"${Target.CleanName}\"", N % 100);
+		}
+		Lines[N] = szLine;
+	}
+
+	LARGE_INTEGER Frequency;
+	QueryPerformanceFrequency(&Frequency);
+	double Elapsed[2];
+	std::vector<std::string> Expanded(nLines);
+	int nDiffer = 0;
+	for (int Engine = 0; Engine < 2; Engine++)
+	{
+		LARGE_INTEGER Start, End;
+		QueryPerformanceCounter(&Start);
+		for (int N = 0; N < nLines; N++)
+		{
+			strcpy_s(szLine, Lines[N].c_str());
+			if (!Engine)
+			{
+				ExpandDefinesInList(szLine, sizeof(szLine));
+				Expanded[N] = szLine;
+			}
+			else if (PMACROBLOCK pBlock = AddMacroLine(szLine, sizeof(szLine)))
+			{
+				if (Expanded[N] != pBlock->Line)
+					nDiffer++;
+			}
+			else
+				nDiffer++;
+		}
+		QueryPerformanceCounter(&End);
+		Elapsed[Engine] = (double)(End.QuadPart - Start.QuadPart) * 1000.0 / (double)Frequency.QuadPart;
+	}
+	printf("%d lines, %d defines: define list %.1fms, automaton %.1fms%s\n",
+		nLines, nDefines, Elapsed[0], Elapsed[1], nDiffer ? " RESULTS DIFFER" : "");
+	return nDiffer ? 1 : 0;
+}
@@ -0,0 +1,114 @@
+// Adds 500 commands and times finding full and abbreviated names among them: the walk
+// of pCommands HideDoCommand used to do, against a search of the sorted index it keeps
+// now. The index is internal to MQ2Main, so it's taken here from pCommands, which
+// AddCommand keeps in the same order, and that order is checked first.
+//
+// usage: dispatch [count]
+//   count   lookups timed for each name (default 100000)
+//
+// Links against MQ2Main like a plugin. AddCommand and RemoveCommand work outside the
+// game, so it runs as a plain console program.
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+#include "../MQ2Plugin.h"
+
+// how HideDoCommand used to find a command
+PMQCOMMAND FindCommandInList(PCHAR szName)
+{
+	for (PMQCOMMAND pCommand = pCommands; pCommand; pCommand = pCommand->pNext)
+	{
+		if (pCommand->InGameOnly && gGameState != GAMESTATE_INGAME)
+			continue;
+		int Pos = _strnicmp(szName, pCommand->Command, strlen(szName));
+		if (Pos < 0)
+			break;
+		if (Pos == 0)
+			return pCommand;
+	}
+	return 0;
+}
+
+// the lookup HideDoCommand does in its index
+PMQCOMMAND FindCommandInIndex(std::vector<PMQCOMMAND> &Index, PCHAR szName)
+{
+	size_t Len = strlen(szName);
+	auto iter = std::lower_bound(Index.begin(), Index.end(), szName,
+		[Len](PMQCOMMAND pCommand, PCHAR szName) { return _strnicmp(pCommand->Command, szName, Len) < 0; });
+	for (; iter != Index.end() && !_strnicmp((*iter)->Command, szName, Len); ++iter)
+	{
+		if (!(*iter)->InGameOnly || gGameState == GAMESTATE_INGAME)
+			return *iter;
+	}
+	return 0;
+}
+
+VOID NoCommand(PSPAWNINFO pChar, PCHAR szLine)
+{
+}
+
+int main(int argc, char *argv[])
+{
+	int Count = argc > 1 ? atoi(argv[1]) : 100000;
+	if (Count <= 0)
+		Count = 100000;
+	CHAR szName[MAX_STRING];
+	// in a shuffled order, AddCommand has to put them in place
+	for (int N = 0; N < 500; N++)
+	{
+		sprintf_s(szName, "/benchcmd%03d", (N * 347) % 500);
+		AddCommand(szName, NoCommand, 0, 0, 0);
+	}
+	AddCommand("/echo", NoCommand, 0, 1, 0);
+	AddCommand("/varset", NoCommand, 0, 1, 0);
+	AddCommand("/target", NoCommand, 0, 1, 1);
+
+	std::vector<PMQCOMMAND> Index;
+	int nUnsorted = 0;
+	for (PMQCOMMAND pCommand = pCommands; pCommand; pCommand = pCommand->pNext)
+	{
+		if (Index.size() && _stricmp(Index.back()->Command, pCommand->Command) > 0)
+			nUnsorted++;
+		Index.push_back(pCommand);
+	}
+	printf("%d commands registered%s\n", (int)Index.size(), nUnsorted ? ", pCommands OUT OF ORDER" : "");
+
+	PCHAR Names[] = { "/benchcmd000", "/benchcmd250", "/benchcmd499", "/benchcmd49", "/echo", "/varset", "/tar", "/zzz", 0 };
+	int nDiffer = 0;
+	LARGE_INTEGER Frequency;
+	QueryPerformanceFrequency(&Frequency);
+	for (PCHAR *pName = &Names[0]; *pName; pName++)
+	{
+		double Elapsed[2];
+		PMQCOMMAND pFound[2];
+		for (int Engine = 0; Engine < 2; Engine++)
+		{
+			LARGE_INTEGER Start, End;
+			QueryPerformanceCounter(&Start);
+			for (int N = 0; N < Count; N++)
+				pFound[Engine] = Engine ? FindCommandInIndex(Index, *pName) : FindCommandInList(*pName);
+			QueryPerformanceCounter(&End);
+			Elapsed[Engine] = (double)(End.QuadPart - Start.QuadPart) * 1000000000.0 / (double)Frequency.QuadPart / Count;
+		}
+		if (pFound[0] != pFound[1])
+			nDiffer++;
+		printf("%s -> %s: list %.1fns, index %.1fns%s\n", *pName, pFound[1] ? pFound[1]->Command : "none",
+			Elapsed[0], Elapsed[1], pFound[0] != pFound[1] ? " RESULTS DIFFER" : "");
+	}
+
+	for (int N = 0; N < 500; N++)
+	{
+		sprintf_s(szName, "/benchcmd%03d", N);
+		RemoveCommand(szName);
+	}
+	RemoveCommand("/echo");
+	RemoveCommand("/varset");
+	RemoveCommand("/target");
+	if (pCommands)
+	{
+		printf("commands left after removing them all\n");
+		return 1;
+	}
+	return nUnsorted || nDiffer ? 1 : 0;
+}
@@ -0,0 +1,84 @@
+// Checks that an #event with a print variable matches again after the variable is
+// written. Blech keeps a print variable's value until gVariableGeneration moves, so a
+// write that doesn't move it leaves the event matching the old value. Runs a
+// /for i 1 to 3 ... /next i loop with an event on |${i}| and feeds the line for the
+// current and the previous pass each time round, then does the same after a /varset.
+//
+// usage: events
+//
+// Links against MQ2Main like a plugin. /for and /next aren't exported, so the loop
+// variable is written the way they write it, through SetMQ2DataVariable. The lookup
+// callbacks are the ones MQ2Main gives pEventBlech, less the in game check.
+#include <stdio.h>
+#include <stdlib.h>
+#include "../MQ2Plugin.h"
+
+unsigned int __stdcall VariableValue(char *VarName, char *Value, size_t ValueLen)
+{
+	strcpy_s(Value, ValueLen, VarName);
+	ParseMacroData(Value, ValueLen);
+	return strlen(Value);
+}
+
+unsigned int __stdcall VariableGeneration(char *VarName)
+{
+	if (MacroDataIsLive(VarName))
+		return 0;
+	return gVariableGeneration;
+}
+
+int Fired = 0;
+
+void __stdcall Round(unsigned int ID, void *pData, PBLECHVALUE pValues)
+{
+	Fired++;
+}
+
+int nFailed = 0;
+
+// feeds the line for pass N and reports if it didn't fire the event as Expected
+void FeedRound(Blech &Events, int N, bool Expected, PCHAR szAfter)
+{
+	CHAR szLine[MAX_STRING];
+	sprintf_s(szLine, "Round %d of 3", N);
+	Fired = 0;
+	Events.Feed(szLine);
+	if ((Fired != 0) != Expected)
+	{
+		printf("after %s, '%s' %s\n", szAfter, szLine, Expected ? "didn't match" : "still matched");
+		nFailed++;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	InitializeMQ2Benchmarks();
+	InitializeParser();
+	AddMQ2DataVariable("i", "", pIntType, &pGlobalVariables, "0");
+	PDATAVAR pVar = FindMQ2DataVariable("i");
+
+	Blech Events('#', '|', VariableValue, VariableGeneration);
+	Events.AddEvent("Round |${i}| of 3", Round);
+	FeedRound(Events, 0, true, "the declare");
+
+	// /for i 1 to 3
+	SetMQ2DataVariable(pVar->Var.Type, pVar->Var.VarPtr, "1");
+	FeedRound(Events, 0, false, "/for");
+	for (int N = 1; N <= 3; N++)
+	{
+		FeedRound(Events, N, true, N == 1 ? "/for" : "/next");
+		// /next i
+		CHAR szValue[MAX_STRING] = { 0 };
+		_itoa_s(pVar->Var.Int + 1, szValue, 10);
+		SetMQ2DataVariable(pVar->Var.Type, pVar->Var.VarPtr, szValue);
+		FeedRound(Events, N, false, "/next");
+	}
+
+	CHAR szVarset[MAX_STRING] = "i 10";
+	NewVarset(NULL, szVarset);
+	FeedRound(Events, 4, false, "/varset");
+	FeedRound(Events, 10, true, "/varset");
+
+	printf("%s\n", nFailed ? "FAILED" : "print variable events follow /for, /next and /varset");
+	return nFailed ? 1 : 0;
+}
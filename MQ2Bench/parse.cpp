@@ -0,0 +1,304 @@
+// Checks that ParseMacroData expands lines to the same text as the parser it replaced
+// (OldParseMacroData below, as it was before ${...} were compiled), on a list of lines
+// with commas, quotes and ] in nested results and on generated lines built from the
+// same pieces. Then times ParseMacroData on a long /echo and a long /varset line.
+//
+// usage: parse [lines] [count]
+//   lines   generated lines to compare (default 100000)
+//   count   times each benchmark line is parsed (default 1000)
+//
+// Links against MQ2Main like a plugin. The TLOs and variables it uses work outside the
+// game, so it runs as a plain console program.
+//
+// The old parser reads past the end of a line that ends in [ or , inside a ${, so
+// generated lines never end that way. It also cut the line off at a ${}, which
+// ParseMacroData now leaves alone, so a difference where the new text still has a ${}
+// is counted on its own.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include "../MQ2Plugin.h"
+
+BOOL OldParseMacroData(PCHAR szOriginal, SIZE_T BufferSize)
+{
+	// find each {}
+	PCHAR pBrace = strstr(szOriginal, "${");
+	if (!pBrace)
+		return false;
+	unsigned long NewLength;
+	BOOL Changed = false;
+	//PCHAR pPos;
+	//PCHAR pStart;
+	//PCHAR pIndex;
+	CHAR szCurrent[MAX_STRING] = { 0 };
+	MQ2TYPEVAR Result = { 0 };
+	do
+	{
+		// find this brace's end
+		PCHAR pEnd = &pBrace[1];
+		BOOL Quote = false;
+		BOOL BeginParam = false;
+		int nBrace = 1;
+		while (nBrace)
+		{
+			++pEnd;
+			if (BeginParam)
+			{
+				BeginParam = false;
+				if (*pEnd == '\"')
+				{
+					Quote = true;
+				}
+				continue;
+			}
+			if (*pEnd == 0)
+			{// unmatched brace or quote
+				goto pmdbottom;
+			}
+			if (Quote)
+			{
+				if (*pEnd == '\"')
+				{
+					if (pEnd[1] == ']' || pEnd[1] == ',')
+					{
+						Quote = false;
+					}
+				}
+			}
+			else
+			{
+				if (*pEnd == '}')
+				{
+					nBrace--;
+				}
+				else if (*pEnd == '{')
+				{
+					nBrace++;
+				}
+				else if (*pEnd == '[' || *pEnd == ',')
+					BeginParam = true;
+			}
+
+		}
+		*pEnd = 0;
+		strcpy_s(szCurrent, &pBrace[2]);
+		if (szCurrent[0] == 0)
+		{
+			goto pmdbottom;
+		}
+		if (OldParseMacroData(szCurrent, sizeof(szCurrent)))
+		{
+			unsigned long NewLength = strlen(szCurrent);
+			memmove(&pBrace[NewLength + 1], &pEnd[1], strlen(&pEnd[1]) + 1);
+			int addrlen = (int)(pBrace - szOriginal);
+			memcpy_s(pBrace, BufferSize-addrlen,szCurrent, NewLength);
+			pEnd = &pBrace[NewLength];
+			*pEnd = 0;
+		}
+		ZeroMemory(&Result, sizeof(Result));
+		Result.Type = 0;
+		Result.Int64 = 0;
+		if (!ParseMQ2DataPortion(szCurrent, Result) || !Result.Type || !Result.Type->ToString(Result.VarPtr, szCurrent)) {
+			strcpy_s(szCurrent, "NULL");
+		}
+		NewLength = strlen(szCurrent);
+		memmove(&pBrace[NewLength], &pEnd[1], strlen(&pEnd[1]) + 1);
+		int addrlen = (int)(pBrace - szOriginal);
+		memcpy_s(pBrace, BufferSize-addrlen,szCurrent, NewLength);
+		if (bAllowCommandParse==false) {
+			bAllowCommandParse = true;
+			Changed = false;
+			break;
+		}
+		else {
+			Changed = true;
+		}
+	pmdbottom:;
+	} while (pBrace = strstr(&pBrace[1], "${"));
+	if (Changed)
+		while (OldParseMacroData(szOriginal, BufferSize))
+		{
+		}
+	return Changed;
+}
+
+struct BenchVariable
+{
+	PCHAR Name;
+	bool Int;
+	PCHAR Value;
+};
+
+BenchVariable Variables[] = {
+	{ "x", true, "5" },
+	{ "y", false, "${x}" },
+	{ "z", false, "${y}${y}" },
+	{ "name", false, "a, b" },
+	{ "q", false, "\"q" },
+	{ "br", false, "a].Length" },
+	{ "qc", false, "x\",y" },
+	{ "cm", false, "," },
+	{ "rb", false, "]" },
+	{ "d", false, "$" },
+	{ "b", false, "{x}" },
+	{ "e", false, "" },
+};
+
+const char *Lines[] = {
+	"a ${x} b",
+	"${String[${name}]}",
+	"${String[${name},${x}]}",
+	"${String[${q}]}",
+	"${String[\"${x}\"]}",
+	"${String[${br}]}",
+	"${String[${br}].Length}",
+	"${String[${qc}]}",
+	"${String[${cm}\"a]\"]}",
+	"${String[${rb}]}",
+	"${String[${d}{x}]}",
+	"${String[$${b}]}",
+	"${String[${y}]}",
+	"${String[${z}].Arg[2,5]}",
+	"${String[${x}](string).Length}",
+	"${String[${name}](string).Length}",
+	"${String[a,\"${qc}\"]}",
+	"${String[${String[${name}]}]}",
+	"${x}${String[${rb}]} ${String[${cm}]}",
+	"${String[${e}]}",
+	"${String[${e}\"a]\"].Length}",
+	"${Int[${Int[${y}]}]}",
+	"${String[${q},\"x]\"]}.Length",
+	"${String[${qc}].Length}",
+	"${String[${d}]}",
+	"${String[${b}]}",
+	"${If[${x}==5,${name},${qc}]}",
+	"${String[${String[${rb}].Length}]}",
+	"${String[abc]${e}.Length}",
+	"${nope[${x}]} ${String[${nope}]}",
+};
+
+const char *Names[] = { "x", "y", "z", "name", "q", "br", "qc", "cm", "rb", "d", "b", "e", "String", "Int", "If", "nope" };
+const char *Members[] = { "", "", ".Length", ".Left[2]", ".Arg[1,,]", "(string)", "(string).Length" };
+const char *Literals[] = { "a", "\"", "]", ",", "1", " ", "\"x]\"", "$", "{", "}", "." };
+
+#define countof(a) (sizeof(a) / sizeof(a[0]))
+
+std::string GenerateExpression(int Depth);
+
+std::string GenerateIndex(int Depth)
+{
+	std::string Index;
+	int Parts = rand() % 3;
+	for (int N = 0; N < Parts; N++)
+	{
+		if (Depth < 3 && rand() % 2)
+			Index += GenerateExpression(Depth + 1);
+		else
+			Index += Literals[rand() % countof(Literals)];
+	}
+	return Index;
+}
+
+std::string GenerateExpression(int Depth)
+{
+	std::string Expression = "${";
+	Expression += Names[rand() % countof(Names)];
+	if (rand() % 2)
+	{
+		Expression += "[" + GenerateIndex(Depth);
+		if (rand() % 3 == 0)
+			Expression += "," + GenerateIndex(Depth);
+		Expression += "]";
+	}
+	Expression += Members[rand() % countof(Members)];
+	return Expression + "}";
+}
+
+std::string GenerateLine()
+{
+	std::string Line;
+	int Parts = 1 + rand() % 4;
+	for (int N = 0; N < Parts; N++)
+	{
+		if (rand() % 3)
+			Line += GenerateExpression(0);
+		else
+			Line += Literals[rand() % countof(Literals)];
+	}
+	return Line + " end";
+}
+
+int Compared = 0;
+int Differed = 0;
+int EmptyBraces = 0;
+
+void CompareLine(const char *szLine, bool Show)
+{
+	// zeroed, the old parser can look past the end of the line
+	CHAR szOld[MAX_STRING] = { 0 };
+	CHAR szNew[MAX_STRING] = { 0 };
+	strcpy_s(szOld, szLine);
+	strcpy_s(szNew, szLine);
+	OldParseMacroData(szOld, sizeof(szOld));
+	ParseMacroData(szNew, sizeof(szNew));
+	Compared++;
+	if (!strcmp(szOld, szNew))
+		return;
+	if (strstr(szNew, "${}"))
+	{
+		EmptyBraces++;
+		return;
+	}
+	if (Show || Differed < 20)
+		printf("%s\n  old: %s\n  new: %s\n", szLine, szOld, szNew);
+	Differed++;
+}
+
+void TimeLines(int Count)
+{
+	std::string Echo = "/echo";
+	std::string Varset = "/varset BenchResult";
+	for (int N = 0; N < 40; N++)
+	{
+		Echo += " Item ${Int[" + std::to_string(N) + "]} costs ${Float[" + std::to_string(N) + ".5]}pp";
+		Varset += " ${Int[${Int[" + std::to_string(N) + "]}]}|${Bool[TRUE]}";
+	}
+	const std::string *Timed[] = { &Echo, &Varset };
+	CHAR szBuffer[MAX_STRING * 4];
+	LARGE_INTEGER Frequency;
+	QueryPerformanceFrequency(&Frequency);
+	for (auto pLine : Timed)
+	{
+		LARGE_INTEGER Start, End;
+		QueryPerformanceCounter(&Start);
+		for (int N = 0; N < Count; N++)
+		{
+			strcpy_s(szBuffer, pLine->c_str());
+			ParseMacroData(szBuffer, sizeof(szBuffer));
+		}
+		QueryPerformanceCounter(&End);
+		double Elapsed = (double)(End.QuadPart - Start.QuadPart) * 1000000.0 / (double)Frequency.QuadPart / Count;
+		printf("%.20s... (%d chars): %.1fus per line\n", pLine->c_str(), (int)pLine->size(), Elapsed);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int Generated = argc > 1 ? atoi(argv[1]) : 100000;
+	int Count = argc > 2 ? atoi(argv[2]) : 1000;
+	InitializeMQ2Benchmarks();
+	InitializeParser();
+	for (auto &Var : Variables)
+		AddMQ2DataVariable(Var.Name, "", Var.Int ? (MQ2Type *)pIntType : (MQ2Type *)pStringType, &pGlobalVariables, Var.Value);
+
+	for (auto szLine : Lines)
+		CompareLine(szLine, true);
+	srand(1);
+	for (int N = 0; N < Generated; N++)
+		CompareLine(GenerateLine().c_str(), false);
+	printf("%d lines, %d differ (and %d at a ${})\n", Compared, Differed, EmptyBraces);
+
+	if (Count > 0)
+		TimeLines(Count);
+	return Differed ? 1 : 0;
+}
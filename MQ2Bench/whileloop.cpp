@@ -0,0 +1,96 @@
+// Times the jump from the } of a /while back to it: the old walk back to the first line
+// numbered like the /while, against the loop head LinkMacroLines sets at load. Then puts
+// a line from an #include in the body with the same line number as the /while, which
+// the old walk stopped at.
+//
+// usage: whileloop [iterations] [body lines]
+//   iterations   jumps timed with each (default 10000)
+//   body lines   lines between the /while and its } (default 200)
+//
+// Links against MQ2Main like a plugin, and only builds MACROBLOCKs, so it runs as a
+// plain console program.
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include "../MQ2Plugin.h"
+
+// what the } of a /while used to do
+PMACROBLOCK FindWhileByLineNumber(PMACROBLOCK pEnd, DWORD LineNumber)
+{
+	for (PMACROBLOCK pBlock = pEnd; pBlock && pBlock->pPrev; pBlock = pBlock->pPrev)
+	{
+		if (pBlock->LineNumber == LineNumber)
+			return pBlock->pPrev;
+	}
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	int Count = argc > 1 ? atoi(argv[1]) : 10000;
+	if (Count <= 0)
+		Count = 10000;
+	int Body = argc > 2 ? atoi(argv[2]) : 200;
+	if (Body <= 0)
+		Body = 200;
+
+	// Sub Main, a few lines, the /while, its body, the } and a /return
+	std::vector<MACROBLOCK> Lines(Body + 8);
+	for (size_t N = 0; N < Lines.size(); N++)
+	{
+		PMACROBLOCK pBlock = &Lines[N];
+		pBlock->Line = "/varset Counter ${Math.Calc[${Counter}+1]}";
+		pBlock->SourceFile = "bench.mac";
+		pBlock->LineNumber = (DWORD)N + 1;
+		pBlock->MacroCmd = 0;
+		pBlock->pPrev = N ? &Lines[N - 1] : NULL;
+		pBlock->pNext = N + 1 < Lines.size() ? &Lines[N + 1] : NULL;
+		pBlock->pSub = &Lines[0];
+		pBlock->pBlockEnd = NULL;
+		pBlock->pChainEnd = NULL;
+		pBlock->pLoopStart = NULL;
+		pBlock->pLoopEnd = NULL;
+		pBlock->pLoopHead = NULL;
+		pBlock->CommandGeneration = 0;
+		pBlock->pCommand = NULL;
+	}
+	PMACROBLOCK pWhile = &Lines[5];
+	PMACROBLOCK pClose = &Lines[Body + 6];
+	Lines[0].Line = "Sub Main";
+	pWhile->Line = "/while (${Counter}<10000) {";
+	pWhile->pBlockEnd = pWhile->pChainEnd = pClose;
+	pClose->Line = "}";
+	pClose->pLoopHead = pWhile;
+	Lines.back().Line = "/return";
+
+	LARGE_INTEGER Frequency;
+	QueryPerformanceFrequency(&Frequency);
+	double Elapsed[2];
+	int nWrong = 0;
+	for (int Engine = 0; Engine < 2; Engine++)
+	{
+		LARGE_INTEGER Start, End;
+		QueryPerformanceCounter(&Start);
+		for (int N = 0; N < Count; N++)
+		{
+			volatile PMACROBLOCK pTarget = Engine ? pClose->pLoopHead->pPrev : FindWhileByLineNumber(pClose, pWhile->LineNumber);
+			if (pTarget != pWhile->pPrev)
+				nWrong++;
+		}
+		QueryPerformanceCounter(&End);
+		Elapsed[Engine] = (double)(End.QuadPart - Start.QuadPart) * 1000000000.0 / (double)Frequency.QuadPart / Count;
+	}
+	printf("%d iterations of a %d line /while: line number scan %.1fns, loop head %.1fns per iteration%s\n",
+		Count, Body, Elapsed[0], Elapsed[1], nWrong ? " WRONG LINE" : "");
+
+	// a line from an #include in the body can carry the same line number as the /while
+	PMACROBLOCK pIncluded = &Lines[6 + Body / 2];
+	pIncluded->SourceFile = "bench.inc";
+	pIncluded->LineNumber = pWhile->LineNumber;
+	PMACROBLOCK pTarget = FindWhileByLineNumber(pClose, pWhile->LineNumber);
+	if (pTarget != pWhile->pPrev)
+		printf("with %s@%d in the body the scan goes back to %s@%d, the loop head still goes to %s@%d\n",
+			pIncluded->SourceFile.c_str(), pIncluded->LineNumber, pTarget->pNext->SourceFile.c_str(), pTarget->pNext->LineNumber,
+			pWhile->SourceFile.c_str(), pWhile->LineNumber);
+	return nWrong ? 1 : 0;
+}
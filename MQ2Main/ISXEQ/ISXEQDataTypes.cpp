@@ -449,10 +449,10 @@ bool MQ2TimerType::GETMETHOD()
    switch((TimerMethods)pMethod->ID)
    {
    case Reset:
-      pPtr->Current=pPtr->Original;
+      SetMQ2Timer(pPtr,pPtr->Original);
       return true;
    case Expire:
-      pPtr->Current=1;  // Will expire in a 10th of a second
+      SetMQ2Timer(pPtr,1);  // Will expire in a 10th of a second
       return true;
    case Set:
       if (argc)
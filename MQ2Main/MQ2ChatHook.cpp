@@ -274,6 +274,15 @@ unsigned int __stdcall MQ2DataVariableLookup(char * VarName, char * Value,size_t
 		return strlen(Value);
     return strlen(ParseMacroParameter(GetCharInfo()->pSpawn,Value, ValueLen));
 }
+#ifndef ISXEQ
+// lets Blech keep a print variable's value between lines until a macro variable is written
+unsigned int __stdcall MQ2DataVariableGeneration(char * VarName)
+{
+    if (!GetCharInfo() || MacroDataIsLive(VarName))
+        return 0;
+    return gVariableGeneration;
+}
+#endif
 #ifdef ISXEQ
 int CMD_FlashOnTells(int argc, char *argv[])
 {
@@ -365,9 +374,9 @@ VOID InitializeChatHook()
     // initialize Blech
 #ifndef ISXEQ
 #ifdef USEBLECHEVENTS
-    pEventBlech=new Blech('#','|',MQ2DataVariableLookup);
+    pEventBlech=new Blech('#','|',MQ2DataVariableLookup,MQ2DataVariableGeneration);
 #endif
-    pMQ2Blech=new Blech('#','|',MQ2DataVariableLookup);
+    pMQ2Blech=new Blech('#','|',MQ2DataVariableLookup,MQ2DataVariableGeneration);
     DebugSpew("%s",pMQ2Blech->Version);
 #endif
 #ifdef EMU
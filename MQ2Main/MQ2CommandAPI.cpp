@@ -34,26 +34,93 @@ typedef struct _TIMEDCOMMAND
 
 PTIMEDCOMMAND pTimedCommands=0;
 
-PMACROBLOCK GetWhileBlock(DWORD line)
+// bumped whenever a command or alias is added or removed, so macro lines know to
+// look their command up again
+static DWORD gCommandGeneration=1;
+
+// pCommands, pAliases and pBindList stay as they were for whatever walks them, these
+// index them for lookups. commands and aliases are in the same order as their lists,
+// binds are sorted by name and remember how new they are
+typedef struct _MACROBINDINDEX {
+    PBINDLIST pBind;
+    DWORD Order;
+} MACROBINDINDEX;
+static std::vector<PMQCOMMAND> CommandIndex;
+static std::vector<PALIAS> AliasIndex;
+static std::vector<MACROBINDINDEX> BindIndex;
+static DWORD nMacroBinds=0;
+
+// the first command szName abbreviates, the way walking the sorted pCommands finds it.
+// AnyState finds in game only commands while not in game as well
+static PMQCOMMAND FindCommand(PCHAR szName, BOOL AnyState=FALSE)
 {
-	
-	BOOL bFound = 0;
-	PMACROBLOCK pblock = gMacroBlock;
-	while(pblock && pblock->pPrev) {
-		if (pblock->LineNumber==line) {
-			bFound = 1;
-			break;
-		}
-		pblock=pblock->pPrev;
-	}
-	if(line==1 && pblock && pblock->LineNumber==1) {
-		return pblock;
-	}
-	if(!bFound) {
-		FatalError("Bad while block pairing");
-		return NULL;
-	}
-	return pblock->pPrev;
+    size_t Len=strlen(szName);
+    auto iter=std::lower_bound(CommandIndex.begin(),CommandIndex.end(),szName,
+        [Len](PMQCOMMAND pCommand, PCHAR szName) { return _strnicmp(pCommand->Command,szName,Len)<0; });
+    // every command szName abbreviates is in this run
+    for ( ; iter!=CommandIndex.end() && !_strnicmp((*iter)->Command,szName,Len) ; ++iter)
+    {
+        if (AnyState || !(*iter)->InGameOnly || gGameState==GAMESTATE_INGAME)
+            return *iter;
+    }
+    return 0;
+}
+
+static std::vector<PALIAS>::iterator FindAliasSlot(PCHAR szName)
+{
+    return std::lower_bound(AliasIndex.begin(),AliasIndex.end(),szName,
+        [](PALIAS pAlias, PCHAR szName) { return _stricmp(pAlias->szName,szName)<0; });
+}
+
+static PALIAS FindAlias(PCHAR szName)
+{
+    auto iter=FindAliasSlot(szName);
+    if (iter!=AliasIndex.end() && !_stricmp((*iter)->szName,szName))
+        return *iter;
+    return 0;
+}
+
+// the newest bind szName abbreviates, binds only work in game
+static PBINDLIST FindMacroBind(PCHAR szName)
+{
+    if (gGameState!=GAMESTATE_INGAME)
+        return 0;
+    size_t Len=strlen(szName);
+    auto iter=std::lower_bound(BindIndex.begin(),BindIndex.end(),szName,
+        [Len](const MACROBINDINDEX &Bind, PCHAR szName) { return _strnicmp(Bind.pBind->szName,szName,Len)<0; });
+    PBINDLIST pFound=0;
+    DWORD Order=0;
+    for ( ; iter!=BindIndex.end() && !_strnicmp(iter->pBind->szName,szName,Len) ; ++iter)
+    {
+        if (!pFound || iter->Order>Order)
+        {
+            pFound=iter->pBind;
+            Order=iter->Order;
+        }
+    }
+    return pFound;
+}
+
+VOID AddMacroBind(PBINDLIST pBind)
+{
+    pBind->pNext=pBindList;
+    pBindList=pBind;
+    MACROBINDINDEX Bind={pBind,++nMacroBinds};
+    BindIndex.insert(std::upper_bound(BindIndex.begin(),BindIndex.end(),Bind,
+        [](const MACROBINDINDEX &A, const MACROBINDINDEX &B) { return _stricmp(A.pBind->szName,B.pBind->szName)<0; }),Bind);
+}
+
+VOID RemoveMacroBinds()
+{
+    BindIndex.clear();
+    nMacroBinds=0;
+    while (pBindList)
+    {
+        PBINDLIST pNext=pBindList->pNext;
+        DebugSpewNoFile("EndMacro: Deleting pBindList %s",pBindList->szName);
+        free(pBindList);
+        pBindList=pNext;
+    }
 }
 
 VOID HideDoCommand(PSPAWNINFO pChar, PCHAR szLine, BOOL delayed)
@@ -93,14 +160,8 @@ VOID HideDoCommand(PSPAWNINFO pChar, PCHAR szLine, BOOL delayed)
     CHAR szOriginalLine[MAX_STRING] = {0};
     strcpy_s(szOriginalLine,szTheCmd);
     GetArg(szArg1,szTheCmd,1);
-    PALIAS pLoop = pAliases;
-    while (pLoop) {
-        if (!_stricmp(szArg1,pLoop->szName)) {
-			sprintf_s(szTheCmd, "%s%s", pLoop->szCommand, szOriginalLine + strlen(pLoop->szName));
-            break;
-        }
-        pLoop = pLoop->pNext;
-    }
+    if (PALIAS pAlias = FindAlias(szArg1))
+        sprintf_s(szTheCmd, "%s%s", pAlias->szCommand, szOriginalLine + strlen(pAlias->szName));
 
     GetArg(szArg1,szTheCmd,1);
     if (szArg1[0]==0)
@@ -111,10 +172,10 @@ VOID HideDoCommand(PSPAWNINFO pChar, PCHAR szLine, BOOL delayed)
         bRunNextCommand = TRUE;
         return;
     }
-	if(gMacroBlock && gMacroBlock->LoopLine!=0) {
-		//this is a command thats inside a while loop
+	if(gMacroBlock && gMacroBlock->pLoopHead) {
+		//this is the } closing a while loop
 		//so its time to loop back
-		gMacroBlock = GetWhileBlock(gMacroBlock->LoopLine);
+		gMacroBlock = gMacroBlock->pLoopHead->pPrev;
 		//CHAR szData[2048] = { 0 };
 		//strcpy_s(szData, gMacroBlock->Line);
 		//BOOL tret = ParseMacroData(szData, sizeof(szData));
@@ -158,65 +219,36 @@ VOID HideDoCommand(PSPAWNINFO pChar, PCHAR szLine, BOOL delayed)
         return;
     }
 
-    PMQCOMMAND pCommand=pCommands;
-    while(pCommand)
+    if (PMQCOMMAND pCommand=FindCommand(szArg1))
     {
-        if (pCommand->InGameOnly && gGameState!=GAMESTATE_INGAME)
-        {
-            pCommand=pCommand->pNext;
-            continue;
-        }
-        int Pos=_strnicmp(szArg1,pCommand->Command,strlen(szArg1));
-        if (Pos<0)
-        {// command not found
-            break;
-        }
-        if (Pos==0)
+        if (pCommand->Parse && bAllowCommandParse)
         {
-            if (pCommand->Parse && bAllowCommandParse)
-            {
-                pCommand->Function(pChar,ParseMacroParameter(pChar,szParam)); 
-            }
-			else {
-                pCommand->Function(pChar,szParam);
-			}
-            strcpy_s(szLastCommand,szOriginalLine);
-            return;
+            pCommand->Function(pChar,ParseMacroParameter(pChar,szParam)); 
         }
-        pCommand=pCommand->pNext;
+		else {
+            pCommand->Function(pChar,szParam);
+		}
+        strcpy_s(szLastCommand,szOriginalLine);
+        return;
     }
 
-    PBINDLIST pBind = pBindList;
-    while( pBind )
+    // Macro Binds only supported in-game
+    if( PBINDLIST pBind = FindMacroBind( szArg1 ) )
     {
-        if( gGameState != GAMESTATE_INGAME )
-        {
-            // Macro Binds only supported in-game
-            pBind = pBind->pNext;
-            continue;
-        }
-
-        int Pos = _strnicmp( szArg1, pBind->szName, strlen( szArg1 ) );
-
-        if( Pos == 0 )
+        // found it!
+        if( pBind->szFuncName )
         {
-            // found it!
-            if( pBind->szFuncName )
+            if( PCHARINFO pCharInfo = (PCHARINFO)GetCharInfo() )
             {
-                if( PCHARINFO pCharInfo = (PCHARINFO)GetCharInfo() )
-                {
-                    std::string szCallFunc( pBind->szFuncName );
-                    szCallFunc += " ";
-                    szCallFunc += szParam;
+                std::string szCallFunc( pBind->szFuncName );
+                szCallFunc += " ";
+                szCallFunc += szParam;
 
-                    Call( pCharInfo->pSpawn, (PCHAR)szCallFunc.c_str() );
-                }
+                Call( pCharInfo->pSpawn, (PCHAR)szCallFunc.c_str() );
             }
-            strcpy_s( szLastCommand, szOriginalLine );
-            return;
         }
-
-        pBind = pBind->pNext;
+        strcpy_s( szLastCommand, szOriginalLine );
+        return;
     }
 
     // skip this logic for Bind Commands.
@@ -231,6 +263,61 @@ VOID HideDoCommand(PSPAWNINFO pChar, PCHAR szLine, BOOL delayed)
     }
 }
 
+// finds what a macro line runs, the way HideDoCommand would. only plain MQ2 commands
+// are kept, everything else is left for HideDoCommand to handle each time
+static VOID ResolveMacroLine(PMACROBLOCK pBlock)
+{
+    CHAR szTheCmd[MAX_STRING];
+    CHAR szArg1[MAX_STRING];
+    PCHAR szOriginalLine = (PCHAR)pBlock->Line.c_str();
+    pBlock->CommandGeneration = gCommandGeneration;
+    pBlock->pCommand = NULL;
+    pBlock->Param.clear();
+    if (pBlock->pLoopHead)
+        return;
+    strcpy_s(szTheCmd,szOriginalLine);
+    GetArg(szArg1,szTheCmd,1);
+    if (PALIAS pAlias = FindAlias(szArg1))
+        sprintf_s(szTheCmd, "%s%s", pAlias->szCommand, szOriginalLine + strlen(pAlias->szName));
+    GetArg(szArg1,szTheCmd,1);
+    if (!szArg1[0] || szArg1[0]==':' || szArg1[0]=='{' || szArg1[0]=='}' || szArg1[0]==';' || szArg1[0]=='[')
+        return;
+    // the first match regardless of game state. HideDoCommand skips the in game only
+    // ones when not in game, but whatever it finds then can't come before this one
+    if (PMQCOMMAND pCommand = FindCommand(szArg1,TRUE)) {
+        pBlock->pCommand = pCommand;
+        pBlock->Param = GetNextArg(szTheCmd);
+    }
+}
+
+// ***************************************************************************
+// Function:    DoMacroLine
+// Description: Runs a line of the macro. The command it resolves to is kept on
+//              the line, so running it again is a straight call
+// ***************************************************************************
+VOID DoMacroLine(PSPAWNINFO pChar, PMACROBLOCK pBlock)
+{
+    if (pBlock->CommandGeneration != gCommandGeneration)
+        ResolveMacroLine(pBlock);
+    PMQCOMMAND pCommand = pBlock->pCommand;
+    if (!pCommand || (pCommand->InGameOnly && gGameState!=GAMESTATE_INGAME)) {
+        DoCommand(pChar,(PCHAR)pBlock->Line.c_str());
+        return;
+    }
+    CAutoLock DoCommandLock(&gCommandCS);
+    WeDidStuff();
+    // the command may end the macro, and the line with it
+    CHAR szOriginalLine[MAX_STRING];
+    CHAR szParam[MAX_STRING];
+    strcpy_s(szOriginalLine,pBlock->Line.c_str());
+    strcpy_s(szParam,pBlock->Param.c_str());
+    if (pCommand->Parse && bAllowCommandParse)
+        pCommand->Function(pChar,ParseMacroParameter(pChar,szParam));
+    else
+        pCommand->Function(pChar,szParam);
+    strcpy_s(szLastCommand,szOriginalLine);
+}
+
 class CCommandHook 
 { 
 public: 
@@ -246,7 +333,6 @@ public:
         std::string szSubFullCommand = "";
         unsigned int k=0;
         bool OneCharacterSub = false;
-        PALIAS pLoop = pAliases; 
         PSUB pSubLoop = pSubs;
 
         if (szFullLine[0]!=0) { 
@@ -316,82 +402,49 @@ public:
             }
 			sprintf_s(szFullCommand, "%s", szSubFullCommand.c_str() );
 
-            while (pLoop) { 
-                if (!_stricmp(szCommand,pLoop->szName)) { 
-					sprintf_s(szCommand,"%s%s",pLoop->szCommand,szFullCommand+strlen(pLoop->szName));
-                    strcpy_s(szFullCommand,szCommand); 
-                    break;
-                } 
-                pLoop = pLoop->pNext; 
+            if (PALIAS pAlias = FindAlias(szCommand)) { 
+				sprintf_s(szCommand,"%s%s",pAlias->szCommand,szFullCommand+strlen(pAlias->szName));
+                strcpy_s(szFullCommand,szCommand); 
             } 
             GetArg(szCommand,szFullCommand,1); 
             strcpy_s(szArgs, GetNextArg(szFullCommand)); 
 
-            PMQCOMMAND pCommand=pCommands;
-            while(pCommand)
+            if (PMQCOMMAND pCommand=FindCommand(szCommand))
             {
-                if (pCommand->InGameOnly && gGameState!=GAMESTATE_INGAME)
+				if (pCommand->Parse && bAllowCommandParse) {
+					ParseMacroParameter(pChar, szArgs);
+				}
+                if (pCommand->EQ)
                 {
-                    pCommand=pCommand->pNext;
-                    continue;
+                    strcat_s(szCommand," "); 
+					strcat_s(szCommand,szArgs);
+                    Trampoline(pChar,szCommand); 
                 }
-                int Pos=_strnicmp(szCommand,pCommand->Command,strlen(szCommand));
-                if (Pos<0)
-                {// command not found
-                    break;
-                }
-                if (Pos==0)
+                else
                 {
-					if (pCommand->Parse && bAllowCommandParse) {
-						ParseMacroParameter(pChar, szArgs);
-					}
-                    if (pCommand->EQ)
-                    {
-                        strcat_s(szCommand," "); 
-						strcat_s(szCommand,szArgs);
-                        Trampoline(pChar,szCommand); 
-                    }
-                    else
-                    {
-                        pCommand->Function(pChar,szArgs);
-                    }
-                    strcpy_s(szLastCommand,szFullCommand);
-                    return;
+                    pCommand->Function(pChar,szArgs);
                 }
-                pCommand=pCommand->pNext;
+                strcpy_s(szLastCommand,szFullCommand);
+                return;
             }
 
-            PBINDLIST pBind = pBindList;
-            while( pBind )
+            // Macro Binds only supported in-game
+            if( PBINDLIST pBind = FindMacroBind( szCommand ) )
             {
-                if( gGameState != GAMESTATE_INGAME )
+                // found it!
+                if( pBind->szFuncName )
                 {
-                    // Macro Binds only supported in-game
-                    pBind = pBind->pNext;
-                    continue;
-                }
-
-                int Pos = _strnicmp( szCommand, pBind->szName, strlen( szCommand ) );
-
-                if( Pos == 0 )
-                {
-                    // found it!
-                    if( pBind->szFuncName )
+                    if( PCHARINFO pCharInfo = (PCHARINFO)GetCharInfo() )
                     {
-                        if( PCHARINFO pCharInfo = (PCHARINFO)GetCharInfo() )
-                        {
-                            std::string szCallFunc( pBind->szFuncName );
-                            szCallFunc += " ";
-                            szCallFunc += szArgs;
+                        std::string szCallFunc( pBind->szFuncName );
+                        szCallFunc += " ";
+                        szCallFunc += szArgs;
 
-                            Call( pCharInfo->pSpawn, (PCHAR)szCallFunc.c_str() );
-                        }
+                        Call( pCharInfo->pSpawn, (PCHAR)szCallFunc.c_str() );
                     }
-                    strcpy_s( szLastCommand, szFullCommand );
-                    return;
                 }
-
-                pBind = pBind->pNext;
+                strcpy_s( szLastCommand, szFullCommand );
+                return;
             }
         }
         Trampoline(pChar,szFullLine); 
@@ -408,6 +461,7 @@ DETOUR_TRAMPOLINE_EMPTY(VOID CCommandHook::Trampoline(PSPAWNINFO pChar, PCHAR sz
 void AddCommand(PCHAR Command, fEQCommand Function, BOOL EQ, BOOL Parse, BOOL InGame)
 {
     DebugSpew("AddCommand(%s,0x%X)",Command,Function);
+    gCommandGeneration++;
     PMQCOMMAND pCommand=new MQCOMMAND;
     memset(pCommand,0,sizeof(MQCOMMAND));
     strcpy_s(pCommand->Command,Command);
@@ -416,134 +470,91 @@ void AddCommand(PCHAR Command, fEQCommand Function, BOOL EQ, BOOL Parse, BOOL In
     pCommand->Function=Function;
     pCommand->InGameOnly=InGame;
 
-    // perform insertion sort
-    if (!pCommands)
-    {
+    // insert in front of the first one that sorts the same or after it
+    auto iter=std::lower_bound(CommandIndex.begin(),CommandIndex.end(),Command,
+        [](PMQCOMMAND pOther, PCHAR szName) { return _stricmp(pOther->Command,szName)<0; });
+    PMQCOMMAND pInsert=iter!=CommandIndex.end() ? *iter : 0;
+    PMQCOMMAND pLast=iter!=CommandIndex.begin() ? *(iter-1) : 0;
+    if (pLast)
+        pLast->pNext=pCommand;
+    else
         pCommands=pCommand;
-        return;
-    }
-    PMQCOMMAND pInsert=pCommands;
-    PMQCOMMAND pLast=0;
-    while(pInsert)
-    {
-        if (_stricmp(pCommand->Command,pInsert->Command)<=0)
-        {
-            // insert here.
-            if (pLast)
-                pLast->pNext=pCommand;
-            else
-                pCommands=pCommand;
-            pCommand->pLast=pLast;
-            pInsert->pLast=pCommand;
-            pCommand->pNext=pInsert;
-            return;
-        }
-        pLast=pInsert;
-        pInsert=pInsert->pNext;
-    }
-    // End of list
-    pLast->pNext=pCommand;
+    if (pInsert)
+        pInsert->pLast=pCommand;
     pCommand->pLast=pLast;
+    pCommand->pNext=pInsert;
+    CommandIndex.insert(iter,pCommand);
 }
 
 BOOL RemoveCommand(PCHAR Command)
 {
-    PMQCOMMAND pCommand=pCommands;
-    while(pCommand)
+    gCommandGeneration++;
+    auto iter=std::lower_bound(CommandIndex.begin(),CommandIndex.end(),Command,
+        [](PMQCOMMAND pCommand, PCHAR szName) { return _strnicmp(pCommand->Command,szName,63)<0; });
+    if (iter==CommandIndex.end())
+        return 0;
+    PMQCOMMAND pCommand=*iter;
+    if (_strnicmp(Command,pCommand->Command,63))
     {
-        int Pos=_strnicmp(Command,pCommand->Command,63);
-        if (Pos<0)
-        {
-            DebugSpew("RemoveCommand: Command not found '%s'",Command);
-            return 0;
-        }
-        if (Pos==0)
-        {
-            if (pCommand->pNext)
-                pCommand->pNext->pLast=pCommand->pLast;
-            if (pCommand->pLast)
-                pCommand->pLast->pNext=pCommand->pNext;
-            else
-                pCommands=pCommand->pNext;
-            delete pCommand;
-            return 1;
-        }
-        pCommand=pCommand->pNext;
+        DebugSpew("RemoveCommand: Command not found '%s'",Command);
+        return 0;
     }
-    return 0;
+    if (pCommand->pNext)
+        pCommand->pNext->pLast=pCommand->pLast;
+    if (pCommand->pLast)
+        pCommand->pLast->pNext=pCommand->pNext;
+    else
+        pCommands=pCommand->pNext;
+    CommandIndex.erase(iter);
+    delete pCommand;
+    return 1;
 }
 
 void AddAlias(PCHAR ShortCommand, PCHAR LongCommand)
 {
     DebugSpew("AddAlias(%s,%s)",ShortCommand,LongCommand);
-    // perform insertion sort
-    if (!pAliases)
+    gCommandGeneration++;
+    auto iter=FindAliasSlot(ShortCommand);
+    if (iter!=AliasIndex.end() && !_stricmp(ShortCommand,(*iter)->szName))
     {
-        PALIAS pAlias=new ALIAS;
-        memset(pAlias,0,sizeof(ALIAS));
-        strcpy_s(pAlias->szName,ShortCommand);
-		strcpy_s(pAlias->szCommand,LongCommand);
-        pAliases=pAlias;
+		strcpy_s((*iter)->szName,ShortCommand);
+		strcpy_s((*iter)->szCommand,LongCommand);
         return;
     }
-    PALIAS pInsert=pAliases;
-    PALIAS pLast=0;
-    while(pInsert)
-    {
-        int Pos=_stricmp(ShortCommand,pInsert->szName);
-        if (Pos<0)
-        {
-            // insert here.
-            PALIAS pAlias=new ALIAS;
-            memset(pAlias,0,sizeof(ALIAS));
-			strcpy_s(pAlias->szName,ShortCommand);
-			strcpy_s(pAlias->szCommand,LongCommand);
-            if (pLast)
-                pLast->pNext=pAlias;
-            else
-                pAliases=pAlias;
-            pAlias->pLast=pLast;
-            pInsert->pLast=pAlias;
-            pAlias->pNext=pInsert;
-            return;
-        }
-        if (Pos==0)
-        {
-			strcpy_s(pInsert->szName,ShortCommand);
-			strcpy_s(pInsert->szCommand,LongCommand);
-            return;
-        }
-        pLast=pInsert;
-        pInsert=pInsert->pNext;
-    }
-    // End of list
+    // keep the list sorted
     PALIAS pAlias=new ALIAS;
     memset(pAlias,0,sizeof(ALIAS));
 	strcpy_s(pAlias->szName,ShortCommand);
 	strcpy_s(pAlias->szCommand,LongCommand);
-    pLast->pNext=pAlias;
+    PALIAS pInsert=iter!=AliasIndex.end() ? *iter : 0;
+    PALIAS pLast=iter!=AliasIndex.begin() ? *(iter-1) : 0;
+    if (pLast)
+        pLast->pNext=pAlias;
+    else
+        pAliases=pAlias;
+    if (pInsert)
+        pInsert->pLast=pAlias;
     pAlias->pLast=pLast;
+    pAlias->pNext=pInsert;
+    AliasIndex.insert(iter,pAlias);
 }
 
 BOOL RemoveAlias(PCHAR ShortCommand)
 {
-    PALIAS pAlias=pAliases;
-    while(pAlias)
-    {
-        if (!_stricmp(ShortCommand,pAlias->szName))
-        {
-            if (pAlias->pNext)
-                pAlias->pNext->pLast=pAlias->pLast;
-            if (pAlias->pLast)
-                pAlias->pLast->pNext=pAlias->pNext;
-            else
-                pAliases=pAlias->pNext;
-            delete pAlias;
-            return 1;
-        }
-        pAlias=pAlias->pNext;
-    }
-    return 0;
+    gCommandGeneration++;
+    auto iter=FindAliasSlot(ShortCommand);
+    if (iter==AliasIndex.end() || _stricmp(ShortCommand,(*iter)->szName))
+        return 0;
+    PALIAS pAlias=*iter;
+    if (pAlias->pNext)
+        pAlias->pNext->pLast=pAlias->pLast;
+    if (pAlias->pLast)
+        pAlias->pLast->pNext=pAlias->pNext;
+    else
+        pAliases=pAlias->pNext;
+    AliasIndex.erase(iter);
+    delete pAlias;
+    return 1;
 }
 
 void AddSubstitute(PCHAR Original, PCHAR Substitution)
@@ -736,6 +747,8 @@ void InitializeMQ2Commands()
 		{"/combine",    CombineCmd,1,1},
         {"/drop",       DropCmd,1,0},
 		{"/delay",      Delay,0,0}, // do not parse
+		{"/if",         NewIf,0,0}, // conditions are compiled, see CalculateCondition
+		{"/while",      WhileCmd,0,0},
         {"/hud",        HudCmd,1,0},
         {"/caption",    CaptionCmd,0,0},
         {"/captioncolor",CaptionColorCmd,1,0},
@@ -837,6 +850,7 @@ void ShutdownMQ2Commands()
     EnterCriticalSection(&gCommandCS);
 	lockit lk(ghLockDelayCommand,"ShutdownMQ2Commands");
     RemoveDetour(CEverQuest__InterpretCmd);
+    CommandIndex.clear();
     while(pCommands)
     {
         PMQCOMMAND pNext=pCommands->pNext;
@@ -856,6 +870,7 @@ void ShutdownMQ2Commands()
         delete pTimedCommands;
         pTimedCommands=pNext;
     }
+    AliasIndex.clear();
     while(pAliases)
     {
         PALIAS pNext=pAliases->pNext;
@@ -637,15 +637,13 @@ TLO(dataIf)
 
 					if (CalcResult != 0.0f)
 					{
-						strcpy_s(DataTypeTemp, pTrue);
-						Ret.Ptr = &DataTypeTemp[0];
+						Ret.Ptr = StoreMQ2DataTemp(pTrue);
 						Ret.Type = pStringType;
 						return true;
 					}
 					else
 					{
-						strcpy_s(DataTypeTemp, pFalse);
-						Ret.Ptr = &DataTypeTemp[0];
+						Ret.Ptr = StoreMQ2DataTemp(pFalse);
 						Ret.Type = pStringType;
 						return true;
 					}
@@ -668,15 +666,13 @@ TLO(dataIf)
 
 				if (CalcResult != 0.0f)
 				{
-					strcpy_s(DataTypeTemp, pTrue);
-					Ret.Ptr = &DataTypeTemp[0];
+					Ret.Ptr = StoreMQ2DataTemp(pTrue);
 					Ret.Type = pStringType;
 					return true;
 				}
 				else
 				{
-					strcpy_s(DataTypeTemp, pFalse);
-					Ret.Ptr = &DataTypeTemp[0];
+					Ret.Ptr = StoreMQ2DataTemp(pFalse);
 					Ret.Type = pStringType;
 					return true;
 				}
@@ -922,48 +918,48 @@ TLO(dataIni)
 	{
 		if (Default.size())
 		{
-			if (bNoParse && strchr(DataTypeTemp, '$'))
+			if (bNoParse && Default.find('$') != Default.npos)
 				bAllowCommandParse = false;
-			strcpy_s(DataTypeTemp, Default.c_str());
-			Ret.Ptr = &DataTypeTemp[0];
+			Ret.Ptr = StoreMQ2DataTemp((PCHAR)Default.c_str());
 			Ret.Type = pStringType;
 			return true;
 		}
 		return false;
 	}
+	PCHAR szResult = AllocMQ2DataTemp(MAX_STRING);
 	DWORD nSize = 0;
 	if (Section.size() && Key.size()) {
-		nSize = GetPrivateProfileString(Section.c_str(), Key.c_str(), Default.c_str(), DataTypeTemp, MAX_STRING, IniFile.c_str());
+		nSize = GetPrivateProfileString(Section.c_str(), Key.c_str(), Default.c_str(), szResult, MAX_STRING, IniFile.c_str());
 	}
 	else if (Section.size() && Key.size() == 0) {
-		nSize = GetPrivateProfileString(Section.c_str(), NULL, Default.c_str(), DataTypeTemp, MAX_STRING, IniFile.c_str());
+		nSize = GetPrivateProfileString(Section.c_str(), NULL, Default.c_str(), szResult, MAX_STRING, IniFile.c_str());
 	}
 	else if (Section.size() == 0 && Key.size()) {
-		nSize = GetPrivateProfileString(NULL, Key.c_str(), Default.c_str(), DataTypeTemp, MAX_STRING, IniFile.c_str());
+		nSize = GetPrivateProfileString(NULL, Key.c_str(), Default.c_str(), szResult, MAX_STRING, IniFile.c_str());
 	}
 	else if (Section.size() == 0 && Key.size() == 0) {
-		nSize = GetPrivateProfileString(NULL, NULL, Default.c_str(), DataTypeTemp, MAX_STRING, IniFile.c_str());
+		nSize = GetPrivateProfileString(NULL, NULL, Default.c_str(), szResult, MAX_STRING, IniFile.c_str());
 	}
 	if (nSize)
 	{
 		if (nSize>2)
 			for (unsigned long N = 0; N < nSize - 2; N++)
-				if (DataTypeTemp[N] == 0)
-					DataTypeTemp[N] = '|';
+				if (szResult[N] == 0)
+					szResult[N] = '|';
 		if ((Section.size() == 0 || Key.size() == 0) && (nSize<MAX_STRING - 3))
-			strcat_s(DataTypeTemp, "||");
-		if (bNoParse && strchr(DataTypeTemp,'$'))
+			strcat_s(szResult, MAX_STRING, "||");
+		if (bNoParse && strchr(szResult,'$'))
 			bAllowCommandParse = false;
-		Ret.Ptr = &DataTypeTemp[0];
+		Ret.Ptr = szResult;
 		Ret.Type = pStringType;
 		return true;
 	}
 	if (Default.size())
 	{
-		if (bNoParse && strchr(DataTypeTemp, '$'))
+		if (bNoParse && Default.find('$') != Default.npos)
 			bAllowCommandParse = false;
-		strcpy_s(DataTypeTemp, Default.c_str());
-		Ret.Ptr = &DataTypeTemp[0];
+		strcpy_s(szResult, MAX_STRING, Default.c_str());
+		Ret.Ptr = szResult;
 		Ret.Type = pStringType;
 		return true;
 	}
@@ -22,14 +22,174 @@ GNU General Public License for more details.
 
 #include "MQ2Main.h"
 
+#include <float.h>
+#include <deque>
+#include <list>
 #include <memory>
 #include <unordered_map>
 
-std::unordered_map<std::string, MQ2Type*> MQ2DataTypeMap;
+// Atom table
+//
+// TLO, type, member and variable names are interned here once and keyed by a small
+// integer from then on.  Finding a name never inserts it, so a misspelled member in
+// a macro doesn't grow anything.  Atoms live until the process exits.
+//
+// Each name is stored right after its atom.  Interned names get passed back in a lot
+// (MQ2Type member names handed to GetMember and looked up again with FindMember), so
+// Find recognizes those by address and reads the atom without hashing the string.
+#define ATOM_BLOCK_SIZE 0x10000
+
+class CMQ2AtomTable
+{
+public:
+	CMQ2AtomTable()
+	{
+		Slots.resize(1024);
+		Names.push_back(0);
+		pBlock = 0;
+		BlockLeft = 0;
+	}
+
+	DWORD Find(const char *Name)
+	{
+		UINT_PTR Pos = (UINT_PTR)Name;
+		for (auto &Block : Blocks)
+		{
+			// every name in a block follows its atom, don't read before the block for one that doesn't
+			if (Pos >= Block.first + sizeof(DWORD) && Pos < Block.second)
+			{
+				DWORD Atom = *(DWORD*)(Name - sizeof(DWORD));
+				if (Atom < Names.size() && Names[Atom] == Name)
+					return Atom;
+				break;
+			}
+		}
+		return Find(Name, Hash(Name));
+	}
+
+	DWORD Add(const char *Name)
+	{
+		DWORD NameHash = Hash(Name);
+		if (DWORD Atom = Find(Name, NameHash))
+			return Atom;
+		if ((Names.size() + 1) * 2 > Slots.size())
+			Grow();
+		size_t Len = strlen(Name) + 1;
+		size_t Size = (sizeof(DWORD) + Len + 3) & ~3;
+		if (Size > BlockLeft)
+		{
+			// names are never freed, blocks are just carved up
+			BlockLeft = Size > ATOM_BLOCK_SIZE ? Size : ATOM_BLOCK_SIZE;
+			pBlock = (PCHAR)malloc(BlockLeft);
+			Blocks.emplace_back((UINT_PTR)pBlock, (UINT_PTR)pBlock + BlockLeft);
+		}
+		DWORD Atom = (DWORD)Names.size();
+		*(DWORD*)pBlock = Atom;
+		PCHAR pName = pBlock + sizeof(DWORD);
+		memcpy(pName, Name, Len);
+		pBlock += Size;
+		BlockLeft -= Size;
+		Names.push_back(pName);
+		Insert(NameHash, Atom);
+		return Atom;
+	}
+
+	PCHAR GetName(DWORD Atom)
+	{
+		if (Atom >= Names.size())
+			return 0;
+		return Names[Atom];
+	}
+
+private:
+	struct Slot
+	{
+		DWORD Hash;
+		DWORD Atom;
+	};
+
+	static DWORD Hash(const char *Name)
+	{
+		// FNV-1a
+		DWORD Ret = 2166136261u;
+		while (*Name)
+		{
+			Ret ^= (unsigned char)*Name++;
+			Ret *= 16777619u;
+		}
+		return Ret;
+	}
+
+	DWORD Find(const char *Name, DWORD NameHash)
+	{
+		size_t Mask = Slots.size() - 1;
+		for (size_t N = NameHash & Mask; Slots[N].Atom; N = (N + 1) & Mask)
+		{
+			if (Slots[N].Hash == NameHash && !strcmp(Names[Slots[N].Atom], Name))
+				return Slots[N].Atom;
+		}
+		return 0;
+	}
+
+	void Insert(DWORD NameHash, DWORD Atom)
+	{
+		size_t Mask = Slots.size() - 1;
+		size_t N = NameHash & Mask;
+		while (Slots[N].Atom)
+			N = (N + 1) & Mask;
+		Slots[N].Hash = NameHash;
+		Slots[N].Atom = Atom;
+	}
+
+	void Grow()
+	{
+		std::vector<Slot> Old;
+		Old.swap(Slots);
+		Slots.resize(Old.size() * 2);
+		for (auto &OldSlot : Old)
+		{
+			if (OldSlot.Atom)
+				Insert(OldSlot.Hash, OldSlot.Atom);
+		}
+	}
+
+	std::vector<Slot> Slots;   // open addressed, size is a power of 2
+	std::vector<PCHAR> Names;  // indexed by atom
+	std::vector<std::pair<UINT_PTR, UINT_PTR>> Blocks;
+	PCHAR pBlock;
+	size_t BlockLeft;
+};
+
+static CMQ2AtomTable &MQ2Atoms()
+{
+	// types intern their names from their constructors, make sure this exists first
+	static CMQ2AtomTable Table;
+	return Table;
+}
+
+DWORD MQ2Internal::AddMQ2Atom(PCHAR Name)
+{
+	return MQ2Atoms().Add(Name);
+}
+
+DWORD MQ2Internal::FindMQ2Atom(PCHAR Name)
+{
+	return MQ2Atoms().Find(Name);
+}
+
+PCHAR MQ2Internal::GetMQ2AtomName(DWORD Atom)
+{
+	return MQ2Atoms().GetName(Atom);
+}
+
+std::unordered_map<DWORD, MQ2Type*> MQ2DataTypeMap;
 
 MQ2Type *FindMQ2DataType(PCHAR Name)
 {
-	auto iter = MQ2DataTypeMap.find(Name);
+	DWORD Atom = FindMQ2Atom(Name);
+	if (!Atom)
+		return nullptr;
+	auto iter = MQ2DataTypeMap.find(Atom);
 	if (iter == MQ2DataTypeMap.end())
 		return nullptr;
 
@@ -41,7 +201,9 @@ BOOL MQ2Internal::AddMQ2Type(MQ2Type &Type)
 	// returns pair with iterator pointing to the constructed
 	// element, and a bool indicating if it was actually inserted.
 	// this will not replace existing elements.
-	auto result = MQ2DataTypeMap.emplace(Type.GetName(), &Type);
+	auto result = MQ2DataTypeMap.emplace(Type.GetNameAtom(), &Type);
+	if (result.second)
+		gDataTypeGeneration++;
 	return result.second;
 }
 
@@ -49,31 +211,44 @@ BOOL MQ2Internal::RemoveMQ2Type(MQ2Type &Type)
 {
 	// use iterator to erase. allows us to check for existence
 	// and erase it without any waste
-	auto iter = MQ2DataTypeMap.find(Type.GetName());
-	if (iter == MQ2DataTypeMap.end())
+	auto iter = MQ2DataTypeMap.find(Type.GetNameAtom());
+	if (iter == MQ2DataTypeMap.end() || iter->second != &Type)
 		return false;
 
 	// The type existed. Erase it.
 	MQ2DataTypeMap.erase(iter);
+	gDataTypeGeneration++;
+	// the member memo may still hold this type, don't let a new one at the same address match it
+	gFrameGeneration++;
 	return true;
 }
 
-std::unordered_map<string, std::unique_ptr<MQ2DATAITEM>> MQ2DataMap;
+std::unordered_map<DWORD, std::unique_ptr<MQ2DATAITEM>> MQ2DataMap;
 
-inline PMQ2DATAITEM FindMQ2Data(PCHAR szName)
+PMQ2DATAITEM FindMQ2DataByAtom(DWORD Atom)
 {
-	auto iter = MQ2DataMap.find(szName);
+	auto iter = MQ2DataMap.find(Atom);
 	if (iter == MQ2DataMap.end())
 		return nullptr;
 
 	return iter->second.get();
 }
 
+inline PMQ2DATAITEM FindMQ2Data(PCHAR szName)
+{
+	DWORD Atom = FindMQ2Atom(szName);
+	if (!Atom)
+		return nullptr;
+
+	return FindMQ2DataByAtom(Atom);
+}
+
 BOOL AddMQ2Data(PCHAR szName, fMQData Function)
 {
 	// check if the item exists first, so we don't construct
 	// something we don't actually need.
-	if (MQ2DataMap.find(szName) != MQ2DataMap.end())
+	DWORD Atom = AddMQ2Atom(szName);
+	if (MQ2DataMap.find(Atom) != MQ2DataMap.end())
 		return false;
 
 	// create new MQ2DATAITEM inside a unique_ptr
@@ -82,13 +257,13 @@ BOOL AddMQ2Data(PCHAR szName, fMQData Function)
 	newItem->Function = Function;
 
 	// put the new item into the map
-	MQ2DataMap.emplace(szName, std::move(newItem));
+	MQ2DataMap.emplace(Atom, std::move(newItem));
 	return true;
 }
 
 BOOL RemoveMQ2Data(PCHAR szName)
 {
-	auto iter = MQ2DataMap.find(szName);
+	auto iter = MQ2DataMap.find(FindMQ2Atom(szName));
 	if (iter == MQ2DataMap.end())
 		return false;
 
@@ -96,12 +271,12 @@ BOOL RemoveMQ2Data(PCHAR szName)
 	return true;
 }
 
-std::unordered_map<std::string, std::vector<MQ2Type*>> MQ2DataExtensions;
+std::unordered_map<DWORD, std::vector<MQ2Type*>> MQ2DataExtensions;
 
 bool AddMQ2TypeExtension(const char* szName, MQ2Type* extension)
 {
 	// get the extension record for this type name
-	auto& record = MQ2DataExtensions[szName];
+	auto& record = MQ2DataExtensions[AddMQ2Atom((PCHAR)szName)];
 
 	// check if we already have this extension added
 	if (std::find(record.begin(), record.end(), extension) != record.end())
@@ -115,7 +290,7 @@ bool AddMQ2TypeExtension(const char* szName, MQ2Type* extension)
 bool RemoveMQ2TypeExtension(const char* szName, MQ2Type* extension)
 {
 	// check if we have a record for this type name
-	auto iter = MQ2DataExtensions.find(szName);
+	auto iter = MQ2DataExtensions.find(FindMQ2Atom((PCHAR)szName));
 	if (iter == MQ2DataExtensions.end())
 		return false;
 
@@ -140,7 +315,7 @@ int FindMacroDataMember(MQ2Type* type, MQ2TYPEVAR& Result, PCHAR pStart, PCHAR p
 	bool checkFirst = false)
 {
 	// search for extensions on this type
-	auto extIter = MQ2DataExtensions.find(type->GetName());
+	auto extIter = MQ2DataExtensions.find(type->GetNameAtom());
 	if (extIter != MQ2DataExtensions.end())
 	{
 		// we have at least one extension. process each one until a match is found
@@ -178,18 +353,211 @@ int FindMacroDataMember(MQ2Type* type, MQ2TYPEVAR& Result, PCHAR pStart, PCHAR p
 	return 0;
 }
 
-bool EvaluateDataExpression(MQ2TYPEVAR& Result, PCHAR pStart, PCHAR pIndex)
+// Scratch storage for data results
+//
+// Members and TLOs that build a string put it here (AllocMQ2DataTemp, StoreMQ2DataTemp)
+// rather than in DataTypeTemp, so a nested evaluation can't overwrite a result that is
+// still being used. Everything is released at once when the outermost ParseMacroData
+// returns, or on the next pulse for results taken outside of any parse; the blocks are
+// kept for the next one.
+#define DATATEMP_BLOCK_SIZE 0x10000
+// blocks beyond this are given back on release, after something unusually large
+#define DATATEMP_KEEP_BLOCKS 4
+
+class CMQ2DataArena
+{
+public:
+	CMQ2DataArena()
+	{
+		Block = 0;
+		Used = 0;
+	}
+
+	~CMQ2DataArena()
+	{
+		for (auto &Cur : Blocks)
+			free(Cur.pData);
+	}
+
+	PCHAR Alloc(size_t Size)
+	{
+		Size = (Size + 7) & ~(size_t)7;
+		while (Block < Blocks.size())
+		{
+			if (Used + Size <= Blocks[Block].Size)
+			{
+				PCHAR pRet = Blocks[Block].pData + Used;
+				Used += Size;
+				return pRet;
+			}
+			Block++;
+			Used = 0;
+		}
+		MQ2DataBlock NewBlock;
+		NewBlock.Size = Size > DATATEMP_BLOCK_SIZE ? Size : DATATEMP_BLOCK_SIZE;
+		NewBlock.pData = (PCHAR)malloc(NewBlock.Size);
+		if (!NewBlock.pData)
+			return 0;
+		Blocks.push_back(NewBlock);
+		Used = Size;
+		return NewBlock.pData;
+	}
+
+	void Release()
+	{
+		while (Blocks.size() > DATATEMP_KEEP_BLOCKS)
+		{
+			free(Blocks.back().pData);
+			Blocks.pop_back();
+		}
+		Block = 0;
+		Used = 0;
+	}
+
+private:
+	struct MQ2DataBlock
+	{
+		PCHAR pData;
+		size_t Size;
+	};
+	std::vector<MQ2DataBlock> Blocks;
+	size_t Block; // the block being carved up
+	size_t Used;  // bytes of it handed out
+};
+
+static CMQ2DataArena DataTempArena;
+static int DataTempDepth = 0;
+
+// marks a parse; the arena is released when the outermost one ends
+class CMQ2DataTempScope
+{
+public:
+	CMQ2DataTempScope()
+	{
+		DataTempDepth++;
+	}
+	~CMQ2DataTempScope()
+	{
+		if (--DataTempDepth == 0)
+			DataTempArena.Release();
+	}
+};
+
+PCHAR AllocMQ2DataTemp(SIZE_T Size)
+{
+	PCHAR pRet = DataTempArena.Alloc(Size ? Size : 1);
+	if (!pRet)
+	{
+		// out of memory, hand out the old shared buffer rather than nothing
+		pRet = &DataTypeTemp[0];
+	}
+	pRet[0] = 0;
+	return pRet;
+}
+
+PCHAR StoreMQ2DataTemp(PCHAR szText)
+{
+	size_t Len = strlen(szText) + 1;
+	PCHAR pRet = DataTempArena.Alloc(Len);
+	if (!pRet)
+	{
+		if (szText != DataTypeTemp)
+			strncpy_s(DataTypeTemp, szText, _TRUNCATE);
+		return &DataTypeTemp[0];
+	}
+	memcpy(pRet, szText, Len);
+	return pRet;
+}
+
+VOID ReleaseMQ2DataTemp()
+{
+	if (!DataTempDepth)
+		DataTempArena.Release();
+}
+
+// Per-frame member memo
+//
+// A member its type marks frame-stable (TypeMemberFrameStable) answers the same for the
+// same object and index until the game runs another frame, so the first result is kept
+// for everyone else asking during that frame: the HUD, captions, plugins and the macro
+// all reading ${Me.PctHPs}. Entries are keyed by type, object, member atom and index,
+// and all of them expire when Heartbeat bumps gFrameGeneration. The table is direct
+// mapped, a collision just replaces the older entry.
+#define MEMBER_MEMO_SIZE 1024
+
+struct MQ2MemberMemo
+{
+	DWORD Generation;
+	MQ2Type *pType;
+	unsigned __int64 Object;
+	DWORD Atom;
+	std::string Index;
+	int Ret;             // as returned by FindMacroDataMember
+	MQ2TYPEVAR Result;
+	std::string Text;    // string results, whatever they pointed at won't last the frame
+};
+
+static MQ2MemberMemo MemberMemo[MEMBER_MEMO_SIZE];
+
+static MQ2MemberMemo &GetMemberMemo(MQ2Type *pType, unsigned __int64 Object, DWORD Atom, PCHAR szIndex)
+{
+	DWORD Hash = (DWORD)(UINT_PTR)pType ^ (DWORD)Object ^ (DWORD)(Object >> 32) ^ (Atom * 2654435761u);
+	for (PCHAR pPos = szIndex; *pPos; pPos++)
+		Hash = (Hash ^ (unsigned char)*pPos) * 16777619u;
+	Hash ^= Hash >> 16;
+	return MemberMemo[Hash & (MEMBER_MEMO_SIZE - 1)];
+}
+
+static int FindFrameStableMember(MQ2TYPEVAR& Result, PCHAR pStart, PCHAR pIndex, DWORD Atom)
+{
+	MQ2Type *pType = Result.Type;
+	unsigned __int64 Object = Result.VarPtr.UInt64;
+	MQ2MemberMemo &Memo = GetMemberMemo(pType, Object, Atom, pIndex);
+	if (Memo.Generation == gFrameGeneration && Memo.pType == pType && Memo.Object == Object
+		&& Memo.Atom == Atom && !strcmp(Memo.Index.c_str(), pIndex))
+	{
+		if (Memo.Ret > 0)
+		{
+			Result = Memo.Result;
+			if (Result.Type == pStringType)
+				Result.Ptr = &Memo.Text[0];
+		}
+		return Memo.Ret;
+	}
+	int Ret = FindMacroDataMember(pType, Result, pStart, pIndex);
+	Memo.Generation = gFrameGeneration;
+	Memo.pType = pType;
+	Memo.Object = Object;
+	Memo.Atom = Atom;
+	Memo.Index = pIndex;
+	Memo.Ret = Ret;
+	if (Ret > 0)
+	{
+		Memo.Result = Result;
+		if (Result.Type == pStringType)
+			Memo.Text = Result.Ptr ? (PCHAR)Result.Ptr : "";
+	}
+	return Ret;
+}
+
+// Atom is the atom of pStart, or 0 if it was never interned
+bool EvaluateDataExpression(MQ2TYPEVAR& Result, PCHAR pStart, PCHAR pIndex, DWORD Atom)
 {
 	if (!Result.Type)
 	{
-		if (PMQ2DATAITEM DataItem = FindMQ2Data(pStart))
+		if (!Atom)
+		{
+			// never interned, so it can't be a TLO or a variable
+			return false;
+		}
+		if (PMQ2DATAITEM DataItem = FindMQ2DataByAtom(Atom))
 		{
 			if (!DataItem->Function(pIndex, Result))
 			{
 				return false;
 			}
 		}
-		else if (PDATAVAR DataVar = FindMQ2DataVariable(pStart))
+		else if (PDATAVAR DataVar = FindMQ2DataVariableByAtom(Atom))
 		{
 			if (pIndex[0])
 			{
@@ -211,7 +579,12 @@ bool EvaluateDataExpression(MQ2TYPEVAR& Result, PCHAR pStart, PCHAR pIndex)
 	}
 	else
 	{
-		int result = FindMacroDataMember(Result.Type, Result, pStart, pIndex);
+		int result;
+		PMQ2TYPEMEMBER pMember = Atom ? Result.Type->FindMemberByAtom(Atom) : 0;
+		if (pMember && (pMember->Flags & MEMBER_FRAMESTABLE))
+			result = FindFrameStableMember(Result, pStart, pIndex, Atom);
+		else
+			result = FindMacroDataMember(Result.Type, Result, pStart, pIndex);
 		if (result < 0)
 		{
 			MQ2DataError("No such '%s' member '%s'", Result.Type->GetName(), pStart);
@@ -220,6 +593,10 @@ bool EvaluateDataExpression(MQ2TYPEVAR& Result, PCHAR pStart, PCHAR pIndex)
 			return false;
 	}
 
+	// the next evaluation would overwrite a result left in DataTypeTemp, give it a copy
+	// that lasts as long as the parse does
+	if (Result.Type == pStringType && Result.Ptr == &DataTypeTemp[0])
+		Result.Ptr = StoreMQ2DataTemp(DataTypeTemp);
 	return true;
 }
 
@@ -330,7 +707,7 @@ BOOL ParseMQ2DataPortion(PCHAR szOriginal, MQ2TYPEVAR &Result)
 				return TRUE;
 			}
 			
-			if (!EvaluateDataExpression(Result, pStart, pIndex))
+			if (!EvaluateDataExpression(Result, pStart, pIndex, FindMQ2Atom(pStart)))
 				return FALSE;
 
 			// done processing
@@ -352,7 +729,7 @@ BOOL ParseMQ2DataPortion(PCHAR szOriginal, MQ2TYPEVAR &Result)
 			}
 			else
 			{
-				if (!EvaluateDataExpression(Result, pStart, pIndex))
+				if (!EvaluateDataExpression(Result, pStart, pIndex, FindMQ2Atom(pStart)))
 					return FALSE;
 			}
 			if (!Result.Type)
@@ -481,7 +858,7 @@ BOOL ParseMQ2DataPortion(PCHAR szOriginal, MQ2TYPEVAR &Result)
 						return TRUE;
 					}
 					
-					if (!EvaluateDataExpression(Result, pStart, pIndex))
+					if (!EvaluateDataExpression(Result, pStart, pIndex, FindMQ2Atom(pStart)))
 						return FALSE;
 
 					pStart = &pPos[1];
@@ -494,107 +871,1193 @@ BOOL ParseMQ2DataPortion(PCHAR szOriginal, MQ2TYPEVAR &Result)
 
 }
 
-BOOL ParseMacroData(PCHAR szOriginal, SIZE_T BufferSize)
+// Compiled ${...} expressions
+//
+// The body of a ${...} is split once into its chain of Name[Index](cast) segments
+// and kept in a small LRU cache keyed by the source text, so a macro that evaluates
+// the same few hundred expressions every pulse only runs the tokenizer once per
+// expression.  Nested ${...} inside an index are compiled as child expressions and
+// evaluated in place.  Anything the compiler doesn't handle (nesting inside a name
+// or typecast, malformed input) is flagged and goes through the old text path, which
+// also takes care of reporting the error.
+struct MQ2DataExpression;
+
+struct MQ2DataIndexPart
 {
-	// find each {}
-	PCHAR pBrace = strstr(szOriginal, "${");
-	if (!pBrace)
+	std::string Text;                           // literal text, or the source of pNested
+	std::shared_ptr<MQ2DataExpression> pNested; // nested ${...}, if any
+	size_t Offset;                              // where the ${ of pNested is in the body
+};
+
+struct MQ2DataSegment
+{
+	std::string Name;
+	DWORD Atom;                                 // 0 until the name has been interned
+	std::vector<MQ2DataIndexPart> Index;
+	bool IndexCarried;                          // no index, the one before a typecast carries on
+	std::string Cast;
+	bool HasCast;
+};
+
+struct MQ2DataExpression
+{
+	std::vector<MQ2DataSegment> Segments;
+	int nNested;
+	bool Compiled;
+};
+
+#define DATAEXPRESSION_CACHE_SIZE 1024
+// longer chains, or more nested ${...} in their indexes, go through the text path
+#define MAX_DATA_SEGMENTS 32
+#define MAX_DATA_NESTED 32
+
+// source text -> compiled form, the least recently used entries are dropped
+template <class T> class CCompiledCache
+{
+public:
+	typedef std::shared_ptr<T> (*fCompile)(PCHAR szSource);
+
+	CCompiledCache(size_t MaxEntries, fCompile Compile) : MaxEntries(MaxEntries), Compile(Compile)
+	{
+	}
+
+	std::shared_ptr<T> Get(PCHAR szSource)
+	{
+		std::string Key(szSource);
+		auto iter = Lookup.find(Key);
+		if (iter != Lookup.end())
+		{
+			Entries.splice(Entries.begin(), Entries, iter->second);
+			return iter->second->second;
+		}
+		auto pCompiled = Compile(szSource);
+		if (Entries.size() >= MaxEntries)
+		{
+			Lookup.erase(Entries.back().first);
+			Entries.pop_back();
+		}
+		Entries.emplace_front(Key, pCompiled);
+		Lookup.emplace(std::move(Key), Entries.begin());
+		return pCompiled;
+	}
+
+	void Clear()
+	{
+		Lookup.clear();
+		Entries.clear();
+	}
+
+private:
+	typedef std::list<std::pair<std::string, std::shared_ptr<T>>> EntryList;
+	EntryList Entries; // most recently used first
+	std::unordered_map<std::string, typename EntryList::iterator> Lookup;
+	size_t MaxEntries;
+	fCompile Compile;
+};
+
+static std::shared_ptr<MQ2DataExpression> CompileDataExpression(PCHAR szBody);
+CCompiledCache<MQ2DataExpression> DataExpressionCache(DATAEXPRESSION_CACHE_SIZE, CompileDataExpression);
+
+// finds the } matching the ${ at pBrace, following the same quote rules as ParseMacroData
+static PCHAR FindDataBraceEnd(PCHAR pBrace)
+{
+	PCHAR pEnd = &pBrace[1];
+	BOOL Quote = false;
+	BOOL BeginParam = false;
+	int nBrace = 1;
+	while (nBrace)
+	{
+		++pEnd;
+		if (*pEnd == 0)
+			return 0;
+		if (BeginParam)
+		{
+			BeginParam = false;
+			if (*pEnd == '\"')
+				Quote = true;
+			continue;
+		}
+		if (Quote)
+		{
+			if (*pEnd == '\"' && (pEnd[1] == ']' || pEnd[1] == ','))
+				Quote = false;
+		}
+		else
+		{
+			if (*pEnd == '}')
+				nBrace--;
+			else if (*pEnd == '{')
+				nBrace++;
+			else if (*pEnd == '[' || *pEnd == ',')
+				BeginParam = true;
+		}
+	}
+	return pEnd;
+}
+
+static bool AddDataSegment(MQ2DataExpression &Expr, PCHAR pStart, PCHAR pEnd, std::vector<MQ2DataIndexPart> &Index, bool IndexCarried)
+{
+	std::string Name(pStart, pEnd);
+	if (Name.find("${") != std::string::npos || Expr.Segments.size() >= MAX_DATA_SEGMENTS)
 		return false;
-	unsigned long NewLength;
-	BOOL Changed = false;
-	//PCHAR pPos;
-	//PCHAR pStart;
-	//PCHAR pIndex;
-	CHAR szCurrent[MAX_STRING] = { 0 };
-	MQ2TYPEVAR Result = { 0 };
-	do
-	{
-		// find this brace's end
-		PCHAR pEnd = &pBrace[1];
-		BOOL Quote = false;
-		BOOL BeginParam = false;
-		int nBrace = 1;
-		while (nBrace)
-		{
-			++pEnd;
-			if (BeginParam)
+	Expr.Segments.emplace_back();
+	MQ2DataSegment &Segment = Expr.Segments.back();
+	Segment.Name.swap(Name);
+	Segment.Atom = FindMQ2Atom(&Segment.Name[0]);
+	Segment.Index.swap(Index);
+	Segment.IndexCarried = IndexCarried;
+	Segment.HasCast = false;
+	return true;
+}
+
+// mirrors ParseMQ2DataPortion, but records the segments instead of evaluating them
+static std::shared_ptr<MQ2DataExpression> CompileDataExpression(PCHAR szBody)
+{
+	auto pExpr = std::make_shared<MQ2DataExpression>();
+	pExpr->nNested = 0;
+	pExpr->Compiled = false;
+	PCHAR pPos = szBody;
+	PCHAR pStart = pPos;
+	PCHAR pNameEnd = 0;
+	std::vector<MQ2DataIndexPart> Index;
+	bool IndexCarried = false;
+	while (1)
+	{
+		if (*pPos == 0)
+		{
+			if (pStart == pPos)
 			{
-				BeginParam = false;
-				if (*pEnd == '\"')
-				{
-					Quote = true;
-				}
-				continue;
+				if (pExpr->Segments.empty())
+					return pExpr;
+				break;
 			}
-			if (*pEnd == 0)
-			{// unmatched brace or quote
-				goto pmdbottom;
+			if (!AddDataSegment(*pExpr, pStart, pNameEnd ? pNameEnd : pPos, Index, IndexCarried))
+				return pExpr;
+			break;
+		}
+		if (*pPos == '(')
+		{
+			if (pStart == pPos || !AddDataSegment(*pExpr, pStart, pNameEnd ? pNameEnd : pPos, Index, IndexCarried))
+				return pExpr;
+			PCHAR pType = ++pPos;
+			while (*pPos != ')')
+			{
+				if (!*pPos)
+					return pExpr;
+				++pPos;
 			}
-			if (Quote)
+			MQ2DataSegment &Segment = pExpr->Segments.back();
+			Segment.Cast.assign(pType, pPos);
+			Segment.HasCast = true;
+			if (Segment.Cast.find("${") != std::string::npos)
+				return pExpr;
+			// ParseMQ2DataPortion doesn't clear the index after a typecast, so the
+			// member that follows sees it too unless it has one of its own
+			IndexCarried = true;
+			pNameEnd = 0;
+			if (pPos[1] == '.')
 			{
-				if (*pEnd == '\"')
+				++pPos;
+				pStart = &pPos[1];
+			}
+			else if (!pPos[1])
+				break;
+			else
+				return pExpr;
+		}
+		else if (*pPos == '[')
+		{
+			pNameEnd = pPos;
+			++pPos;
+			Index.clear();
+			IndexCarried = false;
+			std::string Literal;
+			BOOL Quote = false;
+			BOOL BeginParam = true;
+			while (1)
+			{
+				if (*pPos == 0)
+					return pExpr;
+				if (BeginParam)
 				{
-					if (pEnd[1] == ']' || pEnd[1] == ',')
+					BeginParam = false;
+					if (*pPos == '\"')
+					{
+						Quote = true;
+						++pPos;
+						continue;
+					}
+				}
+				if (Quote)
+				{
+					if (*pPos == '\"' && (pPos[1] == ']' || pPos[1] == ','))
 					{
 						Quote = false;
+						++pPos;
+						continue;
 					}
 				}
+				else
+				{
+					if (*pPos == ']')
+					{
+						if (pPos[1] == '.' || pPos[1] == '(' || pPos[1] == 0)
+							break;
+					}
+					else if (*pPos == ',')
+						BeginParam = true;
+				}
+				if (pPos[0] == '$' && pPos[1] == '{')
+				{
+					PCHAR pNestedEnd = FindDataBraceEnd(pPos);
+					if (!pNestedEnd || ++pExpr->nNested > MAX_DATA_NESTED)
+						return pExpr;
+					if (Literal.size())
+					{
+						Index.emplace_back();
+						Index.back().Text.swap(Literal);
+					}
+					Index.emplace_back();
+					MQ2DataIndexPart &Part = Index.back();
+					Part.Text.assign(&pPos[2], pNestedEnd);
+					Part.Offset = pPos - szBody;
+					Part.pNested = CompileDataExpression(&Part.Text[0]);
+					pPos = &pNestedEnd[1];
+					continue;
+				}
+				Literal += *pPos;
+				++pPos;
 			}
-			else
+			if (Literal.size())
+			{
+				Index.emplace_back();
+				Index.back().Text.swap(Literal);
+			}
+		}
+		else if (*pPos == '.')
+		{
+			if (pStart == pPos || !AddDataSegment(*pExpr, pStart, pNameEnd ? pNameEnd : pPos, Index, IndexCarried))
+				return pExpr;
+			Index.clear();
+			IndexCarried = false;
+			pNameEnd = 0;
+			pStart = &pPos[1];
+		}
+		++pPos;
+	}
+	pExpr->Compiled = true;
+	return pExpr;
+}
+
+static void EvaluateDataExpressionText(MQ2DataExpression &Expr, PCHAR szBody, PCHAR szResult, size_t ResultLen);
+
+static BOOL ParseMacroDataFrom(PCHAR szOriginal, SIZE_T BufferSize, size_t From, BOOL Changed);
+
+// a nested result with one of these could end or split the index it's in, or form another
+// ${...} with the text around it, if it were parsed as part of the body
+#define DATAINDEX_SPECIAL "\",]${"
+
+// true if Part's result would be read differently as part of the body than on its own
+static bool DataResultChangesBody(PCHAR szResult, PCHAR szBody, MQ2DataIndexPart &Part)
+{
+	if (strpbrk(szResult, DATAINDEX_SPECIAL))
+		return true;
+	CHAR Before = Part.Offset ? szBody[Part.Offset - 1] : 0;
+	CHAR After = szBody[Part.Offset + Part.Text.size() + 3];
+	if (!szResult[0])
+	{
+		// nothing there, so the text on either side meets
+		return After && (strchr(DATAINDEX_SPECIAL, After) || After == '.' || After == '(');
+	}
+	return Before == ']' && (szResult[0] == '.' || szResult[0] == '(');
+}
+
+// expands the nested ${...} of every index into szIndex, one index after the other at
+// pIndex[N], the way ParseMacroData would have expanded them in the body before it was
+// split up. If a result would change how the body splits, the body is put back together
+// with the results so far, expanded from there on as text and left in szIndex to be
+// parsed whole instead, and this returns false.
+static bool BuildDataIndexes(MQ2DataExpression &Expr, PCHAR szBody, PCHAR szIndex, PCHAR *pIndex)
+{
+	// where each nested result went in szIndex, in body order
+	struct {
+		MQ2DataIndexPart *pPart;
+		PCHAR pText;
+		size_t Length;
+	} Results[MAX_DATA_NESTED];
+	int nResults = 0;
+	bool bVerbatim = false;
+	size_t Len = 0;
+	CHAR szNested[MAX_STRING];
+	for (size_t N = 0; N < Expr.Segments.size(); N++)
+	{
+		if (Expr.Segments[N].IndexCarried)
+		{
+			pIndex[N] = pIndex[N - 1];
+			continue;
+		}
+		pIndex[N] = &szIndex[Len];
+		szIndex[Len] = 0;
+		for (auto &Part : Expr.Segments[N].Index)
+		{
+			PCHAR pText = &Part.Text[0];
+			if (Part.pNested)
 			{
-				if (*pEnd == '}')
+				if (bVerbatim)
 				{
-					nBrace--;
+					// a /noparse result stopped expansion, leave the rest of the body alone
+					sprintf_s(szNested, "${%s}", Part.Text.c_str());
 				}
-				else if (*pEnd == '{')
+				else
 				{
-					nBrace++;
+					EvaluateDataExpressionText(*Part.pNested, &Part.Text[0], szNested, sizeof(szNested));
+					if (!bAllowCommandParse)
+					{
+						bAllowCommandParse = true;
+						bVerbatim = true;
+					}
 				}
-				else if (*pEnd == '[' || *pEnd == ',')
-					BeginParam = true;
+				if (DataResultChangesBody(szNested, szBody, Part))
+				{
+					std::string Text;
+					size_t Pos = 0;
+					for (int R = 0; R < nResults; R++)
+					{
+						Text.append(&szBody[Pos], &szBody[Results[R].pPart->Offset]);
+						Text.append(Results[R].pText, Results[R].Length);
+						Pos = Results[R].pPart->Offset + Results[R].pPart->Text.size() + 3;
+					}
+					Text.append(&szBody[Pos], &szBody[Part.Offset]);
+					// the old expansion of the body carried on looking just inside this result
+					size_t From = Text.size() + 1;
+					Text.append(szNested);
+					Text.append(&szBody[Part.Offset + Part.Text.size() + 3]);
+					strncpy_s(szIndex, MAX_STRING, Text.c_str(), _TRUNCATE);
+					if (!bVerbatim)
+						ParseMacroDataFrom(szIndex, MAX_STRING, From, true);
+					return false;
+				}
+				pText = szNested;
+			}
+			size_t TextLen = strlen(pText);
+			if (Len + TextLen >= MAX_STRING)
+				TextLen = MAX_STRING - Len - 1;
+			if (Part.pNested)
+			{
+				Results[nResults].pPart = &Part;
+				Results[nResults].pText = &szIndex[Len];
+				Results[nResults].Length = TextLen;
+				nResults++;
 			}
+			memcpy(&szIndex[Len], pText, TextLen);
+			Len += TextLen;
+			szIndex[Len] = 0;
+		}
+		if (Len < MAX_STRING - 1)
+			Len++;
+	}
+	return true;
+}
 
+// szIndex must stay valid for as long as Result is used, some members return pointers into it
+static bool EvaluateCompiledDataExpression(MQ2DataExpression &Expr, PCHAR szBody, MQ2TYPEVAR &Result, PCHAR szIndex)
+{
+	// every nested ${...} is expanded before the first segment is evaluated, as it was
+	// when the whole body was expanded up front. Evaluating one between two segments
+	// could overwrite a result (DataTypeTemp) the next member is about to read.
+	PCHAR pIndex[MAX_DATA_SEGMENTS];
+	if (!BuildDataIndexes(Expr, szBody, szIndex, pIndex))
+	{
+		ZeroMemory(&Result, sizeof(Result));
+		return ParseMQ2DataPortion(szIndex, Result) != FALSE;
+	}
+	ZeroMemory(&Result, sizeof(Result));
+	for (size_t N = 0; N < Expr.Segments.size(); N++)
+	{
+		MQ2DataSegment &Segment = Expr.Segments[N];
+		if (!Segment.Atom)
+		{
+			// e.g. a variable that hadn't been declared yet when this was compiled
+			Segment.Atom = FindMQ2Atom(&Segment.Name[0]);
 		}
-		*pEnd = 0;
-		strcpy_s(szCurrent, &pBrace[2]);
-		if (szCurrent[0] == 0)
+		// the interned copy of the name lets FindMember skip hashing it
+		PCHAR pName = Segment.Atom ? GetMQ2AtomName(Segment.Atom) : &Segment.Name[0];
+		if (!EvaluateDataExpression(Result, pName, pIndex[N], Segment.Atom))
+			return false;
+		if (Segment.HasCast)
 		{
-			goto pmdbottom;
+			if (!Result.Type)
+				return false;
+			MQ2Type *pNewType = FindMQ2DataType(&Segment.Cast[0]);
+			if (!pNewType)
+			{
+				MQ2DataError("Unknown type '%s'", Segment.Cast.c_str());
+				return false;
+			}
+			if (pNewType == pTypeType)
+			{
+				Result.Ptr = Result.Type;
+				Result.Type = pTypeType;
+			}
+			else
+				Result.Type = pNewType;
 		}
-		if (ParseMacroData(szCurrent, sizeof(szCurrent)))
+	}
+	return true;
+}
+
+// the typed result of a ${...}. szBuffer (MAX_STRING) holds anything Result may point
+// into. szBody is only parsed when Expr couldn't be compiled.
+static bool EvaluateDataExpressionValue(MQ2DataExpression &Expr, PCHAR szBody, MQ2TYPEVAR &Result, PCHAR szBuffer)
+{
+	if (Expr.Compiled)
+		return EvaluateCompiledDataExpression(Expr, szBody, Result, szBuffer) && Result.Type;
+	ZeroMemory(&Result, sizeof(Result));
+	strcpy_s(szBuffer, MAX_STRING, szBody);
+	ParseMacroData(szBuffer, MAX_STRING);
+	return ParseMQ2DataPortion(szBuffer, Result) && Result.Type;
+}
+
+// writes the text of a ${...} to szResult, or NULL on failure
+static void EvaluateDataExpressionText(MQ2DataExpression &Expr, PCHAR szBody, PCHAR szResult, size_t ResultLen)
+{
+	MQ2TYPEVAR Result;
+	CHAR szBuffer[MAX_STRING];
+	if (!EvaluateDataExpressionValue(Expr, szBody, Result, szBuffer) || !Result.Type->ToString(Result.VarPtr, szResult))
+		strcpy_s(szResult, ResultLen, "NULL");
+}
+
+static void EvaluateMacroDataBody(PCHAR szBody, PCHAR szResult, size_t ResultLen)
+{
+	// hold a reference, nested evaluation can push this entry out of the cache
+	std::shared_ptr<MQ2DataExpression> pExpr = DataExpressionCache.Get(szBody);
+	EvaluateDataExpressionText(*pExpr, szBody, szResult, ResultLen);
+}
+
+// guards against a line that expands to itself forever
+#define MAX_PARSE_PASSES 1000
+
+// ParseMacroData's strings, one set per level since a ${...} can parse another line
+// while this one is half streamed. They keep their capacity from call to call.
+struct ParseMacroDataScratch
+{
+	std::string Output;
+	std::string Pending;
+	std::string Rest;
+};
+static std::deque<ParseMacroDataScratch> ParseScratch;   // a deque, so a deeper level doesn't move one in use
+static size_t ParseDepth = 0;
+
+class CParseScratchScope
+{
+public:
+	CParseScratchScope()
+	{
+		if (ParseDepth == ParseScratch.size())
+			ParseScratch.emplace_back();
+		pScratch = &ParseScratch[ParseDepth++];
+	}
+	~CParseScratchScope()
+	{
+		ParseDepth--;
+	}
+	ParseMacroDataScratch *pScratch;
+};
+
+// one pass over the line, starting the search for ${ at From. It is streamed once into
+// Output, and like the old parser the search for the next ${ carries on one character
+// into each result. A result that could hold a ${ is put back in front of the unread
+// input (in Pending) so only that part is copied again.
+static BOOL ParseMacroDataPass(PCHAR szOriginal, SIZE_T BufferSize, size_t From, BOOL Changed)
+{
+	From = min(From, strlen(szOriginal));
+	PCHAR pBrace = strstr(&szOriginal[From], "${");
+	if (!pBrace)
+		return Changed;
+	CParseScratchScope Scratch;
+	std::string &Output = Scratch.pScratch->Output;
+	std::string &Pending = Scratch.pScratch->Pending;
+	std::string &Rest = Scratch.pScratch->Rest;
+	Output.assign(szOriginal, pBrace);
+	PCHAR pPos = pBrace;
+	CHAR szCurrent[MAX_STRING] = { 0 };
+	while (pBrace = strstr(pPos, "${"))
+	{
+		Output.append(pPos, pBrace);
+		PCHAR pEnd = FindDataBraceEnd(pBrace);
+		if (!pEnd || pEnd == &pBrace[2])
 		{
-			unsigned long NewLength = strlen(szCurrent);
-			memmove(&pBrace[NewLength + 1], &pEnd[1], strlen(&pEnd[1]) + 1);
-			int addrlen = (int)(pBrace - szOriginal);
-			memcpy_s(pBrace, BufferSize-addrlen,szCurrent, NewLength);
-			pEnd = &pBrace[NewLength];
-			*pEnd = 0;
+			// unmatched brace or quote, or ${}. keep the $ and look past it
+			Output += '$';
+			pPos = &pBrace[1];
+			continue;
 		}
-		ZeroMemory(&Result, sizeof(Result));
-		Result.Type = 0;
-		Result.Int64 = 0;
-		if (!ParseMQ2DataPortion(szCurrent, Result) || !Result.Type || !Result.Type->ToString(Result.VarPtr, szCurrent)) {
-			strcpy_s(szCurrent, "NULL");
-		}
-		NewLength = strlen(szCurrent);
-		memmove(&pBrace[NewLength], &pEnd[1], strlen(&pEnd[1]) + 1);
-		int addrlen = (int)(pBrace - szOriginal);
-		memcpy_s(pBrace, BufferSize-addrlen,szCurrent, NewLength);
-		if (bAllowCommandParse==false) {
+		*pEnd = 0;
+		EvaluateMacroDataBody(&pBrace[2], szCurrent, sizeof(szCurrent));
+		*pEnd = '}';
+		pPos = &pEnd[1];
+		if (bAllowCommandParse == false)
+		{
+			// the result asked not to be parsed, leave it and the rest of the line alone
 			bAllowCommandParse = true;
+			Output.append(szCurrent);
 			Changed = false;
 			break;
 		}
-		else {
-			Changed = true;
+		Changed = true;
+		if (!szCurrent[0])
+		{
+			if (*pPos)
+				Output += *pPos++;
+			continue;
 		}
-	pmdbottom:;
-	} while (pBrace = strstr(&pBrace[1], "${"));
-	if (Changed)
-		while (ParseMacroData(szOriginal, BufferSize))
+		Output += szCurrent[0];
+		if (!strchr(&szCurrent[1], '$'))
 		{
+			Output.append(&szCurrent[1]);
+			continue;
 		}
+		Rest.assign(&szCurrent[1]);
+		Rest.append(pPos);
+		Pending.swap(Rest);
+		pPos = &Pending[0];
+	}
+	Output.append(pPos);
+	size_t Len = Output.size();
+	if (Len >= BufferSize)
+		Len = BufferSize - 1;
+	memcpy(szOriginal, Output.c_str(), Len);
+	szOriginal[Len] = 0;
 	return Changed;
 }
 
+// finishes a pass that has already changed the line from From on, then goes over the
+// whole line again. That picks up anything a pass skipped, or that a result closed or
+// formed. The old parser called itself for each pass that changed the line and looped
+// there until one didn't, so a pass /noparse stopped only ends the innermost of those
+// loops and the one before it scans the line again.
+static BOOL ParseMacroDataFrom(PCHAR szOriginal, SIZE_T BufferSize, size_t From, BOOL Changed)
+{
+	if (!ParseMacroDataPass(szOriginal, BufferSize, From, Changed))
+		return false;
+	int Loops = 1;
+	int Passes = 1;
+	while (Loops && Passes++ < MAX_PARSE_PASSES)
+	{
+		if (ParseMacroDataPass(szOriginal, BufferSize, 0, false))
+			Loops++;
+		else
+			Loops--;
+	}
+	return true;
+}
+
+BOOL ParseMacroData(PCHAR szOriginal, SIZE_T BufferSize)
+{
+	// find each {}
+	if (!strstr(szOriginal, "${"))
+		return false;
+	CMQ2DataTempScope Scope;
+	return ParseMacroDataFrom(szOriginal, BufferSize, 0, false);
+}
+
+// Compiled /if and /while conditions
+//
+// A condition is compiled once into an expression tree over the calculator's operators,
+// with each ${...} as an operand read straight from its typed result (int, bool, float)
+// rather than printed and parsed again. && and || don't evaluate their right side when
+// the left side already decides them. The tokenizer and precedence are FastCalculate's,
+// so the tree gives the same answer Calculate would for the expanded text. Conditions
+// where that can't be guaranteed up front (a ${...} run together with other text, words
+// Calculate doesn't know) go through ParseMacroData and Calculate as before, and so does
+// a single evaluation that turns up a result which isn't a plain number.
+#define CONDITION_CACHE_SIZE 512
+#define MAX_CONDITION_REFS 32
+
+struct MQ2ConditionRef
+{
+	std::string Body;                           // between ${ and }
+	std::shared_ptr<MQ2DataExpression> pExpr;
+	bool SignSensitive;                         // follows - ! or ~, see ReadConditionRef
+};
+
+struct MQ2ConditionNode
+{
+	eCalcOp Op;
+	DOUBLE Value;  // CO_NUMBER
+	int Ref;       // CO_NUMBER read from Refs[Ref] instead, or -1
+	int Left;
+	int Right;     // -1 for unary operators
+};
+
+struct MQ2Condition
+{
+	std::vector<std::string> Text;              // source around the refs, Text[N] comes before Refs[N]
+	std::vector<MQ2ConditionRef> Refs;
+	std::vector<MQ2ConditionNode> Nodes;
+	int Root;
+	bool Compiled;
+};
+
+// builds the tree from FastCalculate's RPN, false if the RPN doesn't form exactly one
+// expression (FastCalculate would read past its stack)
+static bool BuildConditionTree(MQ2Condition &Cond, std::vector<MQ2ConditionNode> &RPN)
+{
+	std::vector<int> Stack;
+	for (auto &Item : RPN)
+	{
+		switch (Item.Op)
+		{
+		case CO_OPENPARENS:
+		case CO_CLOSEPARENS:
+			// an unclosed ( ends up in the list, EvaluateRPN ignores it
+			continue;
+		case CO_NUMBER:
+			break;
+		case CO_NEGATE:
+		case CO_LNOT:
+		case CO_NOT:
+			if (Stack.empty())
+				return false;
+			Item.Left = Stack.back();
+			Stack.pop_back();
+			break;
+		default:
+			if (Stack.size() < 2)
+				return false;
+			Item.Right = Stack.back();
+			Stack.pop_back();
+			Item.Left = Stack.back();
+			Stack.pop_back();
+			break;
+		}
+		Stack.push_back((int)Cond.Nodes.size());
+		Cond.Nodes.push_back(Item);
+	}
+	if (Stack.size() != 1)
+		return false;
+	Cond.Root = Stack.back();
+	return true;
+}
+
+static std::shared_ptr<MQ2Condition> CompileCondition(PCHAR szCond)
+{
+	auto pCond = std::make_shared<MQ2Condition>();
+	pCond->Compiled = false;
+	pCond->Root = -1;
+	PCHAR pPos = szCond;
+	while (PCHAR pBrace = strstr(pPos, "${"))
+	{
+		PCHAR pEnd = FindDataBraceEnd(pBrace);
+		if (!pEnd || pEnd == &pBrace[2] || pCond->Refs.size() >= MAX_CONDITION_REFS)
+			return pCond;
+		pCond->Text.emplace_back(pPos, pBrace);
+		pCond->Refs.emplace_back();
+		MQ2ConditionRef &Ref = pCond->Refs.back();
+		Ref.Body.assign(&pBrace[2], pEnd);
+		Ref.pExpr = CompileDataExpression(&Ref.Body[0]);
+		Ref.SignSensitive = false;
+		pPos = &pEnd[1];
+	}
+	pCond->Text.emplace_back(pPos);
+
+	// the same state machine as FastCalculate, with a ${...} standing in for a number
+	std::vector<MQ2ConditionNode> RPN;
+	std::vector<eCalcOp> Stack;
+	std::string Token;
+	int Ref = -1;
+	bool WasParen = false;
+	char LastChar = 0;
+	auto Finish = [&]() {
+		if (Ref >= 0 || Token.size())
+		{
+			MQ2ConditionNode Node = { CO_NUMBER, Ref >= 0 ? 0.0 : atof(Token.c_str()), Ref, -1, -1 };
+			RPN.push_back(Node);
+			Ref = -1;
+			Token.clear();
+		}
+	};
+	auto NewOp = [&](eCalcOp Op) {
+		Finish();
+		while (Stack.size() && Stack.back() != CO_OPENPARENS && CalcOpPrecedence[Stack.back()] >= CalcOpPrecedence[Op])
+		{
+			MQ2ConditionNode Node = { Stack.back(), 0.0, -1, -1, -1 };
+			RPN.push_back(Node);
+			Stack.pop_back();
+		}
+		Stack.push_back(Op);
+	};
+	for (size_t N = 0; N < pCond->Text.size(); N++)
+	{
+		// Calculate's keyword replacement, on this part of the text
+		std::string Text = pCond->Text[N];
+		std::transform(Text.begin(), Text.end(), Text.begin(), ::toupper);
+		const char *Keywords[][2] = { { "NULL", "0.00" }, { "TRUE", "1.00" }, { "FALSE", "0.000" } };
+		for (auto &Keyword : Keywords)
+		{
+			size_t Found;
+			while ((Found = Text.find(Keyword[0])) != Text.npos)
+				Text.replace(Found, strlen(Keyword[0]), Keyword[1]);
+		}
+		bool BeforeRef = N + 1 < pCond->Text.size();
+		for (size_t Pos = 0; Pos < Text.size(); Pos++)
+		{
+			char ch = Text[Pos];
+			// a ref reads as a number here, its sign is dealt with when it's evaluated
+			char Next = Pos + 1 < Text.size() ? Text[Pos + 1] : (BeforeRef ? '0' : 0);
+			if (ch != ' ')
+				LastChar = ch;
+			if ((ch >= '0' && ch <= '9') || ch == '.')
+			{
+				if (Ref >= 0)
+					return pCond;
+				Token += ch;
+				WasParen = false;
+				continue;
+			}
+			switch (ch)
+			{
+			case ' ':
+				continue;
+			case '(':
+				// a ${...} right before a ( would leave its minus sign on the stack
+				// until after the parens
+				if (Ref >= 0)
+					return pCond;
+				Finish();
+				Stack.push_back(CO_OPENPARENS);
+				break;
+			case ')':
+				Finish();
+				while (Stack.size() && Stack.back() != CO_OPENPARENS)
+				{
+					MQ2ConditionNode Node = { Stack.back(), 0.0, -1, -1, -1 };
+					RPN.push_back(Node);
+					Stack.pop_back();
+				}
+				if (Stack.empty())
+					return pCond;
+				Stack.pop_back();
+				WasParen = true;
+				continue;
+			case '+':
+				if (Next != '+')
+					NewOp(CO_ADD);
+				break;
+			case '-':
+				if (Next == '-')
+				{
+					Pos++;
+					NewOp(CO_ADD);
+				}
+				else if (Token.size() || Ref >= 0 || WasParen)
+					NewOp(CO_SUBTRACT);
+				else
+					NewOp(CO_NEGATE);
+				break;
+			case '*':
+				NewOp(CO_MULTIPLY);
+				break;
+			case '\\':
+				NewOp(CO_IDIVIDE);
+				break;
+			case '/':
+				NewOp(CO_DIVIDE);
+				break;
+			case '|':
+				if (Next == '|')
+				{
+					Pos++;
+					NewOp(CO_LOR);
+				}
+				else
+					NewOp(CO_OR);
+				break;
+			case '%':
+				NewOp(CO_MODULUS);
+				break;
+			case '~':
+				NewOp(CO_NOT);
+				break;
+			case '&':
+				if (Next == '&')
+				{
+					Pos++;
+					NewOp(CO_LAND);
+				}
+				else
+					NewOp(CO_AND);
+				break;
+			case '^':
+				if (Next == '^')
+				{
+					Pos++;
+					NewOp(CO_XOR);
+				}
+				else
+					NewOp(CO_POWER);
+				break;
+			case '!':
+				if (Next == '=')
+				{
+					Pos++;
+					NewOp(CO_NOTEQUAL);
+				}
+				else
+					NewOp(CO_LNOT);
+				break;
+			case '=':
+				if (Next != '=')
+					return pCond;
+				Pos++;
+				NewOp(CO_EQUAL);
+				break;
+			case '<':
+				if (Next == '=')
+				{
+					Pos++;
+					NewOp(CO_NOTGREATER);
+				}
+				else if (Next == '<')
+				{
+					Pos++;
+					NewOp(CO_SHL);
+				}
+				else
+					NewOp(CO_LESS);
+				break;
+			case '>':
+				if (Next == '=')
+				{
+					Pos++;
+					NewOp(CO_NOTLESS);
+				}
+				else if (Next == '>')
+				{
+					Pos++;
+					NewOp(CO_SHR);
+				}
+				else
+					NewOp(CO_GREATER);
+				break;
+			default:
+				// anything else is an error, let Calculate report it
+				return pCond;
+			}
+			WasParen = false;
+		}
+		if (BeforeRef)
+		{
+			// run together with a number or another ${...}, or right after a ), the
+			// expanded text would tokenize differently than a lone operand
+			if (Token.size() || Ref >= 0 || WasParen)
+				return pCond;
+			Ref = (int)N;
+			pCond->Refs[N].SignSensitive = LastChar == '-' || LastChar == '!' || LastChar == '~';
+			LastChar = '0';
+			WasParen = false;
+		}
+	}
+	Finish();
+	while (Stack.size())
+	{
+		MQ2ConditionNode Node = { Stack.back(), 0.0, -1, -1, -1 };
+		RPN.push_back(Node);
+		Stack.pop_back();
+	}
+	pCond->Compiled = BuildConditionTree(*pCond, RPN);
+	return pCond;
+}
+
+CCompiledCache<MQ2Condition> ConditionCache(CONDITION_CACHE_SIZE, CompileCondition);
+
+struct MQ2ConditionState
+{
+	MQ2Condition *pCond;
+	bool Evaluated[MAX_CONDITION_REFS];
+	MQ2TYPEVAR Var[MAX_CONDITION_REFS];         // Type 0 when it read as NULL
+	PCHAR pText[MAX_CONDITION_REFS];            // printed result, for types read from their text
+	bool Fallback;                              // needs the text path after all
+	int NoParseRef;                             // a result that asked not to be parsed, or -1
+};
+
+// what atof gives back for ToString's %.2f
+static DOUBLE RoundConditionFloat(DOUBLE Value)
+{
+	DOUBLE Scaled = fabs(Value) * 100.0;
+	DOUBLE Fraction = Scaled - floor(Scaled);
+	if (Scaled >= 1e9 || fabs(Fraction - 0.5) < 1e-6)
+	{
+		// too big, or close enough to a tie that printf's rounding should decide
+		CHAR szTemp[MAX_STRING];
+		sprintf_s(szTemp, "%.2f", Value);
+		return atof(szTemp);
+	}
+	DOUBLE Rounded = floor(Scaled + 0.5) / 100.0;
+	return Value < 0 ? -Rounded : Rounded;
+}
+
+// a result printed as a plain number or TRUE/FALSE/NULL, read the way Calculate would
+static bool ReadConditionText(PCHAR szText, DOUBLE &Value)
+{
+	if (!_stricmp(szText, "TRUE"))
+	{
+		Value = 1.0;
+		return true;
+	}
+	if (!_stricmp(szText, "FALSE") || !_stricmp(szText, "NULL"))
+	{
+		Value = 0.0;
+		return true;
+	}
+	PCHAR pPos = szText;
+	if (*pPos == '-')
+		pPos++;
+	if (!*pPos)
+		return false;
+	for (; *pPos; pPos++)
+	{
+		if ((*pPos < '0' || *pPos > '9') && *pPos != '.')
+			return false;
+	}
+	Value = atof(szText);
+	return true;
+}
+
+static bool ReadConditionRef(MQ2ConditionState &State, int N, DOUBLE &Value)
+{
+	MQ2ConditionRef &Ref = State.pCond->Refs[N];
+	MQ2TYPEVAR &Var = State.Var[N];
+	CHAR szBuffer[MAX_STRING];
+	State.Evaluated[N] = true;
+	State.pText[N] = 0;
+	if (!EvaluateDataExpressionValue(*Ref.pExpr, &Ref.Body[0], Var, szBuffer))
+		Var.Type = 0;
+	bool Negative = false;
+	if (!Var.Type)
+		Value = 0.0;
+	else if (Var.Type == pIntType || Var.Type == pByteType)
+		Value = (DOUBLE)Var.Int;
+	else if (Var.Type == pBoolType)
+		Value = Var.DWord ? 1.0 : 0.0;
+	else if (Var.Type == pInt64Type)
+		Value = (DOUBLE)Var.Int64;
+	else if (Var.Type == pFloatType && _finite(Var.Float))
+		Value = RoundConditionFloat(Var.Float);
+	else if (Var.Type == pDoubleType && _finite(Var.Double))
+		Value = RoundConditionFloat(Var.Double);
+	else
+	{
+		State.pText[N] = AllocMQ2DataTemp(MAX_STRING);
+		if (!Var.Type->ToString(Var.VarPtr, State.pText[N]))
+		{
+			Var.Type = 0;
+			strcpy_s(State.pText[N], MAX_STRING, "NULL");
+		}
+		if (!ReadConditionText(State.pText[N], Value))
+		{
+			State.Fallback = true;
+		}
+		Negative = State.pText[N][0] == '-';
+	}
+	if (!bAllowCommandParse)
+	{
+		bAllowCommandParse = true;
+		State.NoParseRef = N;
+		State.Fallback = true;
+	}
+	if (!State.pText[N])
+		Negative = Value < 0 || (Value == 0 && _copysign(1.0, Value) < 0);
+	// after - ! or ~ the text's own minus sign changes how FastCalculate tokenizes it
+	// (-- is an addition, !- pops the ! first), so only Calculate can say what it means
+	if (Negative && Ref.SignSensitive)
+		State.Fallback = true;
+	return !State.Fallback;
+}
+
+static bool EvaluateConditionNode(MQ2ConditionState &State, int N, DOUBLE &Value)
+{
+	MQ2ConditionNode &Node = State.pCond->Nodes[N];
+	if (Node.Op == CO_NUMBER)
+	{
+		if (Node.Ref < 0)
+		{
+			Value = Node.Value;
+			return true;
+		}
+		return ReadConditionRef(State, Node.Ref, Value);
+	}
+	DOUBLE Left;
+	if (!EvaluateConditionNode(State, Node.Left, Left))
+		return false;
+	switch (Node.Op)
+	{
+	case CO_NEGATE:
+		Value = -Left;
+		return true;
+	case CO_LNOT:
+		Value = !((int)Left);
+		return true;
+	case CO_NOT:
+		Value = ~((int)Left);
+		return true;
+	case CO_LAND:
+		if (!Left)
+		{
+			Value = 0.0;
+			return true;
+		}
+		break;
+	case CO_LOR:
+		if (Left)
+		{
+			Value = 1.0;
+			return true;
+		}
+		break;
+	}
+	DOUBLE Right;
+	if (!EvaluateConditionNode(State, Node.Right, Right))
+		return false;
+	switch (Node.Op)
+	{
+	case CO_ADD:
+		Value = Left + Right;
+		break;
+	case CO_SUBTRACT:
+		Value = Left - Right;
+		break;
+	case CO_MULTIPLY:
+		Value = Left * Right;
+		break;
+	case CO_DIVIDE:
+		if (!Right)
+		{
+			FatalError("Divide by zero in calculation");
+			return false;
+		}
+		Value = Left / Right;
+		break;
+	case CO_IDIVIDE:
+	case CO_MODULUS:
+		if (!(int)Right)
+		{
+			FatalError(Node.Op == CO_IDIVIDE ? "Divide by zero in calculation" : "Modulus by zero in calculation");
+			return false;
+		}
+		Value = Node.Op == CO_IDIVIDE ? (int)Left / (int)Right : (int)Left % (int)Right;
+		break;
+	case CO_LAND:
+	case CO_LOR:
+		// the left side didn't decide it
+		Value = Right ? 1.0 : 0.0;
+		break;
+	case CO_EQUAL:
+		Value = Left == Right;
+		break;
+	case CO_NOTEQUAL:
+		Value = Left != Right;
+		break;
+	case CO_GREATER:
+		Value = Left > Right;
+		break;
+	case CO_NOTGREATER:
+		Value = Left <= Right;
+		break;
+	case CO_LESS:
+		Value = Left < Right;
+		break;
+	case CO_NOTLESS:
+		Value = Left >= Right;
+		break;
+	case CO_SHL:
+		Value = (int)Left << (int)Right;
+		break;
+	case CO_SHR:
+		Value = (int)Left >> (int)Right;
+		break;
+	case CO_AND:
+		Value = (int)Left & (int)Right;
+		break;
+	case CO_OR:
+		Value = (int)Left | (int)Right;
+		break;
+	case CO_XOR:
+		Value = (int)Left ^ (int)Right;
+		break;
+	case CO_POWER:
+		Value = pow(Left, Right);
+		break;
+	default:
+		Value = Left;
+		break;
+	}
+	return true;
+}
+
+// the condition text with what was evaluated so far filled in, for the text path
+static void BuildConditionText(MQ2ConditionState &State, PCHAR szBuffer, size_t BufferLen)
+{
+	MQ2Condition &Cond = *State.pCond;
+	std::string Text;
+	CHAR szRef[MAX_STRING];
+	for (size_t N = 0; N < Cond.Text.size(); N++)
+	{
+		Text += Cond.Text[N];
+		if (N == Cond.Refs.size())
+			break;
+		MQ2ConditionRef &Ref = Cond.Refs[N];
+		if (State.Evaluated[N])
+		{
+			if (State.pText[N])
+				Text += State.pText[N];
+			else if (!State.Var[N].Type || !State.Var[N].Type->ToString(State.Var[N].VarPtr, szRef))
+				Text += "NULL";
+			else
+				Text += szRef;
+		}
+		else if (State.NoParseRef >= 0 && (int)N < State.NoParseRef)
+		{
+			// skipped by && or ||, ParseMacroData would have expanded it before the /noparse
+			EvaluateDataExpressionText(*Ref.pExpr, &Ref.Body[0], szRef, sizeof(szRef));
+			Text += szRef;
+		}
+		else
+		{
+			Text += "${";
+			Text += Ref.Body;
+			Text += "}";
+		}
+	}
+	strncpy_s(szBuffer, BufferLen, Text.c_str(), _TRUNCATE);
+}
+
+// Calculate for /if and /while, with the ${...} in szCond still unexpanded
+BOOL CalculateCondition(PCHAR szCond, DOUBLE &Result)
+{
+	CMQ2DataTempScope Scope;
+	CHAR szBuffer[MAX_STRING];
+	std::shared_ptr<MQ2Condition> pCond = ConditionCache.Get(szCond);
+	if (!pCond->Compiled)
+	{
+		strcpy_s(szBuffer, szCond);
+		ParseMacroData(szBuffer, sizeof(szBuffer));
+		return Calculate(szBuffer, Result);
+	}
+	MQ2ConditionState State;
+	State.pCond = pCond.get();
+	State.Fallback = false;
+	State.NoParseRef = -1;
+	for (size_t N = 0; N < pCond->Refs.size(); N++)
+		State.Evaluated[N] = false;
+	if (EvaluateConditionNode(State, pCond->Root, Result))
+		return true;
+	if (!State.Fallback)
+		return false;
+	BuildConditionText(State, szBuffer, sizeof(szBuffer));
+	if (State.NoParseRef < 0)
+		ParseMacroData(szBuffer, sizeof(szBuffer));
+	return Calculate(szBuffer, Result);
+}
+
 #endif
\ No newline at end of file
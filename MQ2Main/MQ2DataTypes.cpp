@@ -920,6 +920,29 @@ bool MQ2MacroType::GETMEMBER()
 			Dest.Type = pIntType;
 			return true;
 		}
+	case EventQueue:
+		Dest.DWord = gEventQueueSize;
+		Dest.Type = pIntType;
+		return true;
+	case EventsDropped:
+		// events not queued because MaxEventQueue were already waiting
+		Dest.DWord = gEventsDropped;
+		Dest.Type = pIntType;
+		return true;
+	case LinesPerFrame:
+		// averaged over the last few frames, only kept under #turbo budget
+		Dest.Float = gTurboLinesPerFrame;
+		Dest.Type = pFloatType;
+		return true;
+	case TurboBudget:
+		// microseconds this frame may spend on the macro, 0 when #turbo counts lines
+		Dest.DWord = gTurboFrameBudget;
+		Dest.Type = pIntType;
+		return true;
+	case TurboOverruns:
+		Dest.DWord = gTurboOverruns;
+		Dest.Type = pIntType;
+		return true;
 	}
 	return false;
 }
@@ -932,11 +955,7 @@ bool MQ2TicksType::GETMEMBER()
 	//	return false;
 	//DWORD TSeconds = VarPtr.DWord / 1000 / 6;
 #define nTicks (VarPtr.DWord)
-	unsigned long N = MemberMap[Member];
-	if (!N)
-		return false;
-	N--;
-	PMQ2TYPEMEMBER pMember = Members[N];
+	PMQ2TYPEMEMBER pMember = MQ2TicksType::FindMember(Member);
 	if (!pMember)
 		return false;
 	switch ((TicksMembers)pMember->ID)
@@ -1002,11 +1021,7 @@ bool MQ2TicksType::GETMEMBER()
 bool MQ2TimeStampType::GETMEMBER()
 {
 #define nTimeStamp (VarPtr.UInt64)
-	unsigned long N = MemberMap[Member];
-	if (!N)
-		return false;
-	N--;
-	PMQ2TYPEMEMBER pMember = Members[N];
+	PMQ2TYPEMEMBER pMember = MQ2TimeStampType::FindMember(Member);
 	if (!pMember)
 		return false;
 	switch ((TimeStampMembers)pMember->ID)
@@ -1080,11 +1095,7 @@ bool MQ2TimeStampType::GETMEMBER()
 
 bool MQ2ArgbType::GETMEMBER()
 {
-	unsigned long N = MemberMap[Member];
-	if (!N)
-		return false;
-	N--;
-	PMQ2TYPEMEMBER pMember = Members[N];
+	PMQ2TYPEMEMBER pMember = MQ2ArgbType::FindMember(Member);
 	if (!pMember)
 		return false;
 	switch ((ArgbMembers)pMember->ID)
@@ -9754,6 +9765,75 @@ bool MQ2InvSlotType::GETMEMBER()
 
 
 
+bool MQ2TimerType::ToString(MQ2VARPTR VarPtr, PCHAR Destination)
+{
+	PMQTIMER pTimer = (PMQTIMER)VarPtr.Ptr;
+	_ultoa_s(GetMQ2TimerValue(pTimer), Destination, MAX_STRING, 10);
+	return true;
+}
+
+void MQ2TimerType::InitVariable(MQ2VARPTR &VarPtr)
+{
+	if (PMQTIMER pVar = (PMQTIMER)malloc(sizeof(MQTIMER))) {
+		pVar->szName[0] = '\0';
+		pVar->Original = 0;
+		pVar->Deadline = 0;
+		pVar->ppSlot = 0;
+		pVar->pNextInSlot = 0;
+		pVar->pPrevInSlot = 0;
+		pVar->pNext = gTimer;
+		pVar->pPrev = 0;
+		if (gTimer)
+			gTimer->pPrev = pVar;
+		gTimer = pVar;
+		VarPtr.Ptr = pVar;
+		VarPtr.HighPart = 0;
+	}
+}
+
+void MQ2TimerType::FreeVariable(MQ2VARPTR &VarPtr)
+{
+	if (PMQTIMER pVar = (PMQTIMER)VarPtr.Ptr) {
+		SetMQ2Timer(pVar, 0);
+		if (pVar->pPrev)
+			pVar->pPrev->pNext = pVar->pNext;
+		else
+			gTimer = pVar->pNext;
+		if (pVar->pNext)
+			pVar->pNext->pPrev = pVar->pPrev;
+		free(VarPtr.Ptr);
+	}
+}
+
+bool MQ2TimerType::FromData(MQ2VARPTR &VarPtr, MQ2TYPEVAR &Source)
+{
+	PMQTIMER pTimer = (PMQTIMER)VarPtr.Ptr;
+	if (Source.Type == pFloatType)
+		pTimer->Original = (DWORD)Source.Float;
+	else
+		pTimer->Original = Source.DWord;
+	SetMQ2Timer(pTimer, pTimer->Original);
+	return true;
+}
+
+bool MQ2TimerType::FromString(MQ2VARPTR &VarPtr, PCHAR Source)
+{
+	PMQTIMER pTimer = (PMQTIMER)VarPtr.Ptr;
+	FLOAT VarValue = (FLOAT)atof(Source);
+	switch (Source[strlen(Source) - 1])
+	{
+	case 'm':
+	case 'M':
+		VarValue *= 60;
+	case 's':
+	case 'S':
+		VarValue *= 10;
+	}
+	pTimer->Original = (DWORD)VarValue;
+	SetMQ2Timer(pTimer, pTimer->Original);
+	return true;
+}
+
 bool MQ2TimerType::GETMEMBER()
 {
 #define pTimer ((PMQTIMER)VarPtr.Ptr)
@@ -9764,10 +9844,10 @@ bool MQ2TimerType::GETMEMBER()
 		switch ((TimerMethods)pMethod->ID)
 		{
 		case Expire:
-			pTimer->Current = 0;
+			SetMQ2Timer(pTimer, 0);
 			return true;
 		case Reset:
-			pTimer->Current = pTimer->Original;
+			SetMQ2Timer(pTimer, pTimer->Original);
 			return true;
 		case Set:
 		{
@@ -9783,7 +9863,7 @@ bool MQ2TimerType::GETMEMBER()
 	switch ((TimerMembers)pMember->ID)
 	{
 	case Value:
-		Dest.DWord = pTimer->Current;
+		Dest.DWord = GetMQ2TimerValue(pTimer);
 		Dest.Type = pIntType;
 		return true;
 	case OriginalValue:
@@ -51,6 +51,8 @@ GNU General Public License for more details.
 #define DOUBLEPTR(x) Dest.Double=x
 
 #define TypeMember(name) AddMember((DWORD)name,""#name)
+// see MEMBER_FRAMESTABLE
+#define TypeMemberFrameStable(name) AddMember((DWORD)name,""#name,MEMBER_FRAMESTABLE)
 #define TypeMethod(name) AddMethod((DWORD)name,""#name)
 //#define TypeMethod(x)
 //#define AddMethod(x,y)
@@ -739,8 +741,8 @@ public:
 		TypeMember(DistanceX);//7,
 		TypeMember(DistanceY);//8,
 		TypeMember(DistanceZ);//9,
-		TypeMember(Distance);//10,
-		TypeMember(Distance3D);//11,
+		TypeMemberFrameStable(Distance);//10,
+		TypeMemberFrameStable(Distance3D);//11,
 		TypeMember(DistancePredict);//12,
 		TypeMember(Next);//13,
 		TypeMember(Prev);//14,
@@ -754,7 +756,7 @@ public:
 		TypeMember(State);//22,
 		TypeMember(CurrentHPs);//23,
 		TypeMember(MaxHPs);//24,
-		TypeMember(PctHPs);//25,
+		TypeMemberFrameStable(PctHPs);//25,
 		TypeMember(Deity);//26,
 		TypeMember(Type);//28,
 		TypeMember(CleanName);//29,
@@ -1211,16 +1213,16 @@ public:
 		TypeMember(Dar);//6,
 		TypeMember(AAExp);//7,
 		TypeMember(AAPoints);//8,
-		TypeMember(CurrentHPs);//10,
-		TypeMember(MaxHPs);//11,
+		TypeMemberFrameStable(CurrentHPs);//10,
+		TypeMemberFrameStable(MaxHPs);//11,
 		TypeMember(HPRegen);//12,
-		TypeMember(PctHPs);//13,
+		TypeMemberFrameStable(PctHPs);//13,
 		TypeMember(CurrentMana);//14,
-		TypeMember(MaxMana);//15,
+		TypeMemberFrameStable(MaxMana);//15,
 		TypeMember(ManaRegen);//16,
-		TypeMember(PctMana);//17,
-		TypeMember(Buff);//18,
-		TypeMember(Song);//19,
+		TypeMemberFrameStable(PctMana);//17,
+		TypeMemberFrameStable(Buff);//18,
+		TypeMemberFrameStable(Song);//19,
 		TypeMember(Book);//20,
 		TypeMember(Skill);//21,
 		TypeMember(Ability);//22,
@@ -1285,7 +1287,7 @@ public:
 		TypeMember(RangedReady);
 		TypeMember(AltTimerReady);
 		TypeMember(MaxEndurance);
-		TypeMember(PctEndurance);
+		TypeMemberFrameStable(PctEndurance);
 		TypeMember(AltAbility);
 		TypeMember(AltAbilityReady);
 		TypeMember(AltAbilityTimer);
@@ -2833,6 +2835,11 @@ public:
 		Param = 6,
 		CurLine = 7,
 		MemUse = 8,
+		EventQueue = 9,
+		EventsDropped = 10,
+		LinesPerFrame = 11,
+		TurboBudget = 12,
+		TurboOverruns = 13,
 	};
 	MQ2MacroType() :MQ2Type("macro")
 	{
@@ -2844,6 +2851,11 @@ public:
 		TypeMember(Param);
 		TypeMember(CurLine);
 		TypeMember(MemUse);
+		TypeMember(EventQueue);
+		TypeMember(EventsDropped);
+		TypeMember(LinesPerFrame);
+		TypeMember(TurboBudget);
+		TypeMember(TurboOverruns);
 	}
 
 	~MQ2MacroType()
@@ -3886,78 +3898,12 @@ public:
 	bool GETMEMBER();
 	DECLAREGETMETHOD();
 
-	bool ToString(MQ2VARPTR VarPtr, PCHAR Destination)
-	{
-		PMQTIMER pTimer = (PMQTIMER)VarPtr.Ptr;
-		_ultoa_s(pTimer->Current, Destination, MAX_STRING, 10);
-		return true;
-	}
-	void InitVariable(MQ2VARPTR &VarPtr)
-	{
-		if (PMQTIMER pVar = (PMQTIMER)malloc(sizeof(MQTIMER))) {
-			pVar->szName[0] = '\0';
-			pVar->Current = 0;
-			pVar->Original = 0;
-			pVar->pNext = gTimer;
-			pVar->pPrev = 0;
-			if (gTimer)
-				gTimer->pPrev = pVar;
-			gTimer = pVar;
-			VarPtr.Ptr = pVar;
-			VarPtr.HighPart = 0;
-		}
-	}
-	void FreeVariable(MQ2VARPTR &VarPtr)
-	{
-		if (PMQTIMER pVar = (PMQTIMER)VarPtr.Ptr) {
-			if (pVar->pPrev)
-				pVar->pPrev->pNext = pVar->pNext;
-			else
-				gTimer = pVar->pNext;
-			if (pVar->pNext)
-				pVar->pNext->pPrev = pVar->pPrev;
-			free(VarPtr.Ptr);
-		}
-	}
-#ifndef MQ2PLUGIN
-	bool FromData(MQ2VARPTR &VarPtr, MQ2TYPEVAR &Source)
-	{
-		PMQTIMER pTimer = (PMQTIMER)VarPtr.Ptr;
-		if (Source.Type == pFloatType)
-		{
-			pTimer->Current = (DWORD)Source.Float;
-			pTimer->Original = pTimer->Current;
-		}
-		else
-		{
-			pTimer->Current = Source.DWord;
-			pTimer->Original = pTimer->Current;
-		}
-		return true;
-	}
-#else
+	// these run the timer wheel in MQ2DataVars.cpp, see MQ2DataTypes.cpp
+	bool ToString(MQ2VARPTR VarPtr, PCHAR Destination);
+	void InitVariable(MQ2VARPTR &VarPtr);
+	void FreeVariable(MQ2VARPTR &VarPtr);
 	bool FromData(MQ2VARPTR &VarPtr, MQ2TYPEVAR &Source);
-#endif
-
-	bool FromString(MQ2VARPTR &VarPtr, PCHAR Source)
-	{
-		PMQTIMER pTimer = (PMQTIMER)VarPtr.Ptr;
-
-
-		FLOAT VarValue = (FLOAT)atof(Source);
-		switch (Source[strlen(Source) - 1])
-		{
-		case 'm':
-		case 'M':
-			VarValue *= 60;
-		case 's':
-		case 'S':
-			VarValue *= 10;
-		}
-		pTimer->Current = (DWORD)VarValue;
-		pTimer->Original = pTimer->Current;
-		return true;
-	}
+	bool FromString(MQ2VARPTR &VarPtr, PCHAR Source);
 };
 #ifndef ISXEQ
 class MQ2ArrayType : public MQ2Type
@@ -27,12 +27,53 @@ GNU General Public License for more details.
 
 
 
-map<string,PDATAVAR> VariableMap;
+// global and outer variables, by atom of the name
+std::unordered_map<DWORD,PDATAVAR> VariableMap;
+
+// locals and parameters, indexed by atom of the name.  Each slot holds the newest
+// one of that name in any frame, and it holds the one it hid in pHidden until it
+// goes away.  A sub only sees the one in the slot if it's in its own frame, so a
+// lookup is one index and one compare however deep the stack or many the locals.
+std::vector<PDATAVAR> FrameVariables;
+
+static VOID BindFrameVariable(PDATAVAR pVar)
+{
+    if (pVar->Atom>=FrameVariables.size())
+        FrameVariables.resize(pVar->Atom+0x100);
+    pVar->pHidden=FrameVariables[pVar->Atom];
+    FrameVariables[pVar->Atom]=pVar;
+}
+
+static VOID UnbindFrameVariable(PDATAVAR pVar)
+{
+    if (pVar->Atom>=FrameVariables.size())
+        return;
+    // frames go away newest first, so this is nearly always the one in the slot
+    PDATAVAR *ppSlot=&FrameVariables[pVar->Atom];
+    while (*ppSlot)
+    {
+        if (*ppSlot==pVar)
+        {
+            *ppSlot=pVar->pHidden;
+            return;
+        }
+        ppSlot=&(*ppSlot)->pHidden;
+    }
+}
+
+static inline BOOL InCurrentFrame(PDATAVAR *ppHead)
+{
+    return gMacroStack && (ppHead==&gMacroStack->LocalVariables || ppHead==&gMacroStack->Parameters);
+}
 
 inline VOID DeleteMQ2DataVariable(PDATAVAR pVar)
 {
-    if (pVar->ppHead==&pMacroVariables || pVar->ppHead==&pGlobalVariables)
-        VariableMap[pVar->szName]=0;
+    gVariableGeneration++;
+    auto iter=VariableMap.find(pVar->Atom);
+    if (iter!=VariableMap.end() && iter->second==pVar)
+        VariableMap.erase(iter);
+    else
+        UnbindFrameVariable(pVar);
     if (pVar->pNext)
         pVar->pNext->pPrev=pVar->pPrev;
     if (pVar->pPrev)
@@ -43,32 +84,38 @@ inline VOID DeleteMQ2DataVariable(PDATAVAR pVar)
     delete pVar;
 }
 
-inline PDATAVAR FindMQ2DataVariable(PCHAR Name)
+PDATAVAR FindMQ2DataVariableByAtom(DWORD Atom)
 {
-    PDATAVAR pFind=VariableMap[Name];
-    if (pFind)
-        return pFind;
+    auto iter=VariableMap.find(Atom);
+    if (iter!=VariableMap.end())
+        return iter->second;
     // local?
-    if (gMacroStack)
+    if (gMacroStack && Atom<FrameVariables.size())
     {
-        PDATAVAR pVar=gMacroStack->Parameters;
-        while(pVar)
-        {
-            if (!strcmp(pVar->szName,Name))
-                return pVar;
-            pVar=pVar->pNext;
-        }
-        pVar=gMacroStack->LocalVariables;
-        while(pVar)
-        {
-            if (!strcmp(pVar->szName,Name))
-                return pVar;
-            pVar=pVar->pNext;
-        }
+        PDATAVAR pVar=FrameVariables[Atom];
+        if (pVar && InCurrentFrame(pVar->ppHead))
+            return pVar;
     }
     return 0;
 }
 
+inline PDATAVAR FindMQ2DataVariable(PCHAR Name)
+{
+    // a name that was never interned can't be a variable
+    DWORD Atom=FindMQ2Atom(Name);
+    if (!Atom)
+        return 0;
+    return FindMQ2DataVariableByAtom(Atom);
+}
+
+// every write of a variable's value goes through here, so a /delay condition or a Blech
+// print variable waiting on gVariableGeneration sees it
+BOOL SetMQ2DataVariable(MQ2Type *pType, MQ2VARPTR &VarPtr, PCHAR szValue)
+{
+    gVariableGeneration++;
+    return pType->FromString(VarPtr,szValue);
+}
+
 BOOL AddMQ2DataEventVariable(PCHAR Name, PCHAR Index, MQ2Type *pType, PDATAVAR *ppHead, PCHAR Default)
 {
     if (!ppHead || !Name[0])
@@ -90,7 +137,9 @@ BOOL AddMQ2DataEventVariable(PCHAR Name, PCHAR Index, MQ2Type *pType, PDATAVAR *
     pVar->pPrev=0;
     if (pVar->pNext)
         pVar->pNext->pPrev=pVar;
-    strcpy_s(pVar->szName,Name);
+    pVar->Atom=AddMQ2Atom(Name);
+    pVar->szName=GetMQ2AtomName(pVar->Atom);
+    pVar->pHidden=0;
     if (Index[0])
     {
         CDataArray *pArray=new CDataArray(pType,Index,Default);
@@ -101,11 +150,11 @@ BOOL AddMQ2DataEventVariable(PCHAR Name, PCHAR Index, MQ2Type *pType, PDATAVAR *
     {
         pVar->Var.Type=pType;
         pType->InitVariable(pVar->Var.VarPtr);
-        pType->FromString(pVar->Var.VarPtr,Default);
+        SetMQ2DataVariable(pType,pVar->Var.VarPtr,Default);
     }
     if (pVar->ppHead==&pMacroVariables || pVar->ppHead==&pGlobalVariables)
     {
-        VariableMap[Name]=pVar;
+        VariableMap[pVar->Atom]=pVar;
     }
     return TRUE;
 }
@@ -132,7 +181,9 @@ BOOL AddMQ2DataVariableBy(PCHAR Name, PCHAR Index, MQ2Type *pType, PDATAVAR *ppH
     pVar->pPrev=0;
     if (pVar->pNext)
         pVar->pNext->pPrev=pVar;
-    strcpy_s(pVar->szName,Name);
+    pVar->Atom=AddMQ2Atom(Name);
+    pVar->szName=GetMQ2AtomName(pVar->Atom);
+    pVar->pHidden=0;
     if (Index[0])
     {
         CDataArray *pArray=new CDataArray(pType,Index,Default);
@@ -146,12 +197,13 @@ BOOL AddMQ2DataVariableBy(PCHAR Name, PCHAR Index, MQ2Type *pType, PDATAVAR *ppH
         if (ByData)
             pType->FromData(pVar->Var.VarPtr,*(MQ2TYPEVAR *)Default);
         else
-            pType->FromString(pVar->Var.VarPtr,Default);
-    }
-    if (!(gMacroStack && (ppHead==&gMacroStack->LocalVariables || ppHead==&gMacroStack->Parameters)))
-    {
-        VariableMap[Name]=pVar;
+            SetMQ2DataVariable(pType,pVar->Var.VarPtr,Default);
     }
+    if (InCurrentFrame(ppHead))
+        BindFrameVariable(pVar);
+    else
+        VariableMap[pVar->Atom]=pVar;
+    gVariableGeneration++;
     return TRUE;
 }
 
@@ -189,6 +241,23 @@ BOOL DeleteMQ2DataVariable(PCHAR Name)
     return FALSE;
 }
 
+// hands the parameters made for an event over to the frame its sub runs in
+VOID MoveMQ2DataVariables(PDATAVAR *ppFrom, PDATAVAR *ppTo)
+{
+    gVariableGeneration++;
+    *ppTo=*ppFrom;
+    *ppFrom=0;
+    PDATAVAR pLast=0;
+    for (PDATAVAR pVar=*ppTo ; pVar ; pVar=pVar->pNext)
+    {
+        pVar->ppHead=ppTo;
+        pLast=pVar;
+    }
+    // oldest first, so a repeated name finds the newest like a walk of the list would
+    for (PDATAVAR pVar=pLast ; pVar ; pVar=pVar->pPrev)
+        BindFrameVariable(pVar);
+}
+
 VOID ClearMQ2DataVariables(PDATAVAR *ppHead)
 {
     PDATAVAR pVar=*ppHead;
@@ -341,14 +410,14 @@ VOID NewVarset(PSPAWNINFO pChar, PCHAR szLine)
             MacroError("/varset '%s[%d]' failed, out of bounds on array",szName,N);
             return;
         }
-        if (!pArray->pType->FromString(pArray->pData[N],szRest))
+        if (!SetMQ2DataVariable(pArray->pType,pArray->pData[N],szRest))
         {
             MacroError("/varset '%s[%d]' failed, array element type rejected new value",szName,N);
         }
     }
     else
     {
-        if (!pVar->Var.Type->FromString(pVar->Var.VarPtr,szRest))
+        if (!SetMQ2DataVariable(pVar->Var.Type,pVar->Var.VarPtr,szRest))
         {
             MacroError("/varset '%s' failed, variable type rejected new value",szName);
         }
@@ -372,13 +441,41 @@ VOID NewVarcalc(PSPAWNINFO pChar, PCHAR szLine)
     }
 	CHAR szRest[MAX_STRING] = { 0 };
 	strcpy_s(szRest, pRest);
-    DOUBLE Result = 0.0;
-    if (!Calculate(szRest,Result))
+
+    // an int64 gets the calculator's exact integers, doubles would round it past 2^53
+    MQ2Type *pTargetType=0;
+    CHAR szTarget[MAX_STRING]={0};
+    strcpy_s(szTarget,szName);
+    PCHAR pTargetBracket=strchr(szTarget,'[');
+    if (pTargetBracket)
+        *pTargetBracket=0;
+    if (PDATAVAR pTarget=FindMQ2DataVariable(szTarget))
     {
-        MacroError("/varcalc '%s' failed.  Could not calculate '%s'",szName,szRest);
-        return;
+        if (pTargetBracket && pTarget->Var.Type==pArrayType)
+            pTargetType=((CDataArray*)pTarget->Var.Ptr)->pType;
+        else
+            pTargetType=pTarget->Var.Type;
+    }
+    if (pTargetType==pInt64Type)
+    {
+        __int64 Result = 0;
+        if (!CalculateInt64(szRest,Result))
+        {
+            MacroError("/varcalc '%s' failed.  Could not calculate '%s'",szName,szRest);
+            return;
+        }
+        _i64toa_s(Result,szRest,sizeof(szRest),10);
+    }
+    else
+    {
+        DOUBLE Result = 0.0;
+        if (!Calculate(szRest,Result))
+        {
+            MacroError("/varcalc '%s' failed.  Could not calculate '%s'",szName,szRest);
+            return;
+        }
+        sprintf_s(szRest,"%f",Result);
     }
-    sprintf_s(szRest,"%f",Result);
 
 
     CHAR szIndex[MAX_STRING]={0};
@@ -407,14 +504,14 @@ VOID NewVarcalc(PSPAWNINFO pChar, PCHAR szLine)
             MacroError("/varcalc '%s[%d]' failed, out of bounds on array",szName,N);
             return;
         }
-        if (!pArray->pType->FromString(pArray->pData[N],szRest))
+        if (!SetMQ2DataVariable(pArray->pType,pArray->pData[N],szRest))
         {
             MacroError("/varcalc '%s[%d]' failed, array element type rejected new value",szName,N);
         }
     }
     else
     {
-        if (!pVar->Var.Type->FromString(pVar->Var.VarPtr,szRest))
+        if (!SetMQ2DataVariable(pVar->Var.Type,pVar->Var.VarPtr,szRest))
         {
             MacroError("/varcalc '%s' failed, variable type rejected new value",szName);
         }
@@ -448,6 +545,7 @@ VOID NewVardata(PSPAWNINFO pChar, PCHAR szLine)
 		MacroError("/vardata '%s' failed, variable not found", szName);
 		return;
 	}
+	gVariableGeneration++;
 	MQ2TYPEVAR Result = { 0 };
 	if (!ParseMQ2DataPortion(szRest, Result))
 	{
@@ -483,63 +581,183 @@ VOID NewVardata(PSPAWNINFO pChar, PCHAR szLine)
 	}
 }
 
+// Event queue
+//
+// gEventQueue holds every queued event in the order it arrived, and each event is also
+// linked into the bucket of the sub it runs (keyed by the lowercased "sub event_name"
+// /doevents compares against), so queueing, /doevents and /doevents [flush] name never
+// walk the whole queue.  Finished events go back to a small pool.
+static PEVENTQUEUE gEventQueueTail = NULL;
+static std::unordered_map<std::string, EVENTBUCKET> EventBuckets;
+#define EVENTQUEUE_POOL_SIZE 256
+static std::vector<PEVENTQUEUE> EventQueuePool;
+
+static std::string EventBucketKey(PCHAR szSubName)
+{
+    std::string Key(szSubName);
+    for (auto &c : Key)
+        c = (CHAR)tolower((unsigned char)c);
+    return Key;
+}
+
+// NULL when the queue is full, the event is counted as dropped
+static PEVENTQUEUE NewMacroEvent(DWORD Type, PEVENTLIST pEList)
+{
+    if (gMaxEventQueue && gEventQueueSize >= gMaxEventQueue) {
+        if (!gEventsDropped++)
+            WriteChatf("\arMacro event queue is full (MaxEventQueue=%d), events are being dropped.",gMaxEventQueue);
+        return NULL;
+    }
+    PEVENTQUEUE pEvent;
+    if (EventQueuePool.size()) {
+        pEvent = EventQueuePool.back();
+        EventQueuePool.pop_back();
+    } else {
+        pEvent = new EVENTQUEUE;
+    }
+    pEvent->pPrev = NULL;
+    pEvent->pNext = NULL;
+    pEvent->Type = Type;
+    pEvent->Name.clear();
+    pEvent->pEventList = pEList;
+    pEvent->Parameters = NULL;
+    pEvent->pBucket = NULL;
+    pEvent->pPrevInBucket = NULL;
+    pEvent->pNextInBucket = NULL;
+    return pEvent;
+}
+
+static VOID QueueMacroEvent(PEVENTQUEUE pEvent)
+{
+    pEvent->pPrev = gEventQueueTail;
+    if (gEventQueueTail)
+        gEventQueueTail->pNext = pEvent;
+    else
+        gEventQueue = pEvent;
+    gEventQueueTail = pEvent;
+    gEventQueueSize++;
+
+    PCHAR szSubName = NULL;
+    if (pEvent->Type == EVENT_CHAT)
+        szSubName = "Sub Event_Chat";
+    else if (pEvent->Type == EVENT_TIMER)
+        szSubName = "Sub Event_Timer";
+    else if (pEvent->Type == EVENT_CUSTOM && pEvent->pEventList)
+        szSubName = pEvent->pEventList->szName;
+    if (!szSubName)
+        return;
+    PEVENTBUCKET pBucket = &EventBuckets[EventBucketKey(szSubName)];
+    pEvent->pBucket = pBucket;
+    pEvent->pPrevInBucket = pBucket->pTail;
+    if (pBucket->pTail)
+        pBucket->pTail->pNextInBucket = pEvent;
+    else
+        pBucket->pHead = pEvent;
+    pBucket->pTail = pEvent;
+}
+
+// the oldest event queued for szSubName ("Sub Event_Name"), or the oldest of all if it's NULL
+PEVENTQUEUE FindMacroEvent(PCHAR szSubName)
+{
+    if (!szSubName)
+        return gEventQueue;
+    auto iter = EventBuckets.find(EventBucketKey(szSubName));
+    if (iter == EventBuckets.end())
+        return NULL;
+    return iter->second.pHead;
+}
+
+// takes pEvent off the queue, it's still the caller's to free
+VOID RemoveMacroEvent(PEVENTQUEUE pEvent)
+{
+    if (pEvent->pPrev)
+        pEvent->pPrev->pNext = pEvent->pNext;
+    else
+        gEventQueue = pEvent->pNext;
+    if (pEvent->pNext)
+        pEvent->pNext->pPrev = pEvent->pPrev;
+    else
+        gEventQueueTail = pEvent->pPrev;
+    pEvent->pPrev = pEvent->pNext = NULL;
+    gEventQueueSize--;
+    if (PEVENTBUCKET pBucket = pEvent->pBucket) {
+        if (pEvent->pPrevInBucket)
+            pEvent->pPrevInBucket->pNextInBucket = pEvent->pNextInBucket;
+        else
+            pBucket->pHead = pEvent->pNextInBucket;
+        if (pEvent->pNextInBucket)
+            pEvent->pNextInBucket->pPrevInBucket = pEvent->pPrevInBucket;
+        else
+            pBucket->pTail = pEvent->pPrevInBucket;
+        pEvent->pBucket = NULL;
+        pEvent->pPrevInBucket = pEvent->pNextInBucket = NULL;
+    }
+}
+
+VOID FreeMacroEvent(PEVENTQUEUE pEvent)
+{
+    ClearMQ2DataVariables(&pEvent->Parameters);
+    if (EventQueuePool.size() < EVENTQUEUE_POOL_SIZE)
+        EventQueuePool.push_back(pEvent);
+    else
+        delete pEvent;
+}
+
+// drops the events queued for szSubName, or all of them if it's NULL
+VOID FlushMacroEvents(PCHAR szSubName)
+{
+    if (!szSubName) {
+        while (PEVENTQUEUE pEvent = gEventQueue) {
+            DebugSpewNoFile("FlushMacroEvents: Deleting gEventQueue %d %s", pEvent->Type, pEvent->Name.c_str());
+            RemoveMacroEvent(pEvent);
+            FreeMacroEvent(pEvent);
+        }
+        EventBuckets.clear();
+        return;
+    }
+    while (PEVENTQUEUE pEvent = FindMacroEvent(szSubName)) {
+        DebugSpewNoFile("FlushMacroEvents: Deleting pEvent %d %s", pEvent->Type, pEvent->Name.c_str());
+        RemoveMacroEvent(pEvent);
+        FreeMacroEvent(pEvent);
+    }
+}
+
 VOID AddEvent(DWORD Event, PCHAR FirstArg, ...)
 { 
     PEVENTQUEUE pEvent = NULL; 
     if (!gEventFunc[Event]) 
         return; 
-	//this is deleted in 2 locations DoEvents and EndMacro
+	//this is freed in DoEvents and FlushMacroEvents
 	DebugSpewNoFile("Adding Event %d %s", Event, FirstArg);
-	pEvent = new EVENTQUEUE;
+	pEvent = NewMacroEvent(Event, NULL);
     if (!pEvent) 
         return;
-	pEvent->Parameters = 0;
-	pEvent->pEventList = 0;
-	pEvent->pNext = 0;
-	pEvent->pPrev = 0;
-	pEvent->Type = 0;
-    //ZeroMemory(pEvent,sizeof(EVENTQUEUE)); 
-	pEvent->Name = FirstArg;
-    pEvent->Type = Event; 
-    pEvent->pEventList = NULL; 
+	if (FirstArg)
+		pEvent->Name = FirstArg;
     if (FirstArg) {
         va_list marker;
         DWORD i=0;
         PCHAR CurrentArg = FirstArg;
         va_start(marker, FirstArg);
 
+        CHAR szParamName[MAX_STRING];
         while (CurrentArg) 
         {
-            CHAR szParamName[MAX_STRING] = {0};
-            CHAR szParamType[MAX_STRING] = {0};
-            GetFuncParam((PCHAR)gEventFunc[Event]->Line.c_str(),i,szParamName, MAX_STRING,szParamType, MAX_STRING);
-            MQ2Type *pType = FindMQ2DataType(szParamType);
-            if (!pType)
-                pType=pStringType;
-            AddMQ2DataEventVariable(szParamName,"",pType,&pEvent->Parameters,CurrentArg);
+            MQ2Type *pType;
+            PCHAR pParamName = GetSubParam(gEventFunc[Event],i,szParamName,MAX_STRING,pType);
+            AddMQ2DataEventVariable(pParamName,"",pType,&pEvent->Parameters,CurrentArg);
             i++;
             CurrentArg = va_arg(marker,PCHAR);
         }
         va_end(marker);
     }
-
-    if (!gEventQueue) 
-    { 
-        gEventQueue = pEvent; 
-    } 
-    else 
-    { 
-        PEVENTQUEUE pTemp = NULL; 
-        for (pTemp = gEventQueue;pTemp->pNext;pTemp=pTemp->pNext); 
-        pTemp->pNext = pEvent; 
-        pEvent->pPrev=pTemp;
-    } 
+    QueueMacroEvent(pEvent);
 } 
 
 #ifdef USEBLECHEVENTS
-void __stdcall EventBlechCallback(unsigned int ID, void * pData, PBLECHVALUE pValues)
+void __stdcall EventBlechCallback(unsigned int ID, void * pData, const char *Input, PBLECHCAPTURE pCaptures, unsigned int nCaptures)
 {
-    DebugSpew("EventBlechCallback(%d,%X,%X) msg='%s'",ID,pData,pValues,EventMsg);
+    DebugSpew("EventBlechCallback(%d,%X,%d) msg='%s'",ID,pData,nCaptures,Input);
     PEVENTLIST pEList=(PEVENTLIST)pData;
     PEVENTQUEUE pEvent = NULL;
     if (!pEList->pEventFunc) 
@@ -547,57 +765,33 @@ void __stdcall EventBlechCallback(unsigned int ID, void * pData, PBLECHVALUE pVa
         DebugSpew("EventBlechCallback() -- pEventFunc is NULL, cannot call event sub");
         return;
     }
-    pEvent = (PEVENTQUEUE)malloc(sizeof(EVENTQUEUE));
+    pEvent = NewMacroEvent(EVENT_CUSTOM, pEList);
     if (!pEvent) 
         return;
-    ZeroMemory(pEvent,sizeof(EVENTQUEUE));
-    pEvent->Type = EVENT_CUSTOM;
-    pEvent->pEventList = pEList;
-    CHAR szParamName[MAX_STRING] = {0};
-    CHAR szParamType[MAX_STRING] = {0};
-    GetFuncParam((PCHAR)pEList->pEventFunc->Line.c_str(),0,szParamName, MAX_STRING,szParamType, MAX_STRING);
-    MQ2Type *pType = FindMQ2DataType(szParamType);
-    if (!pType)
-        pType=pStringType;
+    CHAR szParamName[MAX_STRING];
+    MQ2Type *pType;
+    PCHAR pParamName = GetSubParam(pEList->pEventFunc,0,szParamName,MAX_STRING,pType);
 
-    AddMQ2DataEventVariable(szParamName,"",pType,&pEvent->Parameters,EventMsg);
-    DWORD nParam=1;
-    while(pValues)
+    AddMQ2DataEventVariable(pParamName,"",pType,&pEvent->Parameters,(PCHAR)Input);
+    CHAR szValue[MAX_STRING];
+    for (unsigned int N = 0; N < nCaptures; N++)
     {
-        if (pValues->Name[0]!='*')
+        if (pCaptures[N].Name[0]!='*')
         {
-            GetFuncParam((PCHAR)pEList->pEventFunc->Line.c_str(),atoi(pValues->Name),szParamName, MAX_STRING,szParamType, MAX_STRING);
-            MQ2Type *pType = FindMQ2DataType(szParamType);
-            if (!pType)
-                pType=pStringType;
-            AddMQ2DataEventVariable(szParamName,"",pType,&pEvent->Parameters,pValues->Value);    
+            pParamName = GetSubParam(pEList->pEventFunc,atoi(pCaptures[N].Name),szParamName,MAX_STRING,pType);
+            strncpy_s(szValue,&Input[pCaptures[N].Offset],min(pCaptures[N].Length,(unsigned int)MAX_STRING-1));
+            AddMQ2DataEventVariable(pParamName,"",pType,&pEvent->Parameters,szValue);
         }
-        pValues=pValues->pNext;
-    }
-
-    if (!gEventQueue) 
-    {
-        gEventQueue = pEvent;
-    } 
-    else 
-    {
-        PEVENTQUEUE pTemp;
-        for (pTemp = gEventQueue;pTemp->pNext;pTemp=pTemp->pNext);
-        pTemp->pNext = pEvent;
-        pEvent->pPrev=pTemp;
     }
-
+    QueueMacroEvent(pEvent);
 }
 #else
 VOID AddCustomEvent(PEVENTLIST pEList, PCHAR szLine)
 {
     PEVENTQUEUE pEvent = NULL;
     if (!pEList->pEventFunc) return;
-    pEvent = (PEVENTQUEUE)malloc(sizeof(EVENTQUEUE));
+    pEvent = NewMacroEvent(EVENT_CUSTOM, pEList);
     if (!pEvent) return;
-    ZeroMemory(pEvent,sizeof(EVENTQUEUE));
-    pEvent->Type = EVENT_CUSTOM;
-    pEvent->pEventList = pEList;
     CHAR szParamName[MAX_STRING] = {0};
     CHAR szParamType[MAX_STRING] = {0};
     GetFuncParam(pEList->pEventFunc->Line,0,szParamName,szParamType);
@@ -606,18 +800,7 @@ VOID AddCustomEvent(PEVENTLIST pEList, PCHAR szLine)
         pType=pStringType;
 
     AddMQ2DataEventVariable(szParamName,"",pType,&pEvent->Parameters,szLine);
-
-    if (!gEventQueue) 
-    {
-        gEventQueue = pEvent;
-    } 
-    else 
-    {
-        PEVENTQUEUE pTemp;
-        for (pTemp = gEventQueue;pTemp->pNext;pTemp=pTemp->pNext);
-        pTemp->pNext = pEvent;
-        pEvent->pPrev=pTemp;
-    }
+    QueueMacroEvent(pEvent);
 }
 #endif
 #ifndef SafeXLoc
@@ -810,9 +993,7 @@ VOID CheckChatForEvent(PCHAR szMsg)
 			} 
 		#else // blech
 			}
-			strcpy_s(EventMsg,szClean);
-			pEventBlech->Feed(EventMsg);
-			EventMsg[0] = '\0';
+			pEventBlech->Feed(szClean,MAX_STRING);
 		#endif
 		}
 		if (szClean != pszCleanOrg) {
@@ -825,22 +1006,104 @@ VOID CheckChatForEvent(PCHAR szMsg)
 	}
 }
 
+// Timer wheel
+//
+// A running timer sits in one slot of a hierarchical timing wheel: level 0 has a slot
+// for each of the next 64 ticks, level 1 a slot for each of the next 64 spans of 64
+// ticks, and so on, enough levels to reach any ULONG.  Each tick only looks at the one
+// level 0 slot that's due, and every 64 ticks spreads the next level 1 slot out over
+// level 0 (and so on up), so arming, stopping and waiting are all constant time no
+// matter how many timers a macro keeps.
+#define TIMER_WHEEL_BITS   6
+#define TIMER_WHEEL_SIZE   (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK   (TIMER_WHEEL_SIZE - 1)
+#define TIMER_WHEEL_LEVELS 6
+static PMQTIMER TimerWheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE] = { 0 };
+// the last tick DropTimers ran, timers count down against it
+static unsigned __int64 gTimerTick = 0;
+
+static VOID InsertTimer(PMQTIMER pTimer)
+{
+    // the next tick to run is gTimerTick+1
+    unsigned __int64 Base = gTimerTick + 1;
+    unsigned __int64 Delta = pTimer->Deadline - Base;
+    int Level = 0;
+    while (Level < TIMER_WHEEL_LEVELS - 1 && Delta >= ((unsigned __int64)1 << (TIMER_WHEEL_BITS * (Level + 1))))
+        Level++;
+    PMQTIMER *ppSlot = &TimerWheel[Level][(pTimer->Deadline >> (TIMER_WHEEL_BITS * Level)) & TIMER_WHEEL_MASK];
+    pTimer->ppSlot = ppSlot;
+    pTimer->pPrevInSlot = 0;
+    pTimer->pNextInSlot = *ppSlot;
+    if (*ppSlot)
+        (*ppSlot)->pPrevInSlot = pTimer;
+    *ppSlot = pTimer;
+}
+
+static VOID UnlinkTimer(PMQTIMER pTimer)
+{
+    if (!pTimer->ppSlot)
+        return;
+    if (pTimer->pPrevInSlot)
+        pTimer->pPrevInSlot->pNextInSlot = pTimer->pNextInSlot;
+    else
+        *pTimer->ppSlot = pTimer->pNextInSlot;
+    if (pTimer->pNextInSlot)
+        pTimer->pNextInSlot->pPrevInSlot = pTimer->pPrevInSlot;
+    pTimer->ppSlot = 0;
+    pTimer->pNextInSlot = pTimer->pPrevInSlot = 0;
+}
+
+// (re)starts pTimer to fire Ticks ticks from now, or stops it if Ticks is 0
+VOID SetMQ2Timer(PMQTIMER pTimer, ULONG Ticks)
+{
+    UnlinkTimer(pTimer);
+    if (!Ticks) {
+        pTimer->Deadline = 0;
+        return;
+    }
+    pTimer->Deadline = gTimerTick + Ticks;
+    InsertTimer(pTimer);
+}
+
+// ticks left before pTimer fires, 0 if it isn't running
+ULONG GetMQ2TimerValue(PMQTIMER pTimer)
+{
+    if (!pTimer->Deadline)
+        return 0;
+    return (ULONG)(pTimer->Deadline - gTimerTick);
+}
+
+// moves the timers in a higher level slot down to where they belong now
+static int CascadeTimers(int Level, int Index)
+{
+    PMQTIMER pTimer = TimerWheel[Level][Index];
+    TimerWheel[Level][Index] = 0;
+    while (pTimer) {
+        PMQTIMER pNext = pTimer->pNextInSlot;
+        InsertTimer(pTimer);
+        pTimer = pNext;
+    }
+    return Index;
+}
+
+// runs one 100ms tick, called from Heartbeat
 VOID DropTimers(VOID)
 {
-    PMQTIMER pTimer=gTimer;
-    CHAR szOrig[MAX_STRING] = {0};
-    while(pTimer)
-    {
-        if (pTimer->Current)
-        {
-            pTimer->Current--;
-            if (!pTimer->Current)
-            {
-                _itoa_s(pTimer->Original,szOrig,10);
-                AddEvent(EVENT_TIMER,pTimer->szName,szOrig,NULL);
-            }
+    unsigned __int64 Base = gTimerTick + 1;
+    int Index = (int)(Base & TIMER_WHEEL_MASK);
+    if (!Index) {
+        for (int Level = 1; Level < TIMER_WHEEL_LEVELS; Level++) {
+            if (CascadeTimers(Level, (int)((Base >> (TIMER_WHEEL_BITS * Level)) & TIMER_WHEEL_MASK)))
+                break;
         }
-        pTimer=pTimer->pNext;
+    }
+    gTimerTick = Base;
+    CHAR szOrig[MAX_STRING] = {0};
+    while (PMQTIMER pTimer = TimerWheel[0][Index]) {
+        UnlinkTimer(pTimer);
+        pTimer->Deadline = 0;
+        _itoa_s(pTimer->Original,szOrig,10);
+        AddEvent(EVENT_TIMER,pTimer->szName,szOrig,NULL);
     }
 }
 
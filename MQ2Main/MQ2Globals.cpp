@@ -318,6 +318,9 @@ namespace MQ2Globals
 	PMACROSTACK gMacroStack = NULL;
 	map<string, PMACROBLOCK> gMacroSubLookupMap;
 	PEVENTQUEUE gEventQueue = NULL;
+	DWORD gEventQueueSize = 0;
+	DWORD gMaxEventQueue = 0;       // 0 for no cap, MaxEventQueue in MacroQuest.ini
+	DWORD gEventsDropped = 0;
 	PMACROBLOCK gEventFunc[NUM_EVENTS] = { NULL };
 #endif
 	UCHAR gLastFind = 0;
@@ -367,6 +370,10 @@ namespace MQ2Globals
 	ULONGLONG gRunning = 0;
 	BOOL gbMoving = FALSE;
 	DWORD gMaxTurbo = 10;
+	DWORD gTurboBudget = 0;
+	DWORD gTurboFrameBudget = 0;
+	FLOAT gTurboLinesPerFrame = 0.0f;
+	DWORD gTurboOverruns = 0;
 	BOOL gReturn = TRUE;
 	BOOL gInClick = FALSE;
 	DWORD gbAssistComplete = 0;
@@ -408,6 +415,8 @@ namespace MQ2Globals
 	PMQTIMER gTimer = NULL;
 	LONG gDelay = 0;
 	CHAR gDelayCondition[MAX_STRING] = { 0 };
+	DWORD gDelayPollInterval = 0;
+	DWORD gVariableGeneration = 1;
 	BOOL bAllowCommandParse = TRUE;
 	LONG gDelayZoning = 0;
 	std::map<DWORD, std::list<SEARCHSPAWN>> gAlertMap;
@@ -421,6 +430,8 @@ namespace MQ2Globals
 	PITEMDB gItemDB = NULL;
 	BOOL bRunNextCommand = FALSE;
 	BOOL gTurbo = FALSE;
+	DWORD gFrameGeneration = 1;
+	DWORD gDataTypeGeneration = 1;
 	PDEFINE pDefines = NULL;
     PBINDLIST pBindList = NULL;
 	CHAR gLastFindSlot[MAX_STRING] = { 0 };
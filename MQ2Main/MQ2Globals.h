@@ -79,6 +79,9 @@ namespace MQ2Globals
 	LEGACY_VAR PMACROSTACK gMacroStack;
 	LEGACY_VAR map<string, PMACROBLOCK> gMacroSubLookupMap;
 	LEGACY_VAR PEVENTQUEUE gEventQueue;
+	EQLIB_VAR DWORD gEventQueueSize;
+	EQLIB_VAR DWORD gMaxEventQueue;
+	EQLIB_VAR DWORD gEventsDropped;
 	LEGACY_VAR PMACROBLOCK gEventFunc[NUM_EVENTS];
 #endif
 	EQLIB_VAR UCHAR gLastFind;
@@ -112,6 +115,10 @@ namespace MQ2Globals
 	EQLIB_VAR ULONGLONG gRunning;
 	EQLIB_VAR BOOL gbMoving;
 	EQLIB_VAR DWORD gMaxTurbo;
+	EQLIB_VAR DWORD gTurboBudget;
+	EQLIB_VAR DWORD gTurboFrameBudget;
+	EQLIB_VAR FLOAT gTurboLinesPerFrame;
+	EQLIB_VAR DWORD gTurboOverruns;
 	EQLIB_VAR BOOL gReturn;
 
 	EQLIB_VAR PCHATBUF gDelayedCommands;
@@ -172,6 +179,8 @@ namespace MQ2Globals
 	EQLIB_VAR PMQTIMER gTimer;
 	EQLIB_VAR LONG gDelay;
 	EQLIB_VAR CHAR gDelayCondition[MAX_STRING];
+	EQLIB_VAR DWORD gDelayPollInterval;
+	EQLIB_VAR DWORD gVariableGeneration;
 	EQLIB_VAR BOOL gMacroPause;
 	EQLIB_VAR SPAWNINFO EnviroTarget;
 	EQLIB_VAR SPAWNINFO PetSpawn;
@@ -183,6 +192,8 @@ namespace MQ2Globals
 	EQLIB_VAR BOOL bRunNextCommand;
 	EQLIB_VAR BOOL bAllowCommandParse;
 	EQLIB_VAR BOOL gTurbo;
+	EQLIB_VAR DWORD gFrameGeneration;
+	EQLIB_VAR DWORD gDataTypeGeneration;
 	EQLIB_VAR PDEFINE pDefines;
     EQLIB_VAR PBINDLIST pBindList;
 	//EQLIB_VAR CHAR gLastFindSlot[MAX_STRING];
@@ -213,26 +213,51 @@ namespace MQ2Internal {
         DWORD Y;
     } PACKLOC, *PPACKLOC;
 
+    class MQ2Type;
+
+    // a parameter in the signature of a Sub
+    typedef struct _SUBPARAM {
+        std::string Name;
+        std::string TypeName;
+        MQ2Type *pType;       // string when the type isn't known
+        DWORD TypeGeneration; // gDataTypeGeneration pType was looked up in
+    } SUBPARAM, *PSUBPARAM;
+
     typedef struct _MACROBLOCK {
         std::string Line;
         std::string SourceFile;
         DWORD LineNumber;
         BOOL MacroCmd;
-        DWORD LoopLine;//used for loops/while if its 0 no action is taken, otherwise it will jump to the line indicated. -eqmule
 #ifdef MQ2_PROFILING
         DWORD ExecutionCount;
         LONGLONG ExecutionTime;
 #endif
         struct _MACROBLOCK *pNext;
         struct _MACROBLOCK *pPrev;
+        // resolved once the whole macro is loaded, NULL when there's nothing to resolve
+        struct _MACROBLOCK *pSub;       // the Sub line this line is part of
+        struct _MACROBLOCK *pBlockEnd;  // for a line ending in {, the line with the } closing it
+        struct _MACROBLOCK *pChainEnd;  // like pBlockEnd, but past any } else { that follow
+        struct _MACROBLOCK *pLoopStart; // for /next, its /for
+        struct _MACROBLOCK *pLoopEnd;   // the /next that a /break or /continue here goes to
+        struct _MACROBLOCK *pLoopHead;  // for the } closing a /while ... {, its /while
+        // the command this line runs, resolved the first time it runs. stale once the
+        // command or alias tables change, see DoMacroLine
+        DWORD CommandGeneration;
+        struct _MQCOMMAND *pCommand;    // NULL when it isn't a plain MQ2 command
+        std::string Param;              // its parameters, after any alias was expanded
+        std::vector<SUBPARAM> SubParams;  // for a Sub line, its signature. see GetSubParam
     } MACROBLOCK, *PMACROBLOCK;
 
     typedef struct _MQTIMER {
         CHAR szName[MAX_VARNAME];
         ULONG Original;
-        ULONG Current;
+        unsigned __int64 Deadline;      // timer tick it fires on, 0 when stopped. see GetMQ2TimerValue
         struct _MQTIMER *pNext;
         struct _MQTIMER *pPrev;
+        struct _MQTIMER **ppSlot;       // timer wheel slot it's in, if running
+        struct _MQTIMER *pNextInSlot;
+        struct _MQTIMER *pPrevInSlot;
     } MQTIMER, *PMQTIMER;
 
     typedef struct _KEYPRESS {
@@ -786,11 +811,17 @@ namespace MQ2Internal {
         };
     } MQ2TYPEVAR, *PMQ2TYPEVAR;
 
+    // MQ2TYPEMEMBER::Flags
+    // the result doesn't change during a frame for the same object and index, and stays
+    // valid until the next one (a value, a game object or a string), so it can be reused
+    #define MEMBER_FRAMESTABLE 0x1
+
     typedef struct _MQ2TypeMember
     {
         DWORD ID;
         PCHAR Name;
 		DWORD Type;
+        DWORD Flags;
     } MQ2TYPEMEMBER, *PMQ2TYPEMEMBER;
 
     typedef BOOL  (__cdecl *fMQData)(PCHAR szIndex, MQ2TYPEVAR &Ret);
@@ -804,20 +835,108 @@ namespace MQ2Internal {
     LEGACY_API BOOL AddMQ2Type(class MQ2Type &Type);
     LEGACY_API BOOL RemoveMQ2Type(class MQ2Type &Type);
 
+    // interned names, see MQ2DataAPI.cpp. 0 is never a valid atom
+    LEGACY_API DWORD AddMQ2Atom(PCHAR Name);
+    LEGACY_API DWORD FindMQ2Atom(PCHAR Name);
+    LEGACY_API PCHAR GetMQ2AtomName(DWORD Atom);
+
+    // atom -> index table used for the members and methods of an MQ2Type.  Keyed
+    // directly on the atom, so a lookup is a mask and a compare in the usual case.
+    class CAtomIndex
+    {
+    public:
+        CAtomIndex()
+        {
+            Count=0;
+        }
+
+        bool Find(DWORD Atom, DWORD &Index) const
+        {
+            if (!Atom || Slots.empty())
+                return false;
+            size_t Mask=Slots.size()-1;
+            for (size_t N=Atom&Mask ; Slots[N].Atom ; N=(N+1)&Mask)
+            {
+                if (Slots[N].Atom==Atom)
+                {
+                    Index=Slots[N].Index;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void Set(DWORD Atom, DWORD Index)
+        {
+            if ((Count+1)*2>Slots.size())
+                Rebuild(Slots.size() ? Slots.size()*2 : 16, 0);
+            Insert(Atom,Index);
+        }
+
+        bool Remove(DWORD Atom)
+        {
+            DWORD Index;
+            if (!Find(Atom,Index))
+                return false;
+            Rebuild(Slots.size(),Atom);
+            return true;
+        }
+
+    private:
+        struct Slot
+        {
+            DWORD Atom;
+            DWORD Index;
+        };
+
+        void Insert(DWORD Atom, DWORD Index)
+        {
+            size_t Mask=Slots.size()-1;
+            size_t N=Atom&Mask;
+            while (Slots[N].Atom && Slots[N].Atom!=Atom)
+                N=(N+1)&Mask;
+            if (!Slots[N].Atom)
+                Count++;
+            Slots[N].Atom=Atom;
+            Slots[N].Index=Index;
+        }
+
+        void Rebuild(size_t Size, DWORD Skip)
+        {
+            std::vector<Slot> Old(Size);
+            Old.swap(Slots);
+            Count=0;
+            for (auto &OldSlot : Old)
+            {
+                if (OldSlot.Atom && OldSlot.Atom!=Skip)
+                    Insert(OldSlot.Atom,OldSlot.Index);
+            }
+        }
+
+        std::vector<Slot> Slots;
+        size_t Count;
+    };
+
     typedef struct _DATAVAR {
-        CHAR szName[MAX_STRING];
+        PCHAR szName; // interned, see AddMQ2Atom
+        DWORD Atom;
         MQ2TYPEVAR Var;
         struct _DATAVAR *pNext;
         struct _DATAVAR *pPrev;
         struct _DATAVAR **ppHead;
+        struct _DATAVAR *pHidden; // for a local or parameter, the one of the same name it hides
     } DATAVAR, *PDATAVAR;
 
+    // member IDs below this get a direct slot in MQ2Type::MemberIDs
+    #define MAX_MEMBERID 0x1000
+
     class MQ2Type
     {
     public:
         inline MQ2Type(PCHAR NewName)
         {
             strcpy_s(TypeName,NewName);
+            NameAtom=AddMQ2Atom(TypeName);
             Official=AddMQ2Type(*this);
             pInherits=0;
         }
@@ -856,9 +975,16 @@ namespace MQ2Internal {
         }
 
         inline PCHAR GetName() {return &TypeName[0];}
+        inline DWORD GetNameAtom() {return NameAtom;}
 
         PCHAR GetMemberName(DWORD ID)
         {
+            if (ID<MemberIDs.size())
+            {
+                if (PMQ2TYPEMEMBER pMember = MemberIDs[ID])
+                    return &pMember->Name[0];
+                return 0;
+            }
             for (unsigned long N=0 ; N < Members.Size ; N++)
             {
                 if (PMQ2TYPEMEMBER pMember = Members[N])
@@ -872,28 +998,28 @@ namespace MQ2Internal {
 
         BOOL GetMemberID(PCHAR Name, DWORD &Result)
         {
-            unsigned long N=MemberMap[Name];
-            if (N==0)
+            PMQ2TYPEMEMBER pMember = FindMember(Name);
+            if (!pMember)
                 return false;
-            N--;
-            PMQ2TYPEMEMBER pMember = Members[N];
             Result=pMember->ID;
             return true;
         }
         PMQ2TYPEMEMBER FindMember(PCHAR Name)
         {
-            unsigned long N=MemberMap[Name];
-            if (!N)
+            return FindMemberByAtom(FindMQ2Atom(Name));
+        }
+        PMQ2TYPEMEMBER FindMemberByAtom(DWORD Atom)
+        {
+            DWORD N;
+            if (!MemberMap.Find(Atom,N))
                 return 0;
-            N--;
             return Members[N];
         }
 		PMQ2TYPEMEMBER FindMethod(PCHAR Name)
         {
-            unsigned long N=MethodMap[Name];
-            if (!N)
+            DWORD N;
+            if (!MethodMap.Find(FindMQ2Atom(Name),N))
                 return 0;
-            N--;
             return Methods[N];
         }
         BOOL InheritedMember(PCHAR Name)
@@ -909,60 +1035,81 @@ namespace MQ2Internal {
 
     protected:
 
-        inline BOOL AddMember(DWORD ID, PCHAR Name)
+        inline BOOL AddMember(DWORD ID, PCHAR Name, DWORD Flags=0)
         {
-            unsigned long N=MemberMap[Name];
-            if (N>0)
+            DWORD N;
+            DWORD Atom=AddMQ2Atom(Name);
+            if (MemberMap.Find(Atom,N))
                 return false;
             N=Members.GetUnused();
-            MemberMap[Name]=N+1;
+            MemberMap.Set(Atom,N);
             PMQ2TYPEMEMBER pMember = new MQ2TYPEMEMBER;
-            pMember->Name=Name;
+            pMember->Name=GetMQ2AtomName(Atom);
             pMember->ID=ID;
 			pMember->Type = 0;
+            pMember->Flags=Flags;
             Members[N]=pMember;
+            if (ID<MAX_MEMBERID)
+            {
+                if (ID>=MemberIDs.size())
+                    MemberIDs.resize(ID+1);
+                if (!MemberIDs[ID])
+                    MemberIDs[ID]=pMember;
+            }
             return true;
         }
 		inline BOOL AddMethod(DWORD ID, PCHAR Name)
         {
-            unsigned long N=MethodMap[Name];
-            if (N>0)
+            DWORD N;
+            DWORD Atom=AddMQ2Atom(Name);
+            if (MethodMap.Find(Atom,N))
                 return false;
             N=Methods.GetUnused();
-            MethodMap[Name]=N+1;
+            MethodMap.Set(Atom,N);
             PMQ2TYPEMEMBER pMethod = new MQ2TYPEMEMBER;
-            pMethod->Name=Name;
+            pMethod->Name=GetMQ2AtomName(Atom);
             pMethod->ID=ID;
 			pMethod->Type = 1;
+            pMethod->Flags=0;
             Methods[N]=pMethod;
             return true;
         }
         inline BOOL RemoveMember(PCHAR Name)
         {
-            unsigned long N=MemberMap[Name];
-            if (N==0)
+            DWORD N;
+            DWORD Atom=FindMQ2Atom(Name);
+            if (!MemberMap.Find(Atom,N))
                 return false;
-            N--;
+            MemberMap.Remove(Atom);
             PMQ2TYPEMEMBER pMember = Members[N];
+            if (pMember->ID<MemberIDs.size() && MemberIDs[pMember->ID]==pMember)
+                MemberIDs[pMember->ID]=0;
             delete pMember;
             Members[N]=0;
+            return true;
         }
 		inline BOOL RemoveMethod(PCHAR Name)
         {
-            unsigned long N=MethodMap[Name];
-            if (N==0)
+            DWORD N;
+            DWORD Atom=FindMQ2Atom(Name);
+            if (!MethodMap.Find(Atom,N))
                 return false;
-            N--;
+            MethodMap.Remove(Atom);
             PMQ2TYPEMEMBER pMethod = Methods[N];
             delete pMethod;
             Methods[N]=0;
+            return true;
         }
         CHAR TypeName[32];
+        DWORD NameAtom;
         BOOL Official;
         CIndex<PMQ2TYPEMEMBER> Members;
         CIndex<PMQ2TYPEMEMBER> Methods;
-        map<string,DWORD> MemberMap;
-        map<string,DWORD> MethodMap;
+        // atom of the name -> index into Members/Methods
+        CAtomIndex MemberMap;
+        CAtomIndex MethodMap;
+        // member ID -> member, for GetMemberName
+        std::vector<PMQ2TYPEMEMBER> MemberIDs;
         MQ2Type *pInherits;
     };
 
@@ -1236,6 +1383,12 @@ namespace MQ2Internal {
         PDATAVAR LocalVariables;
     } MACROSTACK, *PMACROSTACK;
 
+    // the queued events of one event sub, oldest first
+    typedef struct _EVENTBUCKET {
+        struct _EVENTQUEUE *pHead;
+        struct _EVENTQUEUE *pTail;
+    } EVENTBUCKET, *PEVENTBUCKET;
+
     typedef struct _EVENTQUEUE {
         struct _EVENTQUEUE *pPrev;
         struct _EVENTQUEUE *pNext;
@@ -1243,6 +1396,9 @@ namespace MQ2Internal {
 		std::string Name;
         PEVENTLIST pEventList;
         PDATAVAR Parameters;
+        PEVENTBUCKET pBucket;               // NULL if /doevents can't name it
+        struct _EVENTQUEUE *pPrevInBucket;
+        struct _EVENTQUEUE *pNextInBucket;
     } EVENTQUEUE, *PEVENTQUEUE;
 #endif
 	typedef struct _MercDesc
@@ -19,42 +19,72 @@ GNU General Public License for more details.
 
 #define DBG_SPEW
 #define MAXTURBO 120
+#define DEFAULTTURBOBUDGET 2000
+#define MAXTURBOBUDGET 20000
 
 #ifdef ISXEQ_LEGACY
 #include "../ISXEQLegacy/ISXEQLegacy.h"
 #else
 #include "MQ2Main.h"
 #endif
+// Macro lines
+//
+// A macro is loaded into one deque, each line a MACROBLOCK chained onto gMacroBlock as it's
+// added, and the jump targets are resolved once the whole file is in (LinkMacroLines).
+// Lines never move once added and nothing is freed until EndMacro, so the pointers
+// AddMacroLine hands out, and /goto, /call, {} blocks and /for ... /next, reach their
+// targets without walking lines.
+static std::deque<MACROBLOCK> MacroLines;
+// labels by the Sub they're in, keyed "<address of the Sub line><label>" in lower case
+static std::unordered_map<std::string, PMACROBLOCK> MacroLabels;
+
+static std::string GetMacroLabelKey(PMACROBLOCK pSub, PCHAR szLabel)
+{
+    std::string Key = std::to_string((unsigned long long)(size_t)pSub);
+    Key += szLabel;
+    _strlwr_s(&Key[0], Key.size() + 1);
+    return Key;
+}
+
+// the line with the } that closes the block opened at the end of pStart. With All, } else {
+// lines don't end it and the whole if/else chain is skipped. Returns NULL after reporting
+// a block that doesn't close.
+static PMACROBLOCK FindBlockEnd(PMACROBLOCK pStart, BOOL All)
+{
+    if (PMACROBLOCK pEnd = All ? pStart->pChainEnd : pStart->pBlockEnd)
+        return pEnd;
+    // only a block that never closes isn't resolved, walk it to say why
+    DWORD Scope = 1;
+    PMACROBLOCK pBlock = pStart->pNext;
+    while (pBlock) {
+        if (pBlock->Line[0]=='}') Scope--;
+        if (All) if (pBlock->Line[pBlock->Line.size()-1]=='{') Scope++;
+        if (Scope==0)
+            return pBlock;
+        if (!All) if (pBlock->Line[pBlock->Line.size()-1]=='{') Scope++;
+        if (!_strnicmp(pBlock->Line.c_str(),"sub ",4)) {
+            gMacroBlock=pStart;
+            FatalError("{} pairing ran into anther subroutine");
+            return NULL;
+        }
+        pBlock = pBlock->pNext;
+    }
+    gMacroBlock=pStart;
+    FatalError("Bad {} block pairing");
+    return NULL;
+}
+
 VOID FailIf(PSPAWNINFO pChar, PCHAR szCommand, PMACROBLOCK pStartLine, BOOL All)
 {
-    DWORD Scope = 0;
     if (szCommand[strlen(szCommand)-1]=='{') {
         if (!gMacroBlock) {
             DebugSpewNoFile("FailIf - Macro was ended before we could handle the false if command");
             return;
         }
-        Scope++;
-        gMacroBlock = gMacroBlock->pNext;
-        while ((Scope>0)) {
-            if (gMacroBlock->Line[0]=='}') Scope--;
-            //if (All) if (gMacroBlock->Line[strlen(gMacroBlock->Line)-1]=='{') Scope++;
-            if (All) if (gMacroBlock->Line[gMacroBlock->Line.size()-1]=='{') Scope++;
-            if (Scope>0) {
-                //if (!All) if (gMacroBlock->Line[strlen(gMacroBlock->Line)-1]=='{') Scope++;
-                if (!All) if (gMacroBlock->Line[gMacroBlock->Line.size()-1]=='{') Scope++;
-                if (!_strnicmp(gMacroBlock->Line.c_str(),"sub ",4)) {
-                    gMacroBlock=pStartLine;
-                    FatalError("{} pairing ran into anther subroutine");
-                    return;
-                }
-                if (!gMacroBlock->pNext) {
-                    gMacroBlock=pStartLine;
-                    FatalError("Bad {} block pairing");
-                    return;
-                }
-                gMacroBlock = gMacroBlock->pNext;
-            }
-        }
+        PMACROBLOCK pEnd = FindBlockEnd(gMacroBlock, All);
+        if (!pEnd)
+            return;
+        gMacroBlock = pEnd;
         if ((!All) && (!_strnicmp(gMacroBlock->Line.c_str(),"} else ",7))) {
             //DoCommand(pChar,gMacroBlock->Line+7);
             DoCommand(pChar,(PCHAR)gMacroBlock->Line.substr(7).c_str());
@@ -68,6 +98,64 @@ VOID FailIf(PSPAWNINFO pChar, PCHAR szCommand, PMACROBLOCK pStartLine, BOOL All)
         bRunNextCommand = TRUE;
     }
 }
+// what the /delay condition was last checked against, see DelayConditionMet
+static BOOL DelayConditionLive = TRUE;
+static DWORD DelayConditionGeneration = 0;
+static ULONGLONG DelayConditionChecked = 0;
+
+// TRUE if the text reads anything but plain macro variables. Those only change
+// when gVariableGeneration does, anything else (or a string variable holding a
+// ${...} of its own) could change any frame.
+BOOL MacroDataIsLive(PCHAR szText)
+{
+    for (PCHAR pBrace = strstr(szText,"${"); pBrace; pBrace = strstr(&pBrace[2],"${")) {
+        CHAR szName[MAX_STRING];
+        size_t Len = strcspn(&pBrace[2],"[.(}");
+        if (Len >= MAX_STRING)
+            return TRUE;
+        memcpy(szName,&pBrace[2],Len);
+        szName[Len] = 0;
+        PDATAVAR pVar = FindMQ2DataVariable(szName);
+        if (!pVar)
+            return TRUE;
+        MQ2Type *pType = pVar->Var.Type;
+        if (pType!=pIntType && pType!=pInt64Type && pType!=pByteType && pType!=pBoolType &&
+            pType!=pFloatType && pType!=pDoubleType && pType!=pStringType)
+            return TRUE;
+        // a string holding ${...} is parsed again wherever it's used
+        if (pType==pStringType && strstr((PCHAR)pVar->Var.Ptr,"${"))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+// ***************************************************************************
+// Function:    DelayConditionMet
+// Description: Checks the /delay condition, if anything it reads may have changed.
+//              Plain macro variables are only looked at again after a variable
+//              was written, anything else at most every DelayPollInterval ms
+// ***************************************************************************
+BOOL DelayConditionMet()
+{
+    ULONGLONG Now = MQGetTickCount64();
+    if (DelayConditionGeneration) {
+        if (DelayConditionLive) {
+            if (Now - DelayConditionChecked < gDelayPollInterval)
+                return FALSE;
+        } else if (DelayConditionGeneration == gVariableGeneration)
+            return FALSE;
+    }
+    DelayConditionLive = MacroDataIsLive(gDelayCondition);
+    DelayConditionGeneration = gVariableGeneration;
+    DelayConditionChecked = Now;
+    DOUBLE Result;
+    if (!CalculateCondition(gDelayCondition,Result)) {
+        FatalError("Failed to parse /delay condition '%s', non-numeric encountered", gDelayCondition);
+        return FALSE;
+    }
+    return Result != 0;
+}
+
 // ***************************************************************************
 // Function:    Delay
 // Description: Our '/delay' command
@@ -85,6 +173,7 @@ VOID Delay(PSPAWNINFO pChar, PCHAR szLine)
     GetArg(szVal,szLine,1);
     ParseMacroParameter(GetCharInfo()->pSpawn,szVal);
     strcpy_s(gDelayCondition,GetNextArg(szLine));
+    DelayConditionGeneration = 0;
     VarValue = atol(szVal);
     switch (szVal[strlen(szVal)-1]) {
         case 'm':
@@ -140,6 +229,95 @@ PCHAR GetFuncParam(PCHAR szMacroLine, DWORD ParamNum, PCHAR szParamName, size_t
         sprintf_s(szParamName, ParamNameLen,"Param%d",ParamNum);
     return szParamName;
 }
+
+// reads the signature of a Sub line into SubParams, each parameter the way
+// GetFuncParam reads it
+static VOID ParseSubSignature(PMACROBLOCK pSub)
+{
+    pSub->SubParams.clear();
+    PCHAR szLine = (PCHAR)pSub->Line.c_str();
+    PCHAR pParen = strchr(szLine,'(');
+    if (!pParen)
+        return;
+    // there can't be more parameters than commas, past these GetFuncParam only has defaults
+    DWORD nParams = 1;
+    for (PCHAR pComma = strchr(pParen,','); pComma; pComma = strchr(pComma+1,','))
+        nParams++;
+    CHAR szParamName[MAX_STRING];
+    CHAR szParamType[MAX_STRING];
+    pSub->SubParams.resize(nParams);
+    for (DWORD N = 0; N < nParams; N++) {
+        SUBPARAM &Param = pSub->SubParams[N];
+        GetFuncParam(szLine,N,szParamName,MAX_STRING,szParamType,MAX_STRING);
+        Param.Name = szParamName;
+        Param.TypeName = szParamType;
+        Param.pType = FindMQ2DataType(szParamType);
+        if (!Param.pType)
+            Param.pType = pStringType;
+        Param.TypeGeneration = gDataTypeGeneration;
+    }
+}
+
+// ***************************************************************************
+// Function:    GetSubParam
+// Description: The name and type /call and events give parameter ParamNum of
+//              pSub, from the signature parsed when the macro was loaded. The name
+//              is only written to szParamName when it isn't in the signature
+// ***************************************************************************
+PCHAR GetSubParam(PMACROBLOCK pSub, DWORD ParamNum, PCHAR szParamName, size_t ParamNameLen, MQ2Type *&pType)
+{
+    if (ParamNum >= pSub->SubParams.size()) {
+        sprintf_s(szParamName,ParamNameLen,"Param%d",ParamNum);
+        pType = pStringType;
+        return szParamName;
+    }
+    SUBPARAM &Param = pSub->SubParams[ParamNum];
+    // a plugin may have added or taken away the type since
+    if (Param.TypeGeneration != gDataTypeGeneration) {
+        Param.pType = FindMQ2DataType((PCHAR)Param.TypeName.c_str());
+        if (!Param.pType)
+            Param.pType = pStringType;
+        Param.TypeGeneration = gDataTypeGeneration;
+    }
+    pType = Param.pType;
+    return (PCHAR)Param.Name.c_str();
+}
+
+// /call and events push a frame for each sub they run. frames returned from are kept
+// for the next one instead of going back to the heap every time
+#define MACROSTACK_POOL_SIZE 256
+static std::vector<PMACROSTACK> MacroStackPool;
+
+// pushing or popping a frame changes what a variable name finds, so both count as a
+// variable write for anything caching values by gVariableGeneration
+static PMACROSTACK NewMacroStack()
+{
+    PMACROSTACK pStack;
+    gVariableGeneration++;
+    if (MacroStackPool.size()) {
+        pStack = MacroStackPool.back();
+        MacroStackPool.pop_back();
+    } else {
+        pStack = (PMACROSTACK)malloc(sizeof(MACROSTACK));
+        if (!pStack)
+            return NULL;
+    }
+    pStack->Location = NULL;
+    pStack->pNext = NULL;
+    pStack->Return[0] = 0;
+    pStack->Parameters = NULL;
+    pStack->LocalVariables = NULL;
+    return pStack;
+}
+
+static VOID FreeMacroStack(PMACROSTACK pStack)
+{
+    gVariableGeneration++;
+    if (MacroStackPool.size() < MACROSTACK_POOL_SIZE)
+        MacroStackPool.push_back(pStack);
+    else
+        free(pStack);
+}
 /* VAR SYSTEM INDEPENDENT */
 // in-place cleanup of tabs, leading/trailing space
 VOID CleanMacroLine(PCHAR szLine)
@@ -233,6 +411,138 @@ DWORD Include(PCHAR szFile)
     return 1;
 }
 
+// #define expansion
+//
+// All the define names go into one Aho-Corasick automaton, so a line is scanned for
+// every define at once and a line that uses none (most of them) is done after one
+// pass.  The defines a line does use are applied the way they always were: most
+// recently defined first, each until it no longer appears.  Only the defines found
+// are applied, and the line is scanned again after one changes it, since the
+// replacement can bring in another.
+class CDefineMatcher
+{
+public:
+    CDefineMatcher() : Classes(1) { memset(ClassOf, 0, sizeof(ClassOf)); }
+
+    // Defines[N] is the Nth define in the list, most recent first
+    VOID Build(PDEFINE pList)
+    {
+        Defines.clear();
+        for (PDEFINE pDef = pList; pDef; pDef = pDef->pNext)
+            Defines.push_back(pDef);
+        // only characters that appear in a name get their own column
+        memset(ClassOf, 0, sizeof(ClassOf));
+        Classes = 1;
+        for (auto pDef : Defines)
+            for (PCHAR p = pDef->szName; *p; p++)
+                if (!ClassOf[(unsigned char)*p])
+                    ClassOf[(unsigned char)*p] = Classes++;
+        Next.assign(Classes, 0);
+        Fail.assign(1, 0);
+        Output.assign(1, -1);
+        Match.assign(1, std::vector<int>());
+        for (int N = 0; N < (int)Defines.size(); N++) {
+            int State = 0;
+            for (PCHAR p = Defines[N]->szName; *p; p++) {
+                int &Target = Next[State*Classes + ClassOf[(unsigned char)*p]];
+                if (!Target) {
+                    Target = (int)Fail.size();
+                    Next.resize(Next.size() + Classes, 0);
+                    Fail.push_back(0);
+                    Output.push_back(-1);
+                    Match.push_back(std::vector<int>());
+                }
+                State = Next[State*Classes + ClassOf[(unsigned char)*p]];
+            }
+            // in list order, so each list is sorted
+            Match[State].push_back(N);
+        }
+        // breadth first, fill in the failure links and turn the trie into a full DFA
+        std::vector<int> Queue;
+        for (int C = 0; C < Classes; C++)
+            if (int Child = Next[C])
+                Queue.push_back(Child);
+        for (size_t Q = 0; Q < Queue.size(); Q++) {
+            int State = Queue[Q];
+            // the nearest state down the failure chain that ends a name
+            Output[State] = Match[Fail[State]].size() ? Fail[State] : Output[Fail[State]];
+            for (int C = 0; C < Classes; C++) {
+                int &Child = Next[State*Classes + C];
+                int FailNext = Next[Fail[State]*Classes + C];
+                if (Child) {
+                    Fail[Child] = FailNext;
+                    Queue.push_back(Child);
+                } else {
+                    Child = FailNext;
+                }
+            }
+        }
+    }
+
+    // the first define in the list at or after First that appears in szLine, or -1
+    int Find(PCHAR szLine, int First)
+    {
+        int Best = -1;
+        int State = 0;
+        for (PCHAR p = szLine; *p; p++) {
+            State = Next[State*Classes + ClassOf[(unsigned char)*p]];
+            for (int Hit = Match[State].size() ? State : Output[State]; Hit > 0; Hit = Output[Hit]) {
+                std::vector<int> &List = Match[Hit];
+                auto iter = std::lower_bound(List.begin(), List.end(), First);
+                if (iter != List.end() && (Best < 0 || *iter < Best)) {
+                    Best = *iter;
+                    if (Best == First)
+                        return Best;
+                }
+            }
+        }
+        return Best;
+    }
+
+    std::vector<PDEFINE> Defines;
+private:
+    unsigned char ClassOf[256];
+    int Classes;
+    std::vector<int> Next;                // [state*Classes+class]
+    std::vector<int> Fail;
+    std::vector<int> Output;              // next state down the failure chain that ends a name
+    std::vector<std::vector<int>> Match;  // defines whose name ends at each state
+};
+
+static CDefineMatcher DefineMatcher;
+static BOOL DefinesChanged = TRUE;
+
+static VOID ExpandDefines(PCHAR szLine, size_t Linelen)
+{
+    if (!pDefines)
+        return;
+    if (DefinesChanged) {
+        DefineMatcher.Build(pDefines);
+        DefinesChanged = FALSE;
+    }
+    int N = DefineMatcher.Find(szLine, 0);
+    if (N < 0)
+        return;
+    std::string Line(szLine);
+    while (N >= 0) {
+        PDEFINE pDef = DefineMatcher.Defines[N];
+        size_t NameLen = strlen(pDef->szName);
+        size_t ReplaceLen = strlen(pDef->szReplace);
+        size_t Pos = Line.find(pDef->szName);
+        while (Pos != std::string::npos) {
+            if (Line.size() - NameLen + ReplaceLen >= Linelen) {
+                MacroError("#define %s makes the line too long: %s", pDef->szName, szLine);
+                break;
+            }
+            Line.replace(Pos, NameLen, pDef->szReplace, ReplaceLen);
+            // nothing before Pos matched, a new match can only start where it could reach the replacement
+            Pos = Line.find(pDef->szName, Pos >= NameLen ? Pos - NameLen + 1 : 0);
+        }
+        strcpy_s(szLine, Linelen, Line.c_str());
+        N = DefineMatcher.Find(szLine, N + 1);
+    }
+}
+
 // ***************************************************************************
 // Function:    AddMacroLine
 // Description: Add a line to the MacroBlock
@@ -243,17 +553,8 @@ PMACROBLOCK AddMacroLine(PCHAR szLine, size_t Linelen)
     // replace all tabs with spaces
     if ((szLine[0]==0) || (szLine[0]=='|')) return (PMACROBLOCK)1;
 
-    PDEFINE pDef = pDefines;
-    if (szLine[0]!='#') while (pDef) {
-        while (strstr(szLine,pDef->szName)) {
-            CHAR szNew[MAX_STRING] = {0};
-			strncpy_s(szNew,szLine,strstr(szLine,pDef->szName)-szLine);
-            strcat_s(szNew,pDef->szReplace);
-            strcat_s(szNew,strstr(szLine,pDef->szName)+strlen(pDef->szName));
-            strcpy_s(szLine, Linelen,szNew);
-        }
-        pDef = pDef->pNext;
-    }
+    if (szLine[0]!='#')
+        ExpandDefines(szLine, Linelen);
     if (szLine[0]=='#') {
         if (!_strnicmp(szLine,"#include ",9)) {
             CHAR Filename[MAX_STRING] = {0};
@@ -270,13 +571,27 @@ PMACROBLOCK AddMacroLine(PCHAR szLine, size_t Linelen)
             gTurbo = TRUE;
             CHAR szArg[MAX_STRING] = {0};
             GetArg(szArg,szLine,2);
-            gMaxTurbo = atoi(szArg);
-            if (gMaxTurbo==0)
-                gMaxTurbo=20;
-            else if (gMaxTurbo>MAXTURBO) 
-            {
-                MacroError("#turbo %d is too high, setting at %d (maximum)",gMaxTurbo, MAXTURBO);
-                gMaxTurbo=MAXTURBO;
+            if (!_stricmp(szArg,"budget")) {
+                // #turbo budget [microseconds], run lines for up to that long each frame
+                GetArg(szArg,szLine,3);
+                gTurboBudget = atoi(szArg);
+                if (gTurboBudget==0)
+                    gTurboBudget=DEFAULTTURBOBUDGET;
+                else if (gTurboBudget>MAXTURBOBUDGET)
+                {
+                    MacroError("#turbo budget %d is too high, setting at %d (maximum)",gTurboBudget, MAXTURBOBUDGET);
+                    gTurboBudget=MAXTURBOBUDGET;
+                }
+            } else {
+                gTurboBudget = 0;
+                gMaxTurbo = atoi(szArg);
+                if (gMaxTurbo==0)
+                    gMaxTurbo=20;
+                else if (gMaxTurbo>MAXTURBO) 
+                {
+                    MacroError("#turbo %d is too high, setting at %d (maximum)",gMaxTurbo, MAXTURBO);
+                    gMaxTurbo=MAXTURBO;
+                }
             }
         } else if (!_strnicmp(szLine,"#define ",8)) {
             CHAR szArg1[MAX_STRING] = {0};
@@ -289,6 +604,7 @@ PMACROBLOCK AddMacroLine(PCHAR szLine, size_t Linelen)
                 strcpy_s(pDef->szReplace,szArg2);
                 pDef->pNext = pDefines;
                 pDefines = pDef;
+                DefinesChanged = TRUE;
             } else {
                 MacroError("Bad #define: %s",szLine);
             }
@@ -321,8 +637,7 @@ PMACROBLOCK AddMacroLine(PCHAR szLine, size_t Linelen)
             if( (szArg1[0] != 0) && (szArg2[0] != 0) ) {
                 sprintf_s( pBind->szFuncName, "Bind_%s", szArg1 );
                 strcpy_s( pBind->szName,  szArg2 );
-                pBind->pNext = pBindList;
-                pBindList = pBind;
+                AddMacroBind( pBind );
             }
             else 
             {
@@ -348,48 +663,133 @@ PMACROBLOCK AddMacroLine(PCHAR szLine, size_t Linelen)
         }
     }
 
-    //pBlock = (PMACROBLOCK)calloc(1,sizeof(MACROBLOCK));
-	pBlock = new MACROBLOCK;
-    if (!pBlock) return NULL;
-	pBlock->LoopLine = 0;
+    MacroLines.emplace_back();
+    pBlock = &MacroLines.back();
 	pBlock->MacroCmd = 0;
 	pBlock->Line = szLine;
-   // strcpy_s(pBlock->Line,szLine);
     pBlock->LineNumber = -1;
-    //pBlock->SourceFile[0]='\0';
     pBlock->pNext=NULL;
-    pBlock->pPrev=NULL;
+    pBlock->pPrev=MacroLines.size()>1 ? &MacroLines[MacroLines.size()-2] : NULL;
+    if (pBlock->pPrev)
+        pBlock->pPrev->pNext=pBlock;
+    if (!gMacroBlock)
+        gMacroBlock=pBlock;
+    pBlock->pSub=NULL;
+    pBlock->pBlockEnd=NULL;
+    pBlock->pChainEnd=NULL;
+    pBlock->pLoopStart=NULL;
+    pBlock->pLoopEnd=NULL;
+    pBlock->pLoopHead=NULL;
+    pBlock->CommandGeneration=0;
+    pBlock->pCommand=NULL;
+#ifdef MQ2_PROFILING
+    pBlock->ExecutionCount=0;
+    pBlock->ExecutionTime=0;
+#endif
+    return pBlock;
+}
 
-    if ((!_stricmp(szLine,"Sub Event_Chat")) || (!_strnicmp(szLine,"Sub Event_Chat(",15))) {
-        gEventFunc[EVENT_CHAT] = pBlock;
-    } else if ((!_stricmp(szLine,"Sub Event_Timer")) || (!_strnicmp(szLine,"Sub Event_Timer(",16))) {
-        gEventFunc[EVENT_TIMER] = pBlock;
-    } else {
-        PEVENTLIST pEvent = pEventList;
-        while (pEvent) {
-            if (!_stricmp(szLine,pEvent->szName)) {
-                pEvent->pEventFunc = pBlock;
+// ***************************************************************************
+// Function:    LinkMacroLines
+// Description: Finds the subs, labels and event handlers in the lines AddMacroLine
+//              loaded and pairs up {} blocks and /for ... /next
+// ***************************************************************************
+static VOID LinkMacroLines()
+{
+    gMacroSubLookupMap.clear();
+    MacroLabels.clear();
+    if (MacroLines.empty())
+        return;
+    size_t Count = MacroLines.size();
+    std::vector<size_t> OpenBlocks;
+    std::vector<size_t> ForLines;
+    PMACROBLOCK pSub = NULL;
+    CHAR szArg[MAX_STRING] = {0};
+    for (size_t N = 0; N < Count; N++) {
+        PMACROBLOCK pBlock = &MacroLines[N];
+        PCHAR szLine = (PCHAR)pBlock->Line.c_str();
+        if (!_strnicmp(szLine,"sub ",4)) {
+            // a {} block or a /for never carries on into the next sub
+            OpenBlocks.clear();
+            ForLines.clear();
+            pSub = pBlock;
+            ParseSubSignature(pBlock);
+            // /call looks subs up without case, the first one of a name wins
+            strcpy_s(szArg,szLine+4);
+            if (PCHAR pParen = strchr(szArg,'('))
+                *pParen = 0;
+            _strlwr_s(szArg);
+            if (!gMacroSubLookupMap.count(szArg))
+                gMacroSubLookupMap[szArg] = pBlock;
+            if ((!_stricmp(szLine,"Sub Event_Chat")) || (!_strnicmp(szLine,"Sub Event_Chat(",15))) {
+                gEventFunc[EVENT_CHAT] = pBlock;
+            } else if ((!_stricmp(szLine,"Sub Event_Timer")) || (!_strnicmp(szLine,"Sub Event_Timer(",16))) {
+                gEventFunc[EVENT_TIMER] = pBlock;
             } else {
-                CHAR szNameP[MAX_STRING] = {0};
-                sprintf_s(szNameP,"%s(",pEvent->szName);
-                if (!_strnicmp(szLine,szNameP,strlen(szNameP))) {
-                    pEvent->pEventFunc = pBlock;
+                PEVENTLIST pEvent = pEventList;
+                while (pEvent) {
+                    if (!_stricmp(szLine,pEvent->szName)) {
+                        pEvent->pEventFunc = pBlock;
+                    } else {
+                        CHAR szNameP[MAX_STRING] = {0};
+                        sprintf_s(szNameP,"%s(",pEvent->szName);
+                        if (!_strnicmp(szLine,szNameP,strlen(szNameP))) {
+                            pEvent->pEventFunc = pBlock;
+                        }
+                    }
+                    pEvent = pEvent->pNext;
+                }
+            }
+        }
+        pBlock->pSub = pSub;
+        if (szLine[0]=='}' && OpenBlocks.size()) {
+            PMACROBLOCK pOpen = &MacroLines[OpenBlocks.back()];
+            pOpen->pBlockEnd = pBlock;
+            // the } of a /while goes back to it, see HideDoCommand
+            if (!_strnicmp(pOpen->Line.c_str(),"/while",6) && pOpen->pPrev)
+                pBlock->pLoopHead = pOpen;
+            OpenBlocks.pop_back();
+        }
+        if (pBlock->Line[pBlock->Line.size()-1]=='{')
+            OpenBlocks.push_back(N);
+        if (szLine[0]==':' && pSub) {
+            // the first of a name in a sub is the one /goto finds
+            MacroLabels.insert(std::make_pair(GetMacroLabelKey(pSub,szLine),pBlock));
+        }
+        if (!_strnicmp(szLine,"/for ",5)) {
+            ForLines.push_back(N);
+        } else if (!_strnicmp(szLine,"/next ",6)) {
+            // the nearest /for of the variable. /next tells them apart by their text after
+            // ${} are parsed, so give up if one in the way has any
+            GetArg(szArg,szLine,2);
+            size_t Len = strlen(szArg);
+            for (size_t F = ForLines.size(); F-- && Len && !strchr(szArg,'$');) {
+                PMACROBLOCK pFor = &MacroLines[ForLines[F]];
+                if (strstr(pFor->Line.c_str(),"${"))
+                    break;
+                if (!_strnicmp(pFor->Line.c_str()+5,szArg,Len) && pFor->Line[5+Len]==' ') {
+                    pBlock->pLoopStart = pFor;
+                    break;
                 }
             }
-            pEvent = pEvent->pNext;
         }
     }
-    if (!gMacroBlock) {
-        gMacroBlock=pBlock;
-    } else {
-        PMACROBLOCK pLoop = gMacroBlock;
-        while (pLoop->pNext)
-			pLoop = pLoop->pNext;
-        pLoop->pNext = pBlock;
-        pBlock->pPrev = pLoop;
-    }
-    return pBlock;
+    // backwards, so the end of an if/else chain (the first } in it without a {) and the
+    // next /next in the sub (where /break and /continue go) are known from the line after
+    PMACROBLOCK pLoopEnd = NULL;
+    for (size_t N = Count; N--;) {
+        PMACROBLOCK pBlock = &MacroLines[N];
+        if (PMACROBLOCK pEnd = pBlock->pBlockEnd)
+            pBlock->pChainEnd = pEnd->Line[pEnd->Line.size()-1]=='{' ? pEnd->pChainEnd : pEnd;
+        if (N+1==Count || !_strnicmp(pBlock->Line.c_str(),"sub ",4))
+            pLoopEnd = NULL;
+        else if (!_strnicmp(pBlock->Line.c_str(),"/next",5))
+            pLoopEnd = pBlock;
+        pBlock->pLoopEnd = pLoopEnd;
+    }
+    gMacroBlock = &MacroLines[0];
 }
+
 // ***************************************************************************
 // Function:    Macro
 // Description: Our '/macro' command
@@ -415,6 +815,10 @@ VOID Macro(PSPAWNINFO pChar, PCHAR szLine)
     }
     gMaxTurbo=20;
     gTurbo=true;
+    gTurboBudget=0;
+    gTurboFrameBudget=0;
+    gTurboLinesPerFrame=0.0f;
+    gTurboOverruns=0;
     GetArg(szTemp,szLine,1);
     Params = GetNextArg(szLine);
 
@@ -453,6 +857,8 @@ VOID Macro(PSPAWNINFO pChar, PCHAR szLine)
             if (NULL == (pAddedLine=AddMacroLine(szTemp, MAX_STRING))) {
                 MacroError("Unable to add macro line.");
                 fclose(fMacro);
+                // keep what loaded so the next /macro or /endmacro cleans it up
+                LinkMacroLines();
                 gszMacroName[0]=0;
                 gRunning = 0;
                 return;
@@ -469,12 +875,14 @@ VOID Macro(PSPAWNINFO pChar, PCHAR szLine)
         }
     }
     fclose(fMacro);
+    LinkMacroLines();
     PDEFINE pDef;
     while (pDefines) {
         pDef = pDefines->pNext;
         free(pDefines);
         pDefines = pDef;
     }
+    DefinesChanged = TRUE;
     strcpy_s(szTemp, "Main");
     if (Params[0] !=0) {
         strcat_s(szTemp, " ");
@@ -550,6 +958,13 @@ VOID Goto(PSPAWNINFO pChar, PCHAR szLine)
         MacroError("Cannot goto when a macro isn't running.");
         return;
     }
+    if (szLine[0]==':' && gMacroBlock->pSub) {
+        auto iter = MacroLabels.find(GetMacroLabelKey(gMacroBlock->pSub,szLine));
+        if (iter != MacroLabels.end()) {
+            gMacroBlock = iter->second;
+            return;
+        }
+    }
     while (gMacroBlock->pPrev) 
     {
         gMacroBlock=gMacroBlock->pPrev;
@@ -606,11 +1021,8 @@ VOID EndMacro(PSPAWNINFO pChar, PCHAR szLine)
 {
     CHAR Buffer[MAX_STRING] = {0};
     DWORD i;
-    PMACROBLOCK pPrev;
     PMACROSTACK pStack;
-    PEVENTQUEUE pEvent;
     PEVENTLIST pEventL;
-    PBINDLIST pBindL;
     BOOL bKeepKeys = gKeepKeys;
     if (szLine && szLine[0]!=0) {
         GetArg(Buffer,szLine,1);
@@ -710,15 +1122,10 @@ VOID EndMacro(PSPAWNINFO pChar, PCHAR szLine)
     }
 #endif
 
-    while (gMacroBlock->pNext)
-		gMacroBlock=gMacroBlock->pNext;
-    while (gMacroBlock) {
-        pPrev = gMacroBlock->pPrev;
-		DebugSpewNoFile("EndMacro: Deleting gMacroBlock %s", gMacroBlock->Line.c_str());
-        //free(gMacroBlock);
-        delete gMacroBlock;
-        gMacroBlock = pPrev;
-    }
+	DebugSpewNoFile("EndMacro: Deleting %d macro lines", MacroLines.size());
+    gMacroBlock = NULL;
+    std::deque<MACROBLOCK>().swap(MacroLines);
+    MacroLabels.clear();
     while (gMacroStack) {
         pStack = gMacroStack->pNext;
         if (gMacroStack->LocalVariables) 
@@ -726,29 +1133,19 @@ VOID EndMacro(PSPAWNINFO pChar, PCHAR szLine)
         if (gMacroStack->Parameters) 
             ClearMQ2DataVariables(&gMacroStack->Parameters);
 		DebugSpewNoFile("EndMacro: Deleting gMacroStack");
-        free(gMacroStack);
+        FreeMacroStack(gMacroStack);
         gMacroStack = pStack;
     }
     gMacroSubLookupMap.clear(); 
-    while (gEventQueue) {
-        pEvent = gEventQueue->pNext;
-		DebugSpewNoFile("EndMacro: Deleting gEventQueue %d %s", gEventQueue->Type, gEventQueue->Name.c_str());
-        //free(gEventQueue);
-        delete gEventQueue;
-        gEventQueue = pEvent;
-    }
+    FlushMacroEvents(NULL);
+    gEventsDropped = 0;
     while (pEventList) {
         pEventL = pEventList->pNext;
 		DebugSpewNoFile("EndMacro: Deleting pEventList %d %s", pEventList->BlechID, pEventList->szName);
         free(pEventList);
         pEventList = pEventL;
     }
-    while( pBindList ) {
-        pBindL = pBindList->pNext;
-        DebugSpewNoFile( "EndMacro: Deleting pBindList %s", pBindList->szName );
-        free( pBindList );
-        pBindList = pBindL;
-    }
+    RemoveMacroBinds();
 #ifdef USEBLECHEVENTS
     pEventBlech->Reset();
 #endif
@@ -798,11 +1195,8 @@ VOID EndMacro(PSPAWNINFO pChar, PCHAR szLine)
 VOID Call(PSPAWNINFO pChar, PCHAR szLine)
 {
     PMACROSTACK pStack = 0;
-    PMACROBLOCK pCallingPoint = gMacroBlock;
     CHAR SubName[MAX_STRING] = {0};
     PCHAR SubParam = NULL;
-    CHAR SubLine[MAX_STRING] = {0};
-    CHAR SubLineP[MAX_STRING] = {0};
     DWORD StackNum = 0;
     bRunNextCommand = TRUE;
 
@@ -818,64 +1212,42 @@ VOID Call(PSPAWNINFO pChar, PCHAR szLine)
     GetArg(SubName,szLine,1);
     SubParam = GetNextArg(szLine);
 
-    sprintf_s(SubLine,"sub %s",SubName);
-    sprintf_s(SubLineP,"sub %s(",SubName);
-
-    // Sub in Map?
-    PMACROBLOCK pSubBlock = gMacroSubLookupMap[SubName];
-
-    // If not, find it and add.
-    if (!pSubBlock) {
-        while (gMacroBlock->pPrev) gMacroBlock = gMacroBlock->pPrev;
-        while (gMacroBlock->pNext) {
-            if (!_stricmp(gMacroBlock->Line.c_str(),SubLine) || !_strnicmp(gMacroBlock->Line.c_str(),SubLineP,strlen(SubLineP))) {
-                pSubBlock = gMacroBlock;
-                break;
-            }
-            gMacroBlock = gMacroBlock->pNext;
-        }
-        if (!pSubBlock) {
-            gMacroBlock=pCallingPoint;
-            FatalError("Subroutine %s wasn't found",SubName);
-            return;
-        } else {
-            gMacroSubLookupMap[SubName] = pSubBlock;
-        }
+    // every sub went in the map when the macro loaded, by its name in lower case
+    CHAR SubKey[MAX_STRING] = {0};
+    strcpy_s(SubKey,SubName);
+    _strlwr_s(SubKey);
+    auto iter = gMacroSubLookupMap.find(SubKey);
+    if (iter == gMacroSubLookupMap.end()) {
+        FatalError("Subroutine %s wasn't found",SubName);
+        return;
     }
 
     // Prep to call the Sub
-    gMacroBlock = pSubBlock;
+    gMacroBlock = iter->second;
 
 	/*if(SubName && SubName[0]!='\0' && SubParam && SubParam[0]!='\0') {
 		DebugSpewNoFile("Call - Calling subroutine %s with params %s",SubName,SubParam);
 	} else {
 		DebugSpewNoFile("Call - SubName and SubParam was empty");
 	}*/
-    pStack = (PMACROSTACK)calloc(1,sizeof(MACROSTACK));
+    pStack = NewMacroStack();
 	if( pStack == NULL ) {
 		MacroError("Failed to allocate pStack for /call");
         return;
 	}
     pStack->Location = gMacroBlock;
-    pStack->Return[0] = '\0';
-    pStack->Parameters = NULL;
-    pStack->LocalVariables = NULL;
     pStack->pNext = gMacroStack;
     gMacroStack = pStack;
     if (SubParam) {
         StackNum = 0;
+        CHAR szParamName[MAX_STRING];
+        CHAR szNewValue[MAX_STRING];
         while (SubParam[0]!=0) {
-            CHAR szParamName[MAX_STRING] = {0};
-            CHAR szParamType[MAX_STRING] = {0};
-            CHAR szNewValue[MAX_STRING]={0};
             GetArg(szNewValue,SubParam,1);
 
-            GetFuncParam((PCHAR)gMacroBlock->Line.c_str(),StackNum,szParamName, MAX_STRING,szParamType,MAX_STRING);
-            MQ2Type *pType = FindMQ2DataType(szParamType);
-            if (!pType)
-                pType=pStringType;
-
-            AddMQ2DataVariable(szParamName,"",pType,&gMacroStack->Parameters,szNewValue);
+            MQ2Type *pType;
+            PCHAR pParamName = GetSubParam(gMacroBlock,StackNum,szParamName,MAX_STRING,pType);
+            AddMQ2DataVariable(pParamName,"",pType,&gMacroStack->Parameters,szNewValue);
             SubParam = GetNextArg(SubParam);
             StackNum++;
         }
@@ -896,9 +1268,23 @@ VOID NewIf(PSPAWNINFO pChar, PCHAR szLine)
 
     PCHAR pEnd=&szLine[1];
     DWORD nParens=1;
+    DWORD nBraces=0;
     while(1)
     {
-        if (*pEnd=='(')
+        // the condition arrives unparsed, parens inside a ${...} don't count
+        if (pEnd[0]=='$' && pEnd[1]=='{')
+        {
+            nBraces++;
+            pEnd++;
+        }
+        else if (nBraces && *pEnd)
+        {
+            if (*pEnd=='{')
+                nBraces++;
+            else if (*pEnd=='}')
+                nBraces--;
+        }
+        else if (*pEnd=='(')
             nParens++;
         else if (*pEnd==')')
         {
@@ -932,7 +1318,7 @@ VOID NewIf(PSPAWNINFO pChar, PCHAR szLine)
 
 
     DOUBLE Result=0;
-    if (!Calculate(szCond,Result))
+    if (!CalculateCondition(szCond,Result))
     {
         FatalError("Failed to parse /if condition '%s', non-numeric encountered",szCond);
         return;
@@ -976,88 +1362,29 @@ VOID ContinueWhile(PSPAWNINFO pChar, PMACROBLOCK pStartLine)
 }
 VOID EndWhile(PSPAWNINFO pChar, PCHAR szCommand, PMACROBLOCK pStartLine, BOOL All=0)
 {
-    DWORD Scope = 0;
     if (szCommand[strlen(szCommand)-1]=='{') {
         if (!gMacroBlock) {
             DebugSpewNoFile("EndWhile - Macro was ended before we could handle the false while command");
             return;
         }
-        Scope++;
-        gMacroBlock = gMacroBlock->pNext;
-        while ((Scope>0)) {
-            if (gMacroBlock->Line[0]=='}') Scope--;
-            //if (All) if (gMacroBlock->Line[strlen(gMacroBlock->Line)-1]=='{') Scope++;
-            if (All) if (gMacroBlock->Line[gMacroBlock->Line.size()-1]=='{') Scope++;
-            if (Scope>0) {
-                //if (!All) if (gMacroBlock->Line[strlen(gMacroBlock->Line)-1]=='{') Scope++;
-                if (!All) if (gMacroBlock->Line[gMacroBlock->Line.size()-1]=='{') Scope++;
-                if (!_strnicmp(gMacroBlock->Line.c_str(),"sub ",4)) {
-                    gMacroBlock=pStartLine;
-                    FatalError("{} pairing ran into anther subroutine");
-                    return;
-                }
-                if (!gMacroBlock->pNext) {
-                    gMacroBlock=pStartLine;
-                    FatalError("Bad {} block pairing");
-                    return;
-                }
-                gMacroBlock = gMacroBlock->pNext;
-            }
-        }
+        if (PMACROBLOCK pEnd = FindBlockEnd(gMacroBlock, All))
+            gMacroBlock = pEnd;
     } else {
-		gMacroBlock = gMacroBlock->pNext;
+        // the macro carries on with the line after this one
         bRunNextCommand = TRUE;
     }
 }
-VOID MarkWhile(PSPAWNINFO pChar, PCHAR szCommand, BOOL All=0)
+// the } closing a /while ... { is paired with it when the macro is loaded, this
+// reports the ones that couldn't be and returns FALSE for them
+BOOL MarkWhile(PSPAWNINFO pChar, PCHAR szCommand, BOOL All=0)
 {
-	PMACROBLOCK pSaveLine = gMacroBlock;
-	BOOL bDelay = 0;
-    DWORD Scope = 0;
-    if (szCommand[strlen(szCommand)-1]=='{') {
-        if (!gMacroBlock) {
-            DebugSpewNoFile("MarkWhile - Macro was ended before we could handle the command");
-            return;
-        }
-        Scope++;
-        gMacroBlock = gMacroBlock->pNext;
-        while ((Scope>0)) {
-            if (gMacroBlock->Line[0]=='}') {
-				Scope--;
-			}
-            if (All) {
-				//if (gMacroBlock->Line[strlen(gMacroBlock->Line)-1]=='{') {
-				if (gMacroBlock->Line[gMacroBlock->Line.size()-1]=='{') {
-					Scope++;
-				}
-			}
-            if (Scope>0) {
-                if (!All) {
-					//if (gMacroBlock->Line[strlen(gMacroBlock->Line)-1]=='{') {
-					if (gMacroBlock->Line[gMacroBlock->Line.size()-1]=='{') {
-						Scope++;
-					}
-				}
-                if (!_strnicmp(gMacroBlock->Line.c_str(),"sub ",4)) {
-                    gMacroBlock=pSaveLine;
-                    FatalError("{} pairing ran into anther subroutine");
-                    return;
-                }
-                if (!gMacroBlock->pNext) {
-                    gMacroBlock=pSaveLine;
-                    FatalError("Bad {} block pairing");
-                    return;
-                }
-                gMacroBlock = gMacroBlock->pNext;
-            }
-        }
-    } else {
-		//its a /while (something) /dosomething
-		//but we know, that unless that /dosomething is a /delay ... we WILL fail them...
-		Sleep(0);
-    }
-	gMacroBlock->LoopLine = pSaveLine->LineNumber;
-	gMacroBlock = pSaveLine;
+    if (szCommand[strlen(szCommand)-1]!='{' || !gMacroBlock || gMacroBlock->pBlockEnd)
+        return TRUE;
+    PMACROBLOCK pSaveLine = gMacroBlock;
+    if (!FindBlockEnd(gMacroBlock, All))
+        return FALSE;
+    gMacroBlock = pSaveLine;
+    return TRUE;
 }
 //yes this is going to work, i just need some more time testing it -eqmule
 VOID WhileCmd(PSPAWNINFO pChar, PCHAR szLine)
@@ -1073,9 +1400,23 @@ VOID WhileCmd(PSPAWNINFO pChar, PCHAR szLine)
 
     PCHAR pEnd=&szLine[1];
     DWORD nParens=1;
+    DWORD nBraces=0;
     while(1)
     {
-        if (*pEnd=='(')
+        // the condition arrives unparsed, parens inside a ${...} don't count
+        if (pEnd[0]=='$' && pEnd[1]=='{')
+        {
+            nBraces++;
+            pEnd++;
+        }
+        else if (nBraces && *pEnd)
+        {
+            if (*pEnd=='{')
+                nBraces++;
+            else if (*pEnd=='}')
+                nBraces--;
+        }
+        else if (*pEnd=='(')
             nParens++;
         else if (*pEnd==')')
         {
@@ -1109,21 +1450,23 @@ VOID WhileCmd(PSPAWNINFO pChar, PCHAR szLine)
 
 
     DOUBLE Result=0;
-    if (!Calculate(szCond,Result))
+    if (!CalculateCondition(szCond,Result))
     {
         FatalError("Failed to parse /while condition '%s', non-numeric encountered",szCond);
         return;
     }
 
-	//ok so we have a loop...
-	//lets check all the lines within it
-	//and mark the end so the interpreter knows when to exit it
-	MarkWhile(pChar,pEnd);
-	
-	
-    if (Result!=0)
-        DoCommand(pChar,pEnd); 
-    else 
+    if (!MarkWhile(pChar,pEnd))
+        return;
+    if (Result!=0) {
+        PMACROBLOCK pWhileLine = gMacroBlock;
+        BOOL bBlock = pEnd[strlen(pEnd)-1]=='{';
+        DoCommand(pChar,pEnd);
+        // /while (something) /dosomething comes back to this line, unless the command
+        // took the macro somewhere else. the } of a /while ... { loops back on its own
+        if (!bBlock && gMacroBlock && gMacroBlock==pWhileLine && pWhileLine->pPrev && !_strnicmp(pWhileLine->Line.c_str(),"/while",6))
+            gMacroBlock = pWhileLine->pPrev;
+    } else 
 		EndWhile(pChar,pEnd, gMacroBlock);
 }
 // ***************************************************************************
@@ -1147,91 +1490,37 @@ VOID DoEvents(PSPAWNINFO pChar, PCHAR szLine)
         if (Arg2[0])
         {
             sprintf_s(Arg1,"Sub Event_%s",Arg2);
-            PEVENTQUEUE pEvent=gEventQueue;
-            while (pEvent) 
-            {
-                if (
-                    (pEvent->Type == EVENT_CHAT && !_stricmp("Sub Event_Chat",Arg1)) ||
-                    (pEvent->Type == EVENT_TIMER && !_stricmp("Sub Event_Timer",Arg1)) ||
-                    (pEvent->Type == EVENT_CUSTOM && !_stricmp(pEvent->pEventList->szName,Arg1))
-                    ) 
-                {
-                    PEVENTQUEUE pEventNext;
-                    if (pEventNext = pEvent->pNext)
-                        pEventNext->pPrev=pEvent->pPrev;
-                    if (pEvent->pPrev)
-                        pEvent->pPrev->pNext=pEvent->pNext;
-                    else
-                        gEventQueue=pEvent->pNext;
-                    ClearMQ2DataVariables(&pEvent->Parameters);
-					DebugSpewNoFile("Doevents: Deleting pEvent %d %s", pEvent->Type,pEvent->Name.c_str());
-                    //free(pEvent);
-                    delete pEvent;
-                    pEvent=pEventNext;
-                    continue;
-                }
-                pEvent = pEvent->pNext;
-            }
+            FlushMacroEvents(Arg1);
         }
         else
         {
-            while (gEventQueue) 
-            {
-                PEVENTQUEUE pEventNext = gEventQueue->pNext;
-                ClearMQ2DataVariables(&gEventQueue->Parameters);
-				DebugSpewNoFile("Doevents: Deleting gEventQueue %d %s", gEventQueue->Type, gEventQueue->Name.c_str());
-                //free(gEventQueue);
-                delete gEventQueue;
-                gEventQueue = pEventNext;
-            }
+            FlushMacroEvents(NULL);
         }
         return;
     }
-    PEVENTQUEUE pEvent=gEventQueue;
+    PEVENTQUEUE pEvent;
     if (Arg1[0])
     {
         sprintf_s(Arg2,"Sub Event_%s",Arg1);
-        while(pEvent)
-        {
-            if (
-                (pEvent->Type == EVENT_CHAT && !_stricmp("Sub Event_Chat",Arg2)) ||
-                (pEvent->Type == EVENT_TIMER && !_stricmp("Sub Event_Timer",Arg2)) ||
-                (pEvent->Type == EVENT_CUSTOM && !_stricmp(pEvent->pEventList->szName,Arg2))
-                ) 
-            {
-                break;
-            }
-            pEvent=pEvent->pNext;
-        }
+        pEvent = FindMacroEvent(Arg2);
         if (!pEvent)
             return;// no event found
     }
-
-    if (pEvent->pPrev)
-        pEvent->pPrev->pNext=pEvent->pNext;
     else
-        gEventQueue=pEvent->pNext;
-    if (pEvent->pNext)
-        pEvent->pNext->pPrev=pEvent->pPrev;
+        pEvent = FindMacroEvent(NULL);
+
+    RemoveMacroEvent(pEvent);
 
     DebugSpewNoFile("DoEvents: Running event type %d (%s) = 0x%p",pEvent->Type,(pEvent->pEventList)?pEvent->pEventList->szName:"NONE",pEvent);
 
-    if(PMACROSTACK pStack = (PMACROSTACK)malloc(sizeof(MACROSTACK))) {
+    if(PMACROSTACK pStack = NewMacroStack()) {
 
 		// back the current location to previous one so we fall into
 		// /doevents again.  This screams for optimization!
 
 		gMacroStack->Location = gMacroStack->Location->pPrev;
 		pStack->Location = gMacroBlock;
-		pStack->Return[0] = 0;
-		pStack->Parameters = pEvent->Parameters;
-		PDATAVAR pParam=pStack->Parameters;
-		while(pParam) // FIX THE HEAD ON EVERY VAR WE MOVED
-		{
-			pParam->ppHead=&pStack->Parameters;
-			pParam=pParam->pNext;
-		}
-		pStack->LocalVariables = NULL;
+		MoveMQ2DataVariables(&pEvent->Parameters,&pStack->Parameters);
 		pStack->pNext = gMacroStack;
 		gMacroStack = pStack;
 		if (pEvent->Type == EVENT_CUSTOM && pEvent->pEventList)
@@ -1243,9 +1532,11 @@ VOID DoEvents(PSPAWNINFO pChar, PCHAR szLine)
 			gMacroBlock = gEventFunc[pEvent->Type];
 		}
 		DebugSpewNoFile("DoEvents - Deleted event: %d %s",pEvent->Type, pEvent->Name.c_str());
-		delete pEvent;
+		FreeMacroEvent(pEvent);
 		bRunNextCommand = FALSE;
 	}
+	else
+		FreeMacroEvent(pEvent);
 }
 
 
@@ -1277,7 +1568,7 @@ VOID Return(PSPAWNINFO pChar, PCHAR szLine)
     strcpy_s(pStack->pNext->Return,szLine);
     gMacroBlock = pStack->pNext->Location;
     gMacroStack = pStack->pNext;
-    free(pStack);
+    FreeMacroStack(pStack);
     //DebugSpewNoFile("Return - Returned to %s",gMacroBlock->Line);
 
 }
@@ -1321,7 +1612,7 @@ VOID For(PSPAWNINFO pChar, PCHAR szLine)
         return;
     }
 
-    if (!pVar->Var.Type->FromString(pVar->Var.VarPtr,ArgStart))
+    if (!SetMQ2DataVariable(pVar->Var.Type,pVar->Var.VarPtr,ArgStart))
     {
         FatalError("/for loop could not assign value '%s' to variable",ArgStart);
         return;
@@ -1362,6 +1653,9 @@ VOID Next(PSPAWNINFO pChar, PCHAR szLine)
         return;
     }
     sprintf_s(szComp,"/for %s ",pVar->szName);
+    // start from the /for found at load time, if there was one
+    if (gMacroBlock->pLoopStart && !_strnicmp(gMacroBlock->pLoopStart->Line.c_str(),szComp,strlen(szComp)))
+        pMacroLine = gMacroBlock->pLoopStart;
     while (pMacroLine->pPrev) {
         strcpy_s(ForLine,pMacroLine->Line.c_str());
         if (!_strnicmp(ForLine,"sub ",4)) {
@@ -1378,6 +1672,7 @@ VOID Next(PSPAWNINFO pChar, PCHAR szLine)
                 return;
             }
             CHAR szTemp[MAX_STRING] = {0};
+            CHAR szValue[MAX_STRING] = {0};
             DWORD VarNum = atoi(szLine+1);
             LONG Loop = 0;
 			strcpy_s(szTemp, ForLine);
@@ -1404,7 +1699,8 @@ VOID Next(PSPAWNINFO pChar, PCHAR szLine)
 				if(pDest = strstr(szTemp,"downto"))
 					Loop = atoi(pDest + 7);
                 //DebugSpewNoFile("Next - End of loop %d downto %d", pVar->Var.Int, Loop);
-                pVar->Var.Int-=StepSize;
+                _itoa_s(pVar->Var.Int-StepSize,szValue,10);
+                SetMQ2DataVariable(pVar->Var.Type,pVar->Var.VarPtr,szValue);
                 if (pVar->Var.Int >= Loop) 
                     gMacroBlock = pMacroLine;
             } 
@@ -1413,7 +1709,8 @@ VOID Next(PSPAWNINFO pChar, PCHAR szLine)
 				if(pDest = strstr(szTemp, "to"))
 					Loop = atoi(pDest + 3);
                 //DebugSpewNoFile("Next - End of loop %d to %d", pVar->Var.Int, Loop);
-                pVar->Var.Int+=StepSize;
+                _itoa_s(pVar->Var.Int+StepSize,szValue,10);
+                SetMQ2DataVariable(pVar->Var.Type,pVar->Var.VarPtr,szValue);
                 if (pVar->Var.Int <= Loop) 
                     gMacroBlock = pMacroLine;
             }
@@ -1437,6 +1734,11 @@ VOID Continue(PSPAWNINFO pChar, PCHAR szLine)
         MacroError("Can only use /continue during a macro.");
         return;
     }
+   if (bRunNextCommand == TRUE && gMacroBlock->pLoopEnd)
+   {
+      gMacroBlock = gMacroBlock->pLoopEnd->pPrev;
+      return;
+   }
 
    while (bRunNextCommand == TRUE) //FIX?
    {   
@@ -1466,6 +1768,11 @@ VOID Break(PSPAWNINFO pChar, PCHAR szLine)
         MacroError("Can only use /break during a macro.");
         return;
     }
+   if (bRunNextCommand == TRUE && gMacroBlock->pLoopEnd)
+   {
+      gMacroBlock = gMacroBlock->pLoopEnd;
+      return;
+   }
 
    while (bRunNextCommand == TRUE) //FIX?
    {   
@@ -142,6 +142,8 @@ BOOL ParseINIFile(PCHAR lpINIPath)
 	gCreateMQ2NewsWindow = 1==GetPrivateProfileInt("MacroQuest","CreateMQ2NewsWindow",1,Filename);
 	gNetStatusXPos = GetPrivateProfileInt("MacroQuest","NetStatusXPos",0,Filename);
 	gNetStatusYPos = GetPrivateProfileInt("MacroQuest","NetStatusYPos",0,Filename);
+	gMaxEventQueue = GetPrivateProfileInt("MacroQuest","MaxEventQueue",gMaxEventQueue,Filename);
+	gDelayPollInterval = GetPrivateProfileInt("MacroQuest","DelayPollInterval",gDelayPollInterval,Filename);
 
 	GetPrivateProfileString("Macroquest","IfDelimiter",",",Delimiter,MAX_STRING,Filename); gIfDelimiter = Delimiter[0];
 	GetPrivateProfileString("Macroquest","IfAltDelimiter","~",Delimiter,MAX_STRING,Filename); gIfAltDelimiter = Delimiter[0];
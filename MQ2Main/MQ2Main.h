@@ -55,6 +55,7 @@ GNU General Public License for more details.
 #include <set>
 #include <stack>
 #include <string>
+#include <unordered_map>
 #include <algorithm>
 using namespace std;
 
@@ -396,6 +397,8 @@ LEGACY_API BOOL RemoveAlias(PCHAR ShortCommand);
 LEGACY_API VOID AddSubstitute(PCHAR Original, PCHAR Substitution);
 LEGACY_API BOOL RemoveSubstitute(PCHAR Original);
 LEGACY_API BOOL RemoveCommand(PCHAR Command);
+LEGACY_API VOID AddMacroBind(PBINDLIST pBind);
+LEGACY_API VOID RemoveMacroBinds();
 LEGACY_API VOID DoTimedCommands();
 LEGACY_API VOID TimedCommand(PCHAR Command, DWORD msDelay);
 
@@ -406,7 +409,7 @@ LEGACY_API VOID Echo(PSPAWNINFO, PCHAR);
 
 /* MACRO PARSING */
 #ifdef USEBLECHEVENTS
-void __stdcall EventBlechCallback(unsigned int ID, void * pData, PBLECHVALUE pValues);
+void __stdcall EventBlechCallback(unsigned int ID, void * pData, const char *Input, PBLECHCAPTURE pCaptures, unsigned int nCaptures);
 #endif
 #define PMP_ERROR_BADPARM 10000
 LEGACY_API PCHAR ParseMacroParameter(PSPAWNINFO pChar, PCHAR szOriginal, SIZE_T BufferSize);
@@ -428,8 +431,15 @@ LEGACY_API BOOL AddMQ2Data(PCHAR szName, fMQData Function);
 LEGACY_API BOOL RemoveMQ2Data(PCHAR szName);
 LEGACY_API MQ2Type *FindMQ2DataType(PCHAR szName);
 LEGACY_API PMQ2DATAITEM FindMQ2Data(PCHAR szName);
+LEGACY_API PMQ2DATAITEM FindMQ2DataByAtom(DWORD Atom);
 LEGACY_API PDATAVAR FindMQ2DataVariable(PCHAR szName);
 LEGACY_API BOOL ParseMQ2DataPortion(PCHAR szOriginal, MQ2TYPEVAR &Result);
+LEGACY_API PCHAR AllocMQ2DataTemp(SIZE_T Size);
+LEGACY_API PCHAR StoreMQ2DataTemp(PCHAR szText);
+LEGACY_API VOID ReleaseMQ2DataTemp();
+LEGACY_API BOOL CalculateCondition(PCHAR szCond, DOUBLE &Result);
+LEGACY_API BOOL DelayConditionMet();
+LEGACY_API BOOL MacroDataIsLive(PCHAR szText);
 LEGACY_API bool AddMQ2TypeExtension(const char* typeName, MQ2Type* extension);
 LEGACY_API bool RemoveMQ2TypeExtension(const char* typeName, MQ2Type* extension);
 #endif
@@ -486,6 +496,7 @@ EQLIB_API PCHAR GetEQPath(PCHAR szBuffer, size_t len);
 
 #define DoCommand(pspawninfo,commandtoexecute) HideDoCommand(pspawninfo,commandtoexecute,FromPlugin)
 LEGACY_API VOID HideDoCommand(PSPAWNINFO pChar, PCHAR szLine, BOOL delayed);
+LEGACY_API VOID DoMacroLine(PSPAWNINFO pChar, PMACROBLOCK pBlock);
 #define EzCommand(commandtoexecute) DoCommand((PSPAWNINFO)pLocalPlayer,commandtoexecute)
 
 EQLIB_API VOID AppendCXStr(PCXSTR *cxstr, PCHAR text);
@@ -643,18 +654,30 @@ EQLIB_API bool LoH_HT_Ready();
 #ifndef ISXEQ
 LEGACY_API PCHAR GetFuncParam(PCHAR szMacroLine, DWORD ParamNum, PCHAR szParamName, size_t ParamNameLen, PCHAR szParamType, size_t ParamTypeLen);
 //LEGACY_API PCHAR GetFuncParam(PCHAR szMacroLine, DWORD ParamNum, PCHAR szParamName, PCHAR szParamType);
+LEGACY_API PCHAR GetSubParam(PMACROBLOCK pSub, DWORD ParamNum, PCHAR szParamName, size_t ParamNameLen, MQ2Type *&pType);
 LEGACY_API PDATAVAR FindMQ2DataVariable(PCHAR Name);
+LEGACY_API PDATAVAR FindMQ2DataVariableByAtom(DWORD Atom);
 LEGACY_API BOOL AddMQ2DataVariable(PCHAR Name, PCHAR Index, MQ2Type *pType, PDATAVAR *ppHead, PCHAR Default);
 LEGACY_API BOOL AddMQ2DataVariableFromData(PCHAR Name, PCHAR Index, MQ2Type *pType, PDATAVAR *ppHead, MQ2TYPEVAR Default);
+// sets a variable (or array element) from text. use this rather than FromString, it tells
+// whatever is waiting on gVariableGeneration that a variable changed
+LEGACY_API BOOL SetMQ2DataVariable(MQ2Type *pType, MQ2VARPTR &VarPtr, PCHAR szValue);
 LEGACY_API PDATAVAR *FindVariableScope(PCHAR Name);
 LEGACY_API BOOL DeleteMQ2DataVariable(PCHAR Name);
 LEGACY_API VOID ClearMQ2DataVariables(PDATAVAR *ppHead);
+LEGACY_API VOID MoveMQ2DataVariables(PDATAVAR *ppFrom, PDATAVAR *ppTo);
+LEGACY_API PEVENTQUEUE FindMacroEvent(PCHAR szSubName);
+LEGACY_API VOID RemoveMacroEvent(PEVENTQUEUE pEvent);
+LEGACY_API VOID FreeMacroEvent(PEVENTQUEUE pEvent);
+LEGACY_API VOID FlushMacroEvents(PCHAR szSubName);
 LEGACY_API VOID NewDeclareVar(PSPAWNINFO pChar, PCHAR szLine);
 LEGACY_API VOID NewDeleteVarCmd(PSPAWNINFO pChar, PCHAR szLine);
 LEGACY_API VOID NewVarset(PSPAWNINFO pChar, PCHAR szLine);
 LEGACY_API VOID NewVarcalc(PSPAWNINFO pChar, PCHAR szLine);
 LEGACY_API VOID NewVardata(PSPAWNINFO pChar, PCHAR szLine);
 LEGACY_API VOID DropTimers(VOID);
+LEGACY_API VOID SetMQ2Timer(PMQTIMER pTimer, ULONG Ticks);
+LEGACY_API ULONG GetMQ2TimerValue(PMQTIMER pTimer);
 #endif
 
 /*                 */
@@ -761,7 +784,41 @@ EQLIB_API VOID UseAbility(char *sAbility);
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 
 
+// calculator operators, the order is the one CalcOpPrecedence is indexed by
+enum eCalcOp
+{
+	CO_NUMBER = 0,
+	CO_OPENPARENS = 1,
+	CO_CLOSEPARENS = 2,
+	CO_ADD = 3,
+	CO_SUBTRACT = 4,
+	CO_MULTIPLY = 5,
+	CO_DIVIDE = 6,
+	CO_IDIVIDE = 7,
+	CO_LAND = 8,
+	CO_AND = 9,
+	CO_LOR = 10,
+	CO_OR = 11,
+	CO_XOR = 12,
+	CO_EQUAL = 13,
+	CO_NOTEQUAL = 14,
+	CO_GREATER = 15,
+	CO_NOTGREATER = 16,
+	CO_LESS = 17,
+	CO_NOTLESS = 18,
+	CO_MODULUS = 19,
+	CO_POWER = 20,
+	CO_LNOT = 21,
+	CO_NOT = 22,
+	CO_SHL = 23,
+	CO_SHR = 24,
+	CO_NEGATE = 25,
+	CO_TOTAL = 26,
+};
+extern int CalcOpPrecedence[CO_TOTAL];
+
 LEGACY_API BOOL Calculate(PCHAR szFormula, DOUBLE& Dest);
+LEGACY_API BOOL CalculateInt64(PCHAR szFormula, __int64 &Dest);
 
 
 #ifndef ISXEQ
@@ -33,18 +33,9 @@ BOOL DoNextCommand()
 	if ((!pChar) || (gZoning)/* || (gDelayZoning)*/) return FALSE;
 	if (((gFaceAngle != 10000.0f) || (gLookAngle != 10000.0f)) && (TurnNotDone)) return FALSE;
 	if (IsMouseWaiting()) return FALSE;
-	if (gDelay && gDelayCondition[0])
+	if (gDelay && gDelayCondition[0] && GetCharInfo())
 	{
-		CHAR szCond[MAX_STRING];
-		strcpy_s(szCond, gDelayCondition);
-		ParseMacroParameter(GetCharInfo()->pSpawn, szCond);
-		DOUBLE Result;
-		if (!Calculate(szCond, Result))
-		{
-			FatalError("Failed to parse /delay condition '%s', non-numeric encountered", szCond);
-			return false;
-		}
-		if (Result != 0)
+		if (DelayConditionMet())
 		{
 			DebugSpewNoFile("/delay ending early, conditions met");
 			gDelay = 0;
@@ -60,7 +51,7 @@ BOOL DoNextCommand()
 		PMACROBLOCK ThisMacroBlock = gMacroBlock;
 #endif
 		gMacroBlock->MacroCmd = 0;
-		DoCommand(pChar, (PCHAR)gMacroBlock->Line.c_str());
+		DoMacroLine(pChar, gMacroBlock);
 		if (gMacroBlock) {
 #ifdef MQ2_PROFILING
 			LARGE_INTEGER AfterCommand;
@@ -269,6 +260,64 @@ void Pulse()
 }
 
 
+#ifndef ISXEQ
+// #turbo budget: instead of a fixed number of lines, run lines each frame until the
+// budget is spent.  The budget is the smaller of the one the macro asked for and a
+// tenth of the recent frame time, so a struggling client gets more of each frame back.
+#define TURBO_MIN_BUDGET 100
+#define TURBO_FRAME_SHARE 10
+
+static LONGLONG TurboMicroseconds(LARGE_INTEGER &Start, LARGE_INTEGER &End)
+{
+	static LARGE_INTEGER Frequency = { 0 };
+	if (!Frequency.QuadPart)
+		QueryPerformanceFrequency(&Frequency);
+	return (End.QuadPart - Start.QuadPart) * 1000000 / Frequency.QuadPart;
+}
+
+// returns FALSE if MQ2 is unloading
+static BOOL RunMacroBudgeted()
+{
+	static LARGE_INTEGER LastFrame = { 0 };
+	static LONGLONG FrameAverage = 0;
+	LARGE_INTEGER Start, Now;
+	QueryPerformanceCounter(&Start);
+	if (LastFrame.QuadPart) {
+		LONGLONG Frame = TurboMicroseconds(LastFrame, Start);
+		// a long gap means the macro wasn't running, don't let it skew the average
+		if (Frame < 1000000)
+			FrameAverage = FrameAverage ? (FrameAverage * 7 + Frame) / 8 : Frame;
+	}
+	LastFrame = Start;
+
+	LONGLONG Budget = gTurboBudget;
+	if (FrameAverage && FrameAverage / TURBO_FRAME_SHARE < Budget)
+		Budget = FrameAverage / TURBO_FRAME_SHARE;
+	if (Budget < TURBO_MIN_BUDGET)
+		Budget = TURBO_MIN_BUDGET;
+	gTurboFrameBudget = (DWORD)Budget;
+
+	DWORD Lines = 0;
+	LONGLONG Elapsed = 0;
+	while (bRunNextCommand) {
+		if (!DoNextCommand())
+			break;
+		Lines++;
+		if (gbUnload)
+			return FALSE;
+		QueryPerformanceCounter(&Now);
+		Elapsed = TurboMicroseconds(Start, Now);
+		if (Elapsed >= Budget)
+			break;
+	}
+	// the last line alone took the frame well past its budget
+	if (Elapsed > Budget + Budget / 2)
+		gTurboOverruns++;
+	gTurboLinesPerFrame = (gTurboLinesPerFrame * 7.0f + (FLOAT)Lines) / 8.0f;
+	return TRUE;
+}
+#endif
+
 int Heartbeat()
 {
 	if (gbUnload) {
@@ -288,6 +337,8 @@ int Heartbeat()
 	ULONGLONG Tick = MQGetTickCount64();
 
 	BeatCount++;
+	// anything remembered for the last frame (frame-stable members) is stale now
+	gFrameGeneration++;
 
 	if (bFirstHeartBeat)
 	{
@@ -303,6 +354,7 @@ int Heartbeat()
 		if (gDelay>0) gDelay--;
 		DropTimers();
 	}
+	ReleaseMQ2DataTemp();
 #endif
 	if (!gStringTableFixed && pStringTable) // Please dont remove the second condition
 	{
@@ -375,7 +427,11 @@ int Heartbeat()
 		delete gDelayedCommands;
 		gDelayedCommands = pNext;
 	}
-	while (bRunNextCommand) {
+	if (gTurbo && gTurboBudget) {
+		if (!RunMacroBudgeted())
+			return 1;
+	}
+	else while (bRunNextCommand) {
 		if (!DoNextCommand())
 			break;
 		if (gbUnload)
@@ -19,6 +19,9 @@ GNU General Public License for more details.
 #endif
 
 #include "MQ2Main.h"
+
+#include <limits.h>
+
 #define TS template <unsigned int _Size>
 #ifndef ISXEQ_LEGACY
 // ***************************************************************************
@@ -809,12 +812,9 @@ PCHAR GetFilenameFromFullPath(PCHAR Filename)
 
 PCHAR GetSubFromLine(PMACROBLOCK pLine, PCHAR szSub, size_t Sublen)
 {
-	while (pLine != NULL) {
-		if (!_strnicmp(pLine->Line.c_str(), "sub ", 4)) {
-			strcpy_s(szSub, Sublen, pLine->Line.c_str() + 4);
-			return szSub;
-		}
-		pLine = pLine->pPrev;
+	if (pLine && pLine->pSub) {
+		strcpy_s(szSub, Sublen, pLine->pSub->Line.c_str() + 4);
+		return szSub;
 	}
 	strcpy_s(szSub, Sublen, "NULL");
 	return szSub;
@@ -4793,37 +4793,6 @@ return true;
 }
 /**/
 #ifndef ISXEQ
-enum eCalcOp
-{
-	CO_NUMBER = 0,
-	CO_OPENPARENS = 1,
-	CO_CLOSEPARENS = 2,
-	CO_ADD = 3,
-	CO_SUBTRACT = 4,
-	CO_MULTIPLY = 5,
-	CO_DIVIDE = 6,
-	CO_IDIVIDE = 7,
-	CO_LAND = 8,
-	CO_AND = 9,
-	CO_LOR = 10,
-	CO_OR = 11,
-	CO_XOR = 12,
-	CO_EQUAL = 13,
-	CO_NOTEQUAL = 14,
-	CO_GREATER = 15,
-	CO_NOTGREATER = 16,
-	CO_LESS = 17,
-	CO_NOTLESS = 18,
-	CO_MODULUS = 19,
-	CO_POWER = 20,
-	CO_LNOT = 21,
-	CO_NOT = 22,
-	CO_SHL = 23,
-	CO_SHR = 24,
-	CO_NEGATE = 25,
-	CO_TOTAL = 26,
-};
-
 int CalcOpPrecedence[CO_TOTAL] =
 {
 	0,
@@ -4854,196 +4823,435 @@ int CalcOpPrecedence[CO_TOTAL] =
 	12,//negate
 };
 
+#define CALC_INT53 9007199254740992LL // 2^53, integers up to here are exact as a DOUBLE
+
 struct _CalcOp
 {
 	eCalcOp Op;
 	DOUBLE Value;
+	__int64 Int;  // CO_NUMBER, exactly
+	BOOL IsInt;   // Int holds the number
 };
 
-BOOL EvaluateRPN(_CalcOp *pList, int Size, DOUBLE &Result)
+// pStack needs room for one more value than there are CO_NUMBER ops in pList
+static BOOL EvaluateRPN(_CalcOp *pList, int Size, DOUBLE *pStack, DOUBLE &Result)
 {
 	if (!Size)
 		return 0;
-	int StackSize = (sizeof(DOUBLE)*(Size / 2 + 2));
-	if(DOUBLE *pStack = (DOUBLE*)malloc(StackSize)) {
-		int nStack = 0;
-		#define StackEmpty() (nStack==0)
-		#define StackTop() (pStack[nStack])
-		#define StackSetTop(do_assign) {pStack[nStack]##do_assign;}
-		#define StackPush(val) {nStack++;pStack[nStack]=val;}
-		#define StackPop() {if (!nStack) {FatalError("Illegal arithmetic in calculation");free(pStack);return 0;};nStack--;}
-
-		#define BinaryIntOp(op) {int RightSide=(int)StackTop();StackPop();StackSetTop(=(DOUBLE)(((int)StackTop())##op##RightSide));}
-		#define BinaryOp(op) {DOUBLE RightSide=StackTop();StackPop();StackSetTop(=StackTop()##op##RightSide);}
-		#define BinaryAssign(op) {DOUBLE RightSide=StackTop();StackPop();StackSetTop(##op##=RightSide);}
-
-		#define UnaryIntOp(op) {StackSetTop(=op##((int)StackTop()));}
-		#define UnaryOp(op)    {StackSetTop(=op##(StackTop()));}
-		for (int i = 0; i < Size; i++)
+	int nStack = 0;
+	pStack[0] = 0;
+	#define StackEmpty() (nStack==0)
+	#define StackTop() (pStack[nStack])
+	#define StackSetTop(do_assign) {pStack[nStack]##do_assign;}
+	#define StackPush(val) {nStack++;pStack[nStack]=val;}
+	#define StackPop() {if (!nStack) {FatalError("Illegal arithmetic in calculation");return 0;};nStack--;}
+
+	#define BinaryIntOp(op) {int RightSide=(int)StackTop();StackPop();StackSetTop(=(DOUBLE)(((int)StackTop())##op##RightSide));}
+	#define BinaryOp(op) {DOUBLE RightSide=StackTop();StackPop();StackSetTop(=StackTop()##op##RightSide);}
+	#define BinaryAssign(op) {DOUBLE RightSide=StackTop();StackPop();StackSetTop(##op##=RightSide);}
+
+	#define UnaryIntOp(op) {StackSetTop(=op##((int)StackTop()));}
+	#define UnaryOp(op)    {StackSetTop(=op##(StackTop()));}
+	for (int i = 0; i < Size; i++)
+	{
+		switch (pList[i].Op)
 		{
-			switch (pList[i].Op)
+		case CO_NUMBER:
+			StackPush(pList[i].Value);
+			break;
+		case CO_ADD:
+			BinaryAssign(+);
+			break;
+		case CO_MULTIPLY:
+			BinaryAssign(*);
+			break;
+		case CO_SUBTRACT:
+			BinaryAssign(-);
+			break;
+		case CO_NEGATE:
+			UnaryOp(-);
+			break;
+		case CO_DIVIDE:
+			if (StackTop())
 			{
-			case CO_NUMBER:
-				StackPush(pList[i].Value);
-				break;
-			case CO_ADD:
-				BinaryAssign(+);
-				break;
-			case CO_MULTIPLY:
-				BinaryAssign(*);
-				break;
-			case CO_SUBTRACT:
-				BinaryAssign(-);
-				break;
-			case CO_NEGATE:
-				UnaryOp(-);
-				break;
-			case CO_DIVIDE:
-				if (StackTop())
-				{
-					BinaryAssign(/ );
-				}
-				else
-				{
-					//printf("Divide by zero error\n");
-					FatalError("Divide by zero in calculation");
-					free(pStack);
-					return false;
-				}
-				break;
-			case CO_IDIVIDE://TODO: SPECIAL HANDLING
+				BinaryAssign(/ );
+			}
+			else
 			{
-				int Right = (int)StackTop();
-				if (Right)
-				{
-					StackPop();
-					int Left = (int)StackTop();
-					Left /= Right;
-					StackSetTop(= Left);
-				}
-				else
-				{
-					//printf("Integer divide by zero error\n");
-					FatalError("Divide by zero in calculation");
-					free(pStack);
-					return false;
-				}
+				//printf("Divide by zero error\n");
+				FatalError("Divide by zero in calculation");
+				return false;
 			}
 			break;
-			case CO_MODULUS://TODO: SPECIAL HANDLING
+		case CO_IDIVIDE://TODO: SPECIAL HANDLING
+		{
+			int Right = (int)StackTop();
+			if (Right)
 			{
-				int Right = (int)StackTop();
-				if (Right)
-				{
-					StackPop();
-					int Left = (int)StackTop();
-					Left %= Right;
-					StackSetTop(= Left);
-				}
-				else
-				{
-					//printf("Modulus by zero error\n");
-					FatalError("Modulus by zero in calculation");
-					free(pStack);
-					return false;
-				}
+				StackPop();
+				int Left = (int)StackTop();
+				Left /= Right;
+				StackSetTop(= Left);
 			}
-			break;
-			case CO_LAND:
-				BinaryOp(&&);
-				break;
-			case CO_LOR:
-				BinaryOp(|| );
-				break;
-			case CO_EQUAL:
-				BinaryOp(== );
-				break;
-			case CO_NOTEQUAL:
-				BinaryOp(!= );
-				break;
-			case CO_GREATER:
-				BinaryOp(>);
-				break;
-			case CO_NOTGREATER:
-				BinaryOp(<= );
-				break;
-			case CO_LESS:
-				BinaryOp(<);
-				break;
-			case CO_NOTLESS:
-				BinaryOp(>= );
-				break;
-			case CO_SHL:
-				BinaryIntOp(<< );
-				break;
-			case CO_SHR:
-				BinaryIntOp(>> );
-				break;
-			case CO_AND:
-				BinaryIntOp(&);
-				break;
-			case CO_OR:
-				BinaryIntOp(| );
-				break;
-			case CO_XOR:
-				BinaryIntOp(^);
-				break;
-			case CO_LNOT:
-				UnaryIntOp(!);
-				break;
-			case CO_NOT:
-				UnaryIntOp(~);
-				break;
-			case CO_POWER:
+			else
+			{
+				//printf("Integer divide by zero error\n");
+				FatalError("Divide by zero in calculation");
+				return false;
+			}
+		}
+		break;
+		case CO_MODULUS://TODO: SPECIAL HANDLING
+		{
+			int Right = (int)StackTop();
+			if (Right)
 			{
-				DOUBLE RightSide = StackTop();
 				StackPop();
-				StackSetTop(= pow(StackTop(), RightSide));
+				int Left = (int)StackTop();
+				Left %= Right;
+				StackSetTop(= Left);
 			}
-			break;
+			else
+			{
+				//printf("Modulus by zero error\n");
+				FatalError("Modulus by zero in calculation");
+				return false;
 			}
 		}
-		Result = StackTop();
-
-		#undef StackEmpty
-		#undef StackTop
-		#undef StackPush
-		#undef StackPop
-		try {
-			free(pStack);
-			return true;
-		} catch(...) {
-			MessageBox(NULL, "Tried to free the stack in EvaluateRPN but failed", "MQ2 Error", MB_SYSTEMMODAL | MB_OK);
+		break;
+		case CO_LAND:
+			BinaryOp(&&);
+			break;
+		case CO_LOR:
+			BinaryOp(|| );
+			break;
+		case CO_EQUAL:
+			BinaryOp(== );
+			break;
+		case CO_NOTEQUAL:
+			BinaryOp(!= );
+			break;
+		case CO_GREATER:
+			BinaryOp(>);
+			break;
+		case CO_NOTGREATER:
+			BinaryOp(<= );
+			break;
+		case CO_LESS:
+			BinaryOp(<);
+			break;
+		case CO_NOTLESS:
+			BinaryOp(>= );
+			break;
+		case CO_SHL:
+			BinaryIntOp(<< );
+			break;
+		case CO_SHR:
+			BinaryIntOp(>> );
+			break;
+		case CO_AND:
+			BinaryIntOp(&);
+			break;
+		case CO_OR:
+			BinaryIntOp(| );
+			break;
+		case CO_XOR:
+			BinaryIntOp(^);
+			break;
+		case CO_LNOT:
+			UnaryIntOp(!);
+			break;
+		case CO_NOT:
+			UnaryIntOp(~);
+			break;
+		case CO_POWER:
+		{
+			DOUBLE RightSide = StackTop();
+			StackPop();
+			StackSetTop(= pow(StackTop(), RightSide));
+		}
+		break;
 		}
 	}
-	return false;
+	Result = StackTop();
+	return true;
+
+	#undef StackEmpty
+	#undef StackTop
+	#undef StackSetTop
+	#undef StackPush
+	#undef StackPop
 }
 
-BOOL FastCalculate(PCHAR szFormula, DOUBLE &Result)
+// Exact evaluation
+//
+// For formulas whose answer goes into an int64. Integer operands stay __int64 over the
+// full 64 bits and a value only becomes a DOUBLE for a fraction, a division with a
+// remainder, a negative or oversized power, or an overflow. \ % << >> & | ^^ ! ~ work
+// on __int64 instead of int, shift counts taken mod 64 the way the CPU does.
+struct _CalcValue
+{
+	BOOL IsInt;
+	union
+	{
+		__int64 Int;
+		DOUBLE Value;
+	};
+};
+
+static inline DOUBLE CalcDouble(_CalcValue &V)
 {
-	//DebugSpew("FastCalculate(%s)",szFormula);
-	if (!szFormula || !szFormula[0])
+	return V.IsInt ? (DOUBLE)V.Int : V.Value;
+}
+
+static inline __int64 CalcInt64(_CalcValue &V)
+{
+	return V.IsInt ? V.Int : (__int64)V.Value;
+}
+
+static inline BOOL CalcTrue(_CalcValue &V)
+{
+	return V.IsInt ? V.Int != 0 : V.Value != 0;
+}
+
+static inline VOID SetCalcInt(_CalcValue &V, __int64 Int)
+{
+	V.IsInt = true;
+	V.Int = Int;
+}
+
+static inline VOID SetCalcDouble(_CalcValue &V, DOUBLE Value)
+{
+	V.IsInt = false;
+	V.Value = Value;
+}
+
+static inline BOOL MultiplyOverflows(__int64 Left, __int64 Right)
+{
+	if (!Left || !Right)
 		return false;
-	int Length = (int)strlen(szFormula);
-	int MaxOps = (Length + 1);
-	int ListSize = sizeof(_CalcOp)*MaxOps;
-	int StackSize = sizeof(eCalcOp)*MaxOps;
-	_CalcOp *pOpList = (_CalcOp *)malloc(ListSize);
-	eCalcOp *pStack = (eCalcOp *)malloc(StackSize);
-	memset(pOpList, 0, ListSize);
-	memset(pStack, 0, StackSize);
-	int nOps = 0;
+	if (Left > 0)
+		return Right > 0 ? Left > _I64_MAX / Right : Right < _I64_MIN / Left;
+	return Right > 0 ? Left < _I64_MIN / Right : Right < _I64_MAX / Left;
+}
+
+// pStack needs room for one more value than there are CO_NUMBER ops in pList
+static BOOL EvaluateExactRPN(_CalcOp *pList, int Size, _CalcValue *pStack, _CalcValue &Result)
+{
+	if (!Size)
+		return 0;
 	int nStack = 0;
+	SetCalcInt(pStack[0], 0);
+	#define StackPop() {if (!nStack) {FatalError("Illegal arithmetic in calculation");return 0;};nStack--;}
+	for (int i = 0; i < Size; i++)
+	{
+		_CalcOp &Op = pList[i];
+		_CalcValue &Top = pStack[nStack];
+		switch (Op.Op)
+		{
+		case CO_NUMBER:
+			nStack++;
+			if (Op.IsInt)
+				SetCalcInt(pStack[nStack], Op.Int);
+			else
+				SetCalcDouble(pStack[nStack], Op.Value);
+			continue;
+		case CO_OPENPARENS:
+		case CO_CLOSEPARENS:
+			continue;
+		case CO_NEGATE:
+			if (!Top.IsInt)
+				Top.Value = -Top.Value;
+			else if (Top.Int == _I64_MIN)
+				SetCalcDouble(Top, -(DOUBLE)Top.Int);
+			else
+				Top.Int = -Top.Int;
+			continue;
+		case CO_LNOT:
+			SetCalcInt(Top, !CalcInt64(Top));
+			continue;
+		case CO_NOT:
+			SetCalcInt(Top, ~CalcInt64(Top));
+			continue;
+		case CO_DIVIDE:
+			if (!CalcTrue(Top))
+			{
+				FatalError("Divide by zero in calculation");
+				return false;
+			}
+			break;
+		case CO_IDIVIDE:
+		case CO_MODULUS:
+			if (!CalcInt64(Top))
+			{
+				FatalError(Op.Op == CO_IDIVIDE ? "Divide by zero in calculation" : "Modulus by zero in calculation");
+				return false;
+			}
+			break;
+		}
+		_CalcValue Right = Top;
+		StackPop();
+		_CalcValue &Left = pStack[nStack];
+		BOOL BothInt = Left.IsInt && Right.IsInt;
+		switch (Op.Op)
+		{
+		case CO_ADD:
+			if (BothInt && (Right.Int > 0 ? Left.Int <= _I64_MAX - Right.Int : Left.Int >= _I64_MIN - Right.Int))
+				Left.Int += Right.Int;
+			else
+				SetCalcDouble(Left, CalcDouble(Left) + CalcDouble(Right));
+			break;
+		case CO_SUBTRACT:
+			if (BothInt && (Right.Int < 0 ? Left.Int <= _I64_MAX + Right.Int : Left.Int >= _I64_MIN + Right.Int))
+				Left.Int -= Right.Int;
+			else
+				SetCalcDouble(Left, CalcDouble(Left) - CalcDouble(Right));
+			break;
+		case CO_MULTIPLY:
+			if (BothInt && !MultiplyOverflows(Left.Int, Right.Int))
+				Left.Int *= Right.Int;
+			else
+				SetCalcDouble(Left, CalcDouble(Left) * CalcDouble(Right));
+			break;
+		case CO_DIVIDE:
+			if (BothInt && !(Left.Int == _I64_MIN && Right.Int == -1) && !(Left.Int % Right.Int))
+				Left.Int /= Right.Int;
+			else
+				SetCalcDouble(Left, CalcDouble(Left) / CalcDouble(Right));
+			break;
+		case CO_IDIVIDE:
+		{
+			__int64 Divisor = CalcInt64(Right);
+			__int64 Dividend = CalcInt64(Left);
+			if (Dividend == _I64_MIN && Divisor == -1)
+				SetCalcDouble(Left, -(DOUBLE)Dividend);
+			else
+				SetCalcInt(Left, Dividend / Divisor);
+		}
+		break;
+		case CO_MODULUS:
+		{
+			__int64 Divisor = CalcInt64(Right);
+			SetCalcInt(Left, Divisor == -1 ? 0 : CalcInt64(Left) % Divisor);
+		}
+		break;
+		case CO_LAND:
+			SetCalcInt(Left, CalcTrue(Left) && CalcTrue(Right));
+			break;
+		case CO_LOR:
+			SetCalcInt(Left, CalcTrue(Left) || CalcTrue(Right));
+			break;
+		case CO_EQUAL:
+			SetCalcInt(Left, BothInt ? Left.Int == Right.Int : CalcDouble(Left) == CalcDouble(Right));
+			break;
+		case CO_NOTEQUAL:
+			SetCalcInt(Left, BothInt ? Left.Int != Right.Int : CalcDouble(Left) != CalcDouble(Right));
+			break;
+		case CO_GREATER:
+			SetCalcInt(Left, BothInt ? Left.Int > Right.Int : CalcDouble(Left) > CalcDouble(Right));
+			break;
+		case CO_NOTGREATER:
+			SetCalcInt(Left, BothInt ? Left.Int <= Right.Int : CalcDouble(Left) <= CalcDouble(Right));
+			break;
+		case CO_LESS:
+			SetCalcInt(Left, BothInt ? Left.Int < Right.Int : CalcDouble(Left) < CalcDouble(Right));
+			break;
+		case CO_NOTLESS:
+			SetCalcInt(Left, BothInt ? Left.Int >= Right.Int : CalcDouble(Left) >= CalcDouble(Right));
+			break;
+		case CO_SHL:
+			SetCalcInt(Left, (__int64)((unsigned __int64)CalcInt64(Left) << (CalcInt64(Right) & 63)));
+			break;
+		case CO_SHR:
+			SetCalcInt(Left, CalcInt64(Left) >> (CalcInt64(Right) & 63));
+			break;
+		case CO_AND:
+			SetCalcInt(Left, CalcInt64(Left) & CalcInt64(Right));
+			break;
+		case CO_OR:
+			SetCalcInt(Left, CalcInt64(Left) | CalcInt64(Right));
+			break;
+		case CO_XOR:
+			SetCalcInt(Left, CalcInt64(Left) ^ CalcInt64(Right));
+			break;
+		case CO_POWER:
+			if (BothInt && Right.Int >= 0)
+			{
+				// by squaring, as long as it fits
+				__int64 Base = Left.Int;
+				__int64 Power = 1;
+				__int64 Exponent = Right.Int;
+				BOOL Fits = true;
+				while (Exponent && Fits)
+				{
+					if (Exponent & 1)
+					{
+						if (MultiplyOverflows(Power, Base))
+							Fits = false;
+						else
+							Power *= Base;
+					}
+					Exponent >>= 1;
+					if (Exponent && Fits)
+					{
+						if (MultiplyOverflows(Base, Base))
+							Fits = false;
+						else
+							Base *= Base;
+					}
+				}
+				if (Fits)
+				{
+					Left.Int = Power;
+					break;
+				}
+			}
+			SetCalcDouble(Left, pow(CalcDouble(Left), CalcDouble(Right)));
+			break;
+		}
+	}
+	Result = pStack[nStack];
+	return true;
+	#undef StackPop
+}
+
+// a number in a formula, also kept as an integer when it is one
+static VOID SetCalcNumber(_CalcOp &Op, PCHAR szToken)
+{
+	Op.Op = CO_NUMBER;
+	Op.Value = atof(szToken);
+	Op.IsInt = false;
+	if (!strchr(szToken, '.') && strlen(szToken) <= 18)
+	{
+		// atof would round anything past 2^53
+		Op.Int = _atoi64(szToken);
+		Op.IsInt = true;
+	}
+	else if (Op.Value == floor(Op.Value) && fabs(Op.Value) <= CALC_INT53)
+	{
+		Op.Int = (__int64)Op.Value;
+		Op.IsInt = true;
+	}
+}
+
+// turns szFormula into RPN in pOpList, with pStack holding the pending operators.
+// both need room for Length+1 entries.
+static BOOL ParseRPN(PCHAR szFormula, int Length, _CalcOp *pOpList, eCalcOp *pStack, int &nOps)
+{
+	nOps = 0;
+	int nStack = 0;
+	pStack[0] = CO_NUMBER;
 	char *pEnd = szFormula + Length;
-	char CurrentToken[MAX_STRING] = { 0 };
+	char CurrentToken[MAX_STRING];
 	char *pToken = &CurrentToken[0];
+	*pToken = 0;
 
 #define OpToList(op) {pOpList[nOps].Op=op;nOps++;}
-#define ValueToList(val) {pOpList[nOps].Value=val;nOps++;}
+#define ValueToList(text) {SetCalcNumber(pOpList[nOps],text);nOps++;}
 #define StackEmpty() (nStack==0)
 #define StackTop() (pStack[nStack])
 #define StackPush(op) {nStack++;pStack[nStack]=op;}
-#define StackPop() {if (!nStack) {FatalError("Illegal arithmetic in calculation");free(pOpList);free(pStack);return 0;} nStack--;}
+#define StackPop() {if (!nStack) {FatalError("Illegal arithmetic in calculation");return 0;} nStack--;}
 #define HasPrecedence(a,b) (CalcOpPrecedence[a]>=CalcOpPrecedence[b])
 #define MoveStack(op)  \
     { \
@@ -5054,7 +5262,7 @@ BOOL FastCalculate(PCHAR szFormula, DOUBLE &Result)
     } \
     }
 
-#define FinishString() {if (pToken!=&CurrentToken[0]) {*pToken=0;ValueToList(atof(CurrentToken));pToken=&CurrentToken[0];*pToken=0;}}
+#define FinishString() {if (pToken!=&CurrentToken[0]) {*pToken=0;ValueToList(CurrentToken);pToken=&CurrentToken[0];*pToken=0;}}
 #define NewOp(op) {FinishString();MoveStack(op);StackPush(op);}
 #define NextChar(ch) {*pToken=ch;pToken++;}
 
@@ -5174,8 +5382,6 @@ BOOL FastCalculate(PCHAR szFormula, DOUBLE &Result)
 			{
 				//printf("Unparsable: '%c'\n",*pCur);
 				// error
-				free(pOpList);
-				free(pStack);
 				return false;
 			}
 			break;
@@ -5229,8 +5435,6 @@ BOOL FastCalculate(PCHAR szFormula, DOUBLE &Result)
 			//printf("Unparsable: '%c'\n",*pCur);
 			FatalError("Unparsable in Calculation: '%c'", *pCur);
 			// unparsable
-			free(pOpList);
-			free(pStack);
 			return false;
 		}
 		break;
@@ -5244,7 +5448,6 @@ BOOL FastCalculate(PCHAR szFormula, DOUBLE &Result)
 		OpToList(StackTop());
 		StackPop();
 	}
-	free(pStack);
 	/*
 	for (int i = 0 ; i < nOps ; i++)
 	{
@@ -5254,16 +5457,159 @@ BOOL FastCalculate(PCHAR szFormula, DOUBLE &Result)
 	printf("Value: %f\n",pOpList[i].Value);
 	}
 	/**/
-	BOOL Ret = EvaluateRPN(pOpList, nOps, Result);
+	return true;
+
+#undef OpToList
+#undef ValueToList
+#undef StackEmpty
+#undef StackTop
+#undef StackPush
+#undef StackPop
+#undef HasPrecedence
+#undef MoveStack
+#undef FinishString
+#undef NewOp
+#undef NextChar
+}
+
+// Compiled calculations
+//
+// Each formula FastCalculate sees is parsed into RPN once and kept, keyed by its text.
+// Programs and their keys are carved out of fixed arenas and the whole cache is dropped
+// when either arena or the slot table fills up, so neither a hit nor a miss allocates.
+// Formulas that fail to parse aren't kept, they report their error every time.
+#define CALC_CACHE_SLOTS 1024 // power of 2, at most half used
+#define CALC_ARENA_OPS 8192
+#define CALC_ARENA_TEXT 32768
+
+struct _CalcProgram
+{
+	DWORD Hash;
+	PCHAR szFormula;
+	_CalcOp *pOps;
+	int nOps;
+};
+
+static _CalcProgram CalcPrograms[CALC_CACHE_SLOTS];
+static int nCalcPrograms = 0;
+static _CalcOp CalcOpArena[CALC_ARENA_OPS];
+static int nCalcOpArena = 0;
+static CHAR CalcTextArena[CALC_ARENA_TEXT];
+static int nCalcTextArena = 0;
+
+static DWORD HashCalcFormula(PCHAR szFormula)
+{
+	// FNV-1a
+	DWORD Hash = 2166136261u;
+	for (PCHAR pPos = szFormula; *pPos; pPos++)
+	{
+		Hash ^= (unsigned char)*pPos;
+		Hash *= 16777619u;
+	}
+	return Hash;
+}
+
+static _CalcProgram *GetCalcProgram(PCHAR szFormula, int Length)
+{
+	DWORD Hash = HashCalcFormula(szFormula);
+	DWORD Slot = Hash & (CALC_CACHE_SLOTS - 1);
+	for (; CalcPrograms[Slot].szFormula; Slot = (Slot + 1) & (CALC_CACHE_SLOTS - 1))
+	{
+		if (CalcPrograms[Slot].Hash == Hash && !strcmp(CalcPrograms[Slot].szFormula, szFormula))
+			return &CalcPrograms[Slot];
+	}
+	if ((nCalcPrograms + 1) * 2 > CALC_CACHE_SLOTS || nCalcOpArena + Length + 1 > CALC_ARENA_OPS || nCalcTextArena + Length + 1 > CALC_ARENA_TEXT)
+	{
+		ZeroMemory(CalcPrograms, sizeof(CalcPrograms));
+		nCalcPrograms = 0;
+		nCalcOpArena = 0;
+		nCalcTextArena = 0;
+		Slot = Hash & (CALC_CACHE_SLOTS - 1);
+	}
+	_CalcOp *pOps = &CalcOpArena[nCalcOpArena];
+	eCalcOp Stack[MAX_STRING];
+	int nOps;
+	if (!ParseRPN(szFormula, Length, pOps, Stack, nOps))
+		return 0;
+	_CalcProgram &Program = CalcPrograms[Slot];
+	Program.Hash = Hash;
+	Program.szFormula = &CalcTextArena[nCalcTextArena];
+	memcpy(Program.szFormula, szFormula, Length + 1);
+	Program.pOps = pOps;
+	Program.nOps = nOps;
+	nCalcTextArena += Length + 1;
+	nCalcOpArena += nOps;
+	nCalcPrograms++;
+	return &Program;
+}
+
+static BOOL CalculateExact(PCHAR szFormula, _CalcValue &Result)
+{
+	if (!szFormula || !szFormula[0])
+		return false;
+	int Length = (int)strlen(szFormula);
+	if (Length < MAX_STRING)
+	{
+		_CalcProgram *pProgram = GetCalcProgram(szFormula, Length);
+		if (!pProgram)
+			return false;
+		// a number takes at least one character and two numbers need an operator between
+		// them, so a formula that fits in MAX_STRING never has more than MAX_STRING/2
+		_CalcValue Stack[MAX_STRING / 2 + 2];
+		return EvaluateExactRPN(pProgram->pOps, pProgram->nOps, Stack, Result);
+	}
+	// too long for the program cache
+	_CalcOp *pOpList = (_CalcOp *)malloc(sizeof(_CalcOp)*(Length + 1));
+	eCalcOp *pStack = (eCalcOp *)malloc(sizeof(eCalcOp)*(Length + 1));
+	int nOps = 0;
+	BOOL Ret = ParseRPN(szFormula, Length, pOpList, pStack, nOps);
+	free(pStack);
+	if (Ret)
+	{
+		_CalcValue *pValues = (_CalcValue *)malloc(sizeof(_CalcValue)*(nOps + 1));
+		Ret = EvaluateExactRPN(pOpList, nOps, pValues, Result);
+		free(pValues);
+	}
 	free(pOpList);
 	return Ret;
 }
 
-BOOL Calculate(PCHAR szFormula, DOUBLE &Result)
+BOOL FastCalculate(PCHAR szFormula, DOUBLE &Result)
 {
-	CHAR Buffer[MAX_STRING] = { 0 };
-	strcpy_s(Buffer, szFormula);
-	_strupr_s(Buffer);
+	//DebugSpew("FastCalculate(%s)",szFormula);
+	if (!szFormula || !szFormula[0])
+		return false;
+	int Length = (int)strlen(szFormula);
+	if (Length < MAX_STRING)
+	{
+		_CalcProgram *pProgram = GetCalcProgram(szFormula, Length);
+		if (!pProgram)
+			return false;
+		// see CalculateExact for the size
+		DOUBLE Stack[MAX_STRING / 2 + 2];
+		return EvaluateRPN(pProgram->pOps, pProgram->nOps, Stack, Result);
+	}
+	// too long for the program cache
+	_CalcOp *pOpList = (_CalcOp *)malloc(sizeof(_CalcOp)*(Length + 1));
+	eCalcOp *pStack = (eCalcOp *)malloc(sizeof(eCalcOp)*(Length + 1));
+	int nOps = 0;
+	BOOL Ret = ParseRPN(szFormula, Length, pOpList, pStack, nOps);
+	free(pStack);
+	if (Ret)
+	{
+		DOUBLE *pValues = (DOUBLE *)malloc(sizeof(DOUBLE)*(nOps + 1));
+		Ret = EvaluateRPN(pOpList, nOps, pValues, Result);
+		free(pValues);
+	}
+	free(pOpList);
+	return Ret;
+}
+
+// uppercases szFormula into Buffer and spells out NULL, TRUE and FALSE as numbers
+static VOID PrepareFormula(PCHAR Buffer, SIZE_T BufferSize, PCHAR szFormula)
+{
+	strcpy_s(Buffer, BufferSize, szFormula);
+	_strupr_s(Buffer, BufferSize);
 	while (PCHAR pNull = strstr(Buffer, "NULL"))
 	{
 		pNull[0] = '0';
@@ -5286,11 +5632,38 @@ BOOL Calculate(PCHAR szFormula, DOUBLE &Result)
 		pFalse[3] = '0';
 		pFalse[4] = '0';
 	}
+}
+
+BOOL Calculate(PCHAR szFormula, DOUBLE &Result)
+{
+	CHAR Buffer[MAX_STRING] = { 0 };
+	PrepareFormula(Buffer, sizeof(Buffer), szFormula);
 	BOOL Ret;
 	//Benchmark(bmCalculate,Ret=ActualCalculate(Buffer,Result));
 	Benchmark(bmCalculate, Ret = FastCalculate(Buffer, Result));
 	return Ret;
 }
+
+// Calculate with exact 64 bit integers, for a result that goes into an int64. One that
+// had to go through a DOUBLE is truncated the way /varcalc always handed it over.
+BOOL CalculateInt64(PCHAR szFormula, __int64 &Result)
+{
+	CHAR Buffer[MAX_STRING] = { 0 };
+	PrepareFormula(Buffer, sizeof(Buffer), szFormula);
+	_CalcValue Value;
+	BOOL Ret;
+	Benchmark(bmCalculate, Ret = CalculateExact(Buffer, Value));
+	if (!Ret)
+		return false;
+	if (Value.IsInt)
+		Result = Value.Int;
+	else
+	{
+		sprintf_s(Buffer, "%f", Value.Value);
+		Result = _atoi64(Buffer);
+	}
+	return true;
+}
 #endif
 
 bool PlayerHasAAAbility(DWORD AAIndex)